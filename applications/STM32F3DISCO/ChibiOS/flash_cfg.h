@@ -21,6 +21,5 @@
 
 #define FLASH_PAGE_COUNT 128
 #define FLASH_PAGE_SIZE 2048
-#define FLASH_PAGE_SIZE_2B 1024
 
 #endif
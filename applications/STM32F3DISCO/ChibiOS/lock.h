@@ -0,0 +1,114 @@
+/*
+ *  lock.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VEEPROM_LOCK_H
+#define VEEPROM_LOCK_H
+
+#include "ch.h"
+
+/*
+ * ChibiOS has no reader/writer lock, it's built of a mutex and a condition
+ * variable (CH_CFG_USE_MUTEXES and CH_CFG_USE_CONDVARS). Readers hold the
+ * mutex only to count themselves, a writer holds it for the whole call
+ * and waits until the readers leave.
+ */
+typedef struct {
+    mutex_t mutex;
+    condition_variable_t readers_gone;
+    int readers;
+} veeprom_lock_t;
+
+
+static inline void veeprom_lock_init(veeprom_lock_t *l) {
+    chMtxObjectInit(&l->mutex);
+    chCondObjectInit(&l->readers_gone);
+    l->readers = 0;
+}
+
+
+static inline void veeprom_read_lock(veeprom_lock_t *l) {
+    chMtxLock(&l->mutex);
+    l->readers++;
+    chMtxUnlock(&l->mutex);
+}
+
+
+static inline void veeprom_read_unlock(veeprom_lock_t *l) {
+    chMtxLock(&l->mutex);
+    if (--l->readers == 0)
+        chCondBroadcast(&l->readers_gone);
+    chMtxUnlock(&l->mutex);
+}
+
+
+static inline void veeprom_write_lock(veeprom_lock_t *l) {
+    chMtxLock(&l->mutex);
+    while (l->readers > 0)
+        chCondWait(&l->readers_gone);
+}
+
+
+#define VEEPROM_LOCK_INIT(l)        veeprom_lock_init(l)
+#define VEEPROM_LOCK_DESTROY(l)
+#define VEEPROM_READ_LOCK(l)        veeprom_read_lock(l)
+#define VEEPROM_READ_UNLOCK(l)      veeprom_read_unlock(l)
+#define VEEPROM_WRITE_LOCK(l)       veeprom_write_lock(l)
+#define VEEPROM_WRITE_UNLOCK(l)     chMtxUnlock(&(l)->mutex)
+#define VEEPROM_YIELD()             chThdYield()
+
+
+/*
+ * Queue and worker thread of VEEPROM_ASYNC. The worker runs the whole
+ * write path: the allocation plan takes 3 bytes per page (384 B with
+ * 128 pages), then either the write stage or the LZSS buffers, about
+ * a dozen frames and the debug log formatting. With the exception frame
+ * of the FPU that is about 1.3 KB, the rest is margin.
+ */
+#ifndef VEEPROM_THREAD_STACK
+#define VEEPROM_THREAD_STACK 2048
+#endif
+
+typedef mutex_t veeprom_mutex_t;
+typedef condition_variable_t veeprom_cond_t;
+typedef struct {
+    thread_t *tp;
+    THD_WORKING_AREA(wa, VEEPROM_THREAD_STACK);
+} veeprom_thread_t;
+
+/* a mutex initialized statically, e.g. of a flash driver */
+#define VEEPROM_MUTEX_DECL(m)       MUTEX_DECL(m)
+#define VEEPROM_MUTEX_INIT(m)       chMtxObjectInit(m)
+#define VEEPROM_MUTEX_DESTROY(m)
+#define VEEPROM_MUTEX_LOCK(m)       chMtxLock(m)
+#define VEEPROM_MUTEX_UNLOCK(m)     chMtxUnlock(m)
+#define VEEPROM_COND_INIT(c)        chCondObjectInit(c)
+#define VEEPROM_COND_DESTROY(c)
+/* ChibiOS waits releasing the mutex locked last, it's m */
+#define VEEPROM_COND_WAIT(c, m)     chCondWait(c)
+#define VEEPROM_COND_BROADCAST(c)   chCondBroadcast(c)
+
+#define VEEPROM_THREAD(name, arg)   void name(void *arg)
+#define VEEPROM_THREAD_EXIT()       return
+/* 0 if the thread is started */
+#define VEEPROM_THREAD_START(t, fn, arg) \
+    (((t)->tp = chThdCreateStatic((t)->wa, sizeof((t)->wa), NORMALPRIO, fn, arg)) == NULL)
+#define VEEPROM_THREAD_JOIN(t)      chThdWait((t)->tp)
+
+#define VEEPROM_TIME_US()           ((uint32_t)ST2US(chVTGetSystemTimeX()))
+
+#endif
@@ -74,9 +74,13 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f30x_flash.h"
+#include "flash.h"
 #include "errnum.h"
 #include "errmsg.h"
 #include "wrappers.h"
+#ifdef VEEPROM_THREADS
+#include "lock.h"
+#endif
 
 
 /** @addtogroup STM32F30x_StdPeriph_Driver
@@ -1151,32 +1155,146 @@ FLASH_Status FLASH_WaitForLastOperation(uint32_t Timeout)
 }
 
 
-int flash_write_short(uint16_t data, uint16_t *p) {
-    FLASH_Status status = FLASH_ProgramHalfWord((uint32_t)p, data);
-    if (status == FLASH_COMPLETE)
-        return OK;
-    return ERROR_FLASH_WRITE;
+/*
+ * STM32F3 flash is programmed by half-words only, wider chunks are
+ * programmed half-word by half-word starting from the low one.
+ */
+#define FLASH_CHUNK_HALFWORDS (sizeof(flash_chunk_t) / sizeof(uint16_t))
+
+/* FLASH->CR and the erase in progress are shared by all stores */
+#ifdef VEEPROM_THREADS
+static VEEPROM_MUTEX_DECL(m_flash_mutex);
+#define FLASH_MUTEX_LOCK()    VEEPROM_MUTEX_LOCK(&m_flash_mutex)
+#define FLASH_MUTEX_UNLOCK()  VEEPROM_MUTEX_UNLOCK(&m_flash_mutex)
+#else
+#define FLASH_MUTEX_LOCK()
+#define FLASH_MUTEX_UNLOCK()
+#endif
+
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    return flash_write_range(p, &data, 1);
 }
 
-int flash_write_int(uint32_t data, uint32_t *p) {
-    FLASH_Status status = FLASH_ProgramWord((uint32_t)p, data);
+/* PG stays set while the range is programmed */
+static int flash_write_range_unlocked(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    FLASH_Status status = FLASH_WaitForLastOperation(FLASH_ER_PRG_TIMEOUT);
+    if (status != FLASH_COMPLETE)
+        return ERROR_FLASH_WRITE;
+
+    /* an erase started by flash_erase_start() is over */
+    FLASH->CR &= ~FLASH_CR_PER;
+
+    __IO uint16_t *hw_dst = (__IO uint16_t*)dst;
+    const uint16_t *hw_src = (const uint16_t*)src;
+    int halfwords = chunks * FLASH_CHUNK_HALFWORDS;
+
+    FLASH->CR |= FLASH_CR_PG;
+    for (int i = 0; i < halfwords && status == FLASH_COMPLETE; i++) {
+        hw_dst[i] = hw_src[i];
+        status = FLASH_WaitForLastOperation(FLASH_ER_PRG_TIMEOUT);
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+
     if (status == FLASH_COMPLETE)
         return OK;
     return ERROR_FLASH_WRITE;
 }
 
-int flash_zero_short(uint16_t *p) {
-    return flash_write_short(0, p);
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    FLASH_MUTEX_LOCK();
+    int ret = flash_write_range_unlocked(dst, src, chunks);
+    FLASH_MUTEX_UNLOCK();
+    return ret;
 }
 
-int flash_erase_page(uint16_t *p) {
+int flash_erase_page(flash_chunk_t *p) {
+    FLASH_MUTEX_LOCK();
     FLASH_Status status = FLASH_ErasePage((uint32_t)p);
+    FLASH_MUTEX_UNLOCK();
     if (status == FLASH_COMPLETE)
         return OK;
     return ERROR_FLASH_ERASE;
 }
 
 
+#ifdef VEEPROM_ASYNC_ERASE
+/*
+ * The erase is started as by FLASH_ErasePage() but not waited for,
+ * flash_erase_poll() checks BSY and EOP. Programming and the next erase
+ * wait for the end of the erase by themselves. An erase which fails
+ * while another store starts its own one is kept in m_failed until its
+ * page is polled, a second failure meanwhile stays in the SR flags of
+ * m_erasing and the new erase isn't started.
+ */
+static flash_chunk_t *m_erasing;
+static flash_chunk_t *m_failed;
+
+#define FLASH_SR_ERRORS (FLASH_SR_PGERR | FLASH_SR_WRPERR)
+
+int flash_erase_start(flash_chunk_t *p) {
+    FLASH_MUTEX_LOCK();
+    FLASH_Status status = FLASH_WaitForLastOperation(FLASH_ER_PRG_TIMEOUT);
+    FLASH->CR &= ~FLASH_CR_PER;
+    if (m_erasing != NULL && (status != FLASH_COMPLETE || !(FLASH->SR & FLASH_SR_EOP))) {
+        if (m_failed != NULL) {
+            FLASH_MUTEX_UNLOCK();
+            return ERROR_FLASH_ERASE;
+        }
+        m_failed = m_erasing;
+        FLASH->SR = FLASH_SR_ERRORS;
+        status = FLASH_COMPLETE;
+    }
+    m_erasing = NULL;
+    if (status != FLASH_COMPLETE) {
+        FLASH_MUTEX_UNLOCK();
+        return ERROR_FLASH_ERASE;
+    }
+
+    FLASH->SR = FLASH_SR_EOP;
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR  = (uint32_t)p;
+    FLASH->CR |= FLASH_CR_STRT;
+    m_erasing = p;
+    FLASH_MUTEX_UNLOCK();
+    return OK;
+}
+
+static int flash_erase_poll_unlocked(flash_chunk_t *p, int *done) {
+    *done = 1;
+    if (m_failed == p) {
+        m_failed = NULL;
+        return ERROR_FLASH_ERASE;
+    }
+    /* otherwise it's over, finished by the start of another erase */
+    if (m_erasing != p)
+        return OK;
+
+    FLASH_Status status = FLASH_GetStatus();
+    if (status == FLASH_BUSY) {
+        *done = 0;
+        return OK;
+    }
+
+    m_erasing = NULL;
+    FLASH->CR &= ~FLASH_CR_PER;
+    if (status == FLASH_COMPLETE && (FLASH->SR & FLASH_SR_EOP)) {
+        FLASH->SR = FLASH_SR_EOP;
+        return OK;
+    }
+    /* the flags would fail the next operation */
+    FLASH->SR = FLASH_SR_ERRORS;
+    return ERROR_FLASH_ERASE;
+}
+
+int flash_erase_poll(flash_chunk_t *p, int *done) {
+    FLASH_MUTEX_LOCK();
+    int ret = flash_erase_poll_unlocked(p, done);
+    FLASH_MUTEX_UNLOCK();
+    return ret;
+}
+#endif
+
+
 /**
   * @}
   */ 
@@ -0,0 +1,117 @@
+/*
+ *  bench_chunks.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Cost of records for the chunk width the benchmark is built with
+ * (VEEPROM_CHUNK_WIDTH). The flash is kept in RAM, the backend below
+ * counts program operations (one per chunk), flash_write_range() calls
+ * and page erases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eeprom.h"
+#include "errnum.h"
+
+#define ROUNDS 200
+
+static flash_chunk_t m_flash[FLASH_PAGE_COUNT * FLASH_PAGE_CHUNKS];
+static long m_programs;
+static long m_ranges;
+static long m_erases;
+static veeprom_t m_veeprom;
+
+
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    *p = data;
+    m_programs++;
+    return OK;
+}
+
+
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+    m_programs += chunks;
+    m_ranges++;
+    return OK;
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    memset(p, 0xFF, FLASH_PAGE_SIZE);
+    m_erases++;
+    return OK;
+}
+
+
+static double elapsed_us(clock_t start) {
+    return (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC / ROUNDS;
+}
+
+
+static void bench(int length) {
+    static uint8_t data[8192];
+    static uint8_t buf[8192 + sizeof(flash_chunk_t)];
+    for (int i = 0; i < length; i++)
+        data[i] = rand() & 0xFF;
+
+    memset(m_flash, 0xFF, sizeof(m_flash));
+    if (veeprom_init(&m_veeprom, m_flash, 0) != OK) {
+        printf("%6d init failed\n", length);
+        return;
+    }
+
+    m_programs = m_ranges = m_erases = 0;
+    clock_t start = clock();
+    for (int i = 0; i < ROUNDS; i++) {
+        if (veeprom_write(&m_veeprom, 1, data, length) != OK) {
+            printf("%6d write failed\n", length);
+            veeprom_deinit(&m_veeprom);
+            return;
+        }
+    }
+    double write_us = elapsed_us(start);
+
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    start = clock();
+    for (int i = 0; i < ROUNDS; i++)
+        veeprom_read(&m_veeprom, &read_buf);
+    double read_us = elapsed_us(start);
+
+    if (read_buf.length != length || memcmp(buf, data, length) != 0)
+        printf("%6d read failed\n", length);
+    else
+        printf("%6d %8.1f %7.1f %6.2f %9.1f %8.1f\n", length,
+                (double)m_programs / ROUNDS, (double)m_ranges / ROUNDS,
+                (double)m_erases / ROUNDS, write_us, read_us);
+    veeprom_deinit(&m_veeprom);
+}
+
+
+int main() {
+    printf("chunk=%d bits page=%d\n", VEEPROM_CHUNK_WIDTH, FLASH_PAGE_SIZE);
+    printf("%6s %8s %7s %6s %9s %8s\n", "bytes", "programs", "ranges",
+            "erases", "write_us", "read_us");
+
+    int lengths[] = { 2, 16, 64, 256, 1000, 4000, 8000 };
+    for (int i = 0; i < sizeof(lengths) / sizeof(*lengths); i++)
+        bench(lengths[i]);
+    return 0;
+}
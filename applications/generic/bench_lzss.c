@@ -0,0 +1,123 @@
+/*
+ *  bench_lzss.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * CPU cost of record compression against flash operations it saves.
+ * For every sample the number of pages (erases) and chunks (program
+ * operations) of the stored record is calculated the same way as
+ * veeprom_record_pages() does it for pages of one size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eeprom.h"
+#include "lzss.h"
+
+#define ROUNDS 200
+
+static uint8_t m_packed[VEEPROM_MAX_LENGTH];
+static int m_packed_size;
+
+
+static int sink(void *context, uint8_t *buf, int length) {
+    memcpy(m_packed + m_packed_size, buf, length);
+    m_packed_size += length;
+    return 0;
+}
+
+
+static int record_chunks(int length) {
+    return TO_CHUNKS(length) + 1 + VEEPROM_CHECKSUM_CHUNKS;
+}
+
+
+static int record_pages(int length) {
+    int free_page_space = FLASH_PAGE_CHUNKS - VEEPROM_HEADER_CHUNKS - 1;
+    return (record_chunks(length) + free_page_space - 1) / free_page_space;
+}
+
+
+static double elapsed_us(clock_t start) {
+    return (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC / ROUNDS;
+}
+
+
+static void bench(const char *name, uint8_t *data, int length) {
+    clock_t start = clock();
+    for (int i = 0; i < ROUNDS; i++) {
+        m_packed_size = 0;
+        veeprom_lzss_compress(data, length, sink, NULL);
+    }
+    double compress_us = elapsed_us(start);
+
+    static uint8_t out[VEEPROM_MAX_LENGTH];
+    veeprom_lzss_decoder_t decoder;
+    start = clock();
+    for (int i = 0; i < ROUNDS; i++) {
+        veeprom_lzss_decoder_init(&decoder, out, length);
+        veeprom_lzss_decode(&decoder, m_packed, m_packed_size);
+    }
+    double decompress_us = elapsed_us(start);
+
+    if (decoder.pos != length || memcmp(out, data, length) != 0) {
+        printf("%-10s decoding failed\n", name);
+        return;
+    }
+
+    int stored = sizeof(flash_chunk_t) + m_packed_size;
+    if (stored >= length)
+        stored = length;
+
+    printf("%-10s %6d %6d %5.2f %4d %4d %6d %6d %9.1f %9.1f\n", name, length, stored,
+            (double)length / stored, record_pages(length), record_pages(stored),
+            record_chunks(length), record_chunks(stored), compress_us, decompress_us);
+}
+
+
+int main() {
+    static uint8_t data[8192];
+    int length = sizeof(data);
+
+    printf("window=%d page=%d chunk=%d\n", VEEPROM_LZSS_WINDOW, FLASH_PAGE_SIZE,
+            (int)sizeof(flash_chunk_t));
+    printf("%-10s %6s %6s %5s %4s %4s %6s %6s %9s %9s\n", "sample", "bytes", "stored",
+            "ratio", "pg", "pg'", "prog", "prog'", "comp_us", "dec_us");
+
+    const char *text = "{\"sensor\": \"temp\", \"id\": 17, \"value\": 21.5, \"unit\": \"C\"},\n";
+    for (int i = 0; i < length; i++)
+        data[i] = text[i % strlen(text)];
+    bench("json", data, length);
+
+    /* structs with a few fields set */
+    memset(data, 0, sizeof(data));
+    for (int i = 0; i < length; i += 32) {
+        data[i] = i / 32;
+        data[i + 4] = 0x10;
+        data[i + 12] = rand() & 0xFF;
+    }
+    bench("sparse", data, length);
+
+    for (int i = 0; i < length; i++)
+        data[i] = rand() & 0xFF;
+    bench("random", data, length);
+
+    bench("short", (uint8_t*)text, strlen(text));
+    return 0;
+}
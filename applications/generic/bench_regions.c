@@ -0,0 +1,131 @@
+/*
+ *  bench_regions.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Waits for erases while hot records are read every round and rewritten
+ * every WRITE_EVERY rounds, cold records are rewritten from time to time.
+ * Between the rounds the application does other work for WORK_US. Built
+ * for a single-bank flash (bench_regions1) and for two banks with
+ * VEEPROM_DUAL_REGION (bench_regions2). The flash simulation makes reads
+ * (flash_sim_access() before veeprom_read()) and programming of the bank
+ * being erased wait for the end of the erase.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "eeprom.h"
+#include "errnum.h"
+
+#define ROUNDS 4000
+#define WRITE_EVERY 4
+#define WORK_US 500
+#define HOT_IDS 4
+#define COLD_IDS 20
+
+void* flash_init(int fd);
+int flash_uninit(void *p);
+int flash_sim_access(const void *p);
+extern long flash_sim_stalls;
+extern uint64_t flash_sim_stall_us;
+
+static veeprom_t m_veeprom;
+
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+int main() {
+    FILE *image = tmpfile();
+    int size = FLASH_PAGE_SIZE * FLASH_PAGE_COUNT;
+    static uint8_t erased[FLASH_PAGE_SIZE * FLASH_PAGE_COUNT];
+    memset(erased, 0xFF, sizeof(erased));
+    if (image == NULL || write(fileno(image), erased, size) != size) {
+        printf("image failed\n");
+        return 1;
+    }
+    flash_chunk_t *flash = flash_init(fileno(image));
+    if (flash == NULL || veeprom_init(&m_veeprom, flash, 0) != OK) {
+        printf("init failed\n");
+        return 1;
+    }
+
+    uint8_t data[300];
+    uint8_t buf[sizeof(data) + sizeof(flash_chunk_t)];
+    memset(data, 0, sizeof(data));
+    for (int id = 1; id <= HOT_IDS; id++)
+        veeprom_write(&m_veeprom, id, data, 48);
+    for (int id = 100; id < 100 + COLD_IDS; id++)
+        veeprom_write(&m_veeprom, id, data, sizeof(data));
+
+    long stalls = flash_sim_stalls;
+    uint64_t stall_us = flash_sim_stall_us;
+    long read_stalls = 0;
+    uint64_t read_stall_us = 0;
+    struct timespec work = { 0, WORK_US * 1000 };
+    double start = now_ms();
+    for (int i = 0; i < ROUNDS; i++) {
+        int ret = OK;
+        memset(data, i, sizeof(data));
+        if (i % WRITE_EVERY == 0)
+            ret = veeprom_write(&m_veeprom, 1 + i / WRITE_EVERY % HOT_IDS, data, 48);
+        if (ret == OK && i % (8 * WRITE_EVERY) == 0)
+            ret = veeprom_write(&m_veeprom, 100 + rand() % COLD_IDS, data, sizeof(data));
+        if (ret == OK)
+            ret = veeprom_poll(&m_veeprom);
+        if (ret != OK) {
+            printf("write failed %d\n", ret);
+            return 1;
+        }
+
+        for (int j = 0; j < HOT_IDS; j++) {
+            veeprom_read_t read_buf = { .id = 1 + rand() % HOT_IDS, .buf = buf,
+                .buf_size = sizeof(buf) };
+            long read_stalls_before = flash_sim_stalls;
+            uint64_t read_stall_us_before = flash_sim_stall_us;
+            flash_sim_access(veeprom_find(&m_veeprom, read_buf.id));
+            read_stalls += flash_sim_stalls - read_stalls_before;
+            read_stall_us += flash_sim_stall_us - read_stall_us_before;
+            veeprom_read(&m_veeprom, &read_buf);
+        }
+        nanosleep(&work, NULL);
+    }
+    double elapsed = now_ms() - start;
+    stalls = flash_sim_stalls - stalls - read_stalls;
+    stall_us = flash_sim_stall_us - stall_us - read_stall_us;
+
+#ifdef VEEPROM_DUAL_REGION
+    printf("dual region, ");
+#else
+    printf("single region, ");
+#endif
+    printf("%d rounds: %.0f ms\n", ROUNDS, elapsed);
+    printf("read stalls %ld (%.1f ms), write stalls %ld (%.1f ms)\n",
+            read_stalls, read_stall_us / 1000.0, stalls, stall_us / 1000.0);
+
+    veeprom_deinit(&m_veeprom);
+    flash_uninit(flash);
+    fclose(image);
+    return 0;
+}
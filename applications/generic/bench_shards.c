@@ -0,0 +1,106 @@
+/*
+ *  bench_shards.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Mount time of the same records spread over 1, 2, 4 and 8 shards in
+ * equal parts of the flash. The flash is kept in RAM and is built larger
+ * (FLASH_PAGE_COUNT) so that the scan of the pages dominates the mount.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shard.h"
+#include "errnum.h"
+
+#define MOUNTS 20
+#define RECORDS 1500
+
+static flash_chunk_t m_flash[FLASH_PAGE_COUNT * FLASH_PAGE_CHUNKS];
+static veeprom_shards_t m_shards;
+
+
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    *p = data;
+    return OK;
+}
+
+
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+    return OK;
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    memset(p, 0xFF, FLASH_PAGE_SIZE);
+    return OK;
+}
+
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static void bench(int count) {
+    static uint8_t data[1500];
+    veeprom_region_t regions[VEEPROM_SHARDS_MAX];
+    int pages = FLASH_PAGE_COUNT / count;
+    for (int i = 0; i < count; i++)
+        regions[i] = (veeprom_region_t){ m_flash + i * pages * FLASH_PAGE_CHUNKS, pages };
+
+    memset(m_flash, 0xFF, sizeof(m_flash));
+    if (veeprom_shards_init(&m_shards, regions, count) != OK) {
+        printf("%6d init failed\n", count);
+        return;
+    }
+    srand(1);
+    for (int id = 1; id <= RECORDS; id++) {
+        int length = 200 + rand() % (sizeof(data) - 200);
+        if (veeprom_shards_write(&m_shards, id, data, length) != OK) {
+            printf("%6d write failed\n", count);
+            veeprom_shards_deinit(&m_shards);
+            return;
+        }
+    }
+    veeprom_shards_deinit(&m_shards);
+
+    double start = now_ms();
+    for (int i = 0; i < MOUNTS; i++) {
+        if (veeprom_shards_init(&m_shards, regions, count) != OK) {
+            printf("%6d mount failed\n", count);
+            return;
+        }
+        veeprom_shards_deinit(&m_shards);
+    }
+    printf("%6d %10.2f\n", count, (now_ms() - start) / MOUNTS);
+}
+
+
+int main() {
+    printf("pages=%d records=%d\n", FLASH_PAGE_COUNT, RECORDS);
+    printf("%6s %10s\n", "shards", "mount_ms");
+
+    for (int count = 1; count <= 8; count *= 2)
+        bench(count);
+    return 0;
+}
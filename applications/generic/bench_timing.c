@@ -0,0 +1,119 @@
+/*
+ *  bench_timing.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Device time of writes and reads of records for the part modelled by
+ * the flash simulation (FLASH_SIM_STM32F3, FLASH_SIM_STM32F4,
+ * FLASH_SIM_SPI_NOR): the virtual clock of the simulation per operation
+ * and the throughput it gives.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "eeprom.h"
+#include "errnum.h"
+
+#define ROUNDS 200
+
+void* flash_init(int fd);
+int flash_uninit(void *p);
+int flash_sim_read(const void *p, int bytes);
+extern uint64_t flash_sim_clock_ns;
+extern long flash_sim_erases;
+
+static veeprom_t m_veeprom;
+
+
+static void bench(flash_chunk_t *flash, int length) {
+    static uint8_t data[4000];
+    static uint8_t buf[sizeof(data) + sizeof(flash_chunk_t)];
+    for (int i = 0; i < length; i++)
+        data[i] = rand() & 0xFF;
+
+    memset(flash, 0xFF, FLASH_PAGE_SIZE * FLASH_PAGE_COUNT);
+    if (veeprom_init(&m_veeprom, flash, 0) != OK) {
+        printf("%6d init failed\n", length);
+        return;
+    }
+
+    uint64_t start_ns = flash_sim_clock_ns;
+    long erases = flash_sim_erases;
+    for (int i = 0; i < ROUNDS; i++) {
+        if (veeprom_write(&m_veeprom, 1, data, length) != OK) {
+            printf("%6d write failed\n", length);
+            veeprom_deinit(&m_veeprom);
+            return;
+        }
+    }
+    double write_us = (flash_sim_clock_ns - start_ns) / 1000.0 / ROUNDS;
+    double erases_per_write = (double)(flash_sim_erases - erases) / ROUNDS;
+
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    start_ns = flash_sim_clock_ns;
+    for (int i = 0; i < ROUNDS; i++) {
+        veeprom_read(&m_veeprom, &read_buf);
+        flash_sim_read(veeprom_find(&m_veeprom, 1), read_buf.length);
+    }
+    double read_us = (flash_sim_clock_ns - start_ns) / 1000.0 / ROUNDS;
+
+    if (read_buf.length != length || memcmp(buf, data, length) != 0)
+        printf("%6d read failed\n", length);
+    else
+        printf("%6d %6.2f %10.1f %9.1f %8.1f %9.0f\n", length, erases_per_write,
+                write_us, length / write_us * 1000000 / 1024, read_us,
+                length / read_us * 1000000 / 1024);
+    veeprom_deinit(&m_veeprom);
+}
+
+
+int main() {
+    FILE *image = tmpfile();
+    int size = FLASH_PAGE_SIZE * FLASH_PAGE_COUNT;
+    static uint8_t erased[FLASH_PAGE_SIZE * FLASH_PAGE_COUNT];
+    memset(erased, 0xFF, sizeof(erased));
+    if (image == NULL || write(fileno(image), erased, size) != size) {
+        printf("image failed\n");
+        return 1;
+    }
+    flash_chunk_t *flash = flash_init(fileno(image));
+    if (flash == NULL) {
+        printf("init failed\n");
+        return 1;
+    }
+
+#if defined(FLASH_SIM_STM32F4)
+    printf("STM32F4");
+#elif defined(FLASH_SIM_SPI_NOR)
+    printf("SPI NOR");
+#else
+    printf("STM32F3");
+#endif
+    printf(", chunk=%d bits page=%d\n", VEEPROM_CHUNK_WIDTH, FLASH_PAGE_SIZE);
+    printf("%6s %6s %10s %9s %8s %9s\n", "bytes", "erases", "write_us", "write_kBs",
+            "read_us", "read_kBs");
+
+    int lengths[] = { 2, 16, 64, 256, 1000, 4000 };
+    for (int i = 0; i < sizeof(lengths) / sizeof(*lengths); i++)
+        bench(flash, lengths[i]);
+
+    flash_uninit(flash);
+    fclose(image);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ *  coro_demo.cpp
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Thousands of emulated devices on a few threads: every device has its
+ * own store of DEVICE_PAGES pages in RAM and rewrites and reads back its
+ * records. Prints the wall time against the flash time the devices spent
+ * waiting, which is far longer as they wait concurrently.
+ */
+
+#define VEEPROM_CORO_SIM_BACKEND
+#include "veeprom_coro.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#define DEVICE_PAGES 8
+#define ROUNDS 20
+
+
+static std::atomic<int> m_failures;
+static std::atomic<uint64_t> m_flash_ns;
+
+
+static veeprom::task<> device(veeprom::executor &ex, flash_chunk_t *flash, int n) {
+    veeprom::store s(ex);
+    int ret = co_await s.mount(flash, DEVICE_PAGES);
+    for (int r = 0; r < ROUNDS && ret == OK; r++) {
+        uint8_t data[32];
+        std::memset(data, n + r, sizeof(data));
+        flash_chunk_t id = 1 + r % 4;
+        ret = co_await s.write(id, data);
+        if (ret != OK)
+            break;
+
+        uint8_t buf[sizeof(data) + sizeof(flash_chunk_t)];
+        veeprom::read_result res = co_await s.read(id, buf);
+        ret = res.status;
+        if (ret == OK && (res.length != int(sizeof(data)) || std::memcmp(buf, data, sizeof(data)) != 0))
+            ret = ERROR_DCNSTY;
+    }
+    if (ret != OK)
+        m_failures++;
+    m_flash_ns += s.flash_ns();
+}
+
+
+int main(int argc, char **argv) {
+    int devices = argc > 1 ? std::atoi(argv[1]) : 2000;
+    unsigned threads = argc > 2 ? std::atoi(argv[2]) : 4;
+
+    size_t chunks = DEVICE_PAGES * FLASH_PAGE_CHUNKS;
+    std::unique_ptr<flash_chunk_t[]> flash(new flash_chunk_t[chunks * devices]);
+    std::memset(flash.get(), 0xFF, chunks * devices * sizeof(flash_chunk_t));
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        veeprom::executor ex(threads);
+        for (int n = 0; n < devices; n++)
+            ex.spawn(device(ex, flash.get() + n * chunks, n));
+        ex.wait_idle();
+    }
+    double wall_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%d devices, %u threads, %d rounds: %.0f ms, flash time %.0f ms, %d failed\n",
+            devices, threads, ROUNDS, wall_ms, m_flash_ns / 1e6, m_failures.load());
+    return m_failures != 0;
+}
@@ -19,8 +19,24 @@
 #ifndef VEEPROM_FLASH_CFG_H
 #define VEEPROM_FLASH_CFG_H
 
+#if FLASH_MIXED_SECTORS
+/*
+ * Sectors of different sizes: { offset, size } in bytes from the start
+ * of the VEEPROM area, ascending. Every sector is a page, FLASH_PAGE_COUNT
+ * is the number of sectors and FLASH_PAGE_SIZE is the largest size.
+ * The layout follows 16K/64K/128K sectors of STM32F4 scaled down.
+ */
+#define FLASH_SECTORS { \
+    {0, 1024}, {1024, 1024}, {2048, 1024}, {3072, 1024}, \
+    {4096, 4096}, {8192, 8192}, {16384, 8192}, {24576, 8192} }
+#define FLASH_PAGE_COUNT 8
+#define FLASH_PAGE_SIZE 8192
+#else
+/* benchmarks build larger flash */
+#ifndef FLASH_PAGE_COUNT
 #define FLASH_PAGE_COUNT 128
+#endif
 #define FLASH_PAGE_SIZE 1024
-#define FLASH_PAGE_SIZE_2B 512
+#endif
 
 #endif
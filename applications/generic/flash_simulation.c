@@ -19,47 +19,324 @@
 #include <sys/mman.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "wrappers.h"
 #include "flash_cfg.h"
 #include "flash.h"
 #include "errnum.h"
 #include "errmsg.h"
+#ifdef VEEPROM_THREADS
+#include "lock.h"
+#endif
 
+#define FLASH_SIM_LENGTH (FLASH_PAGE_SIZE * FLASH_PAGE_COUNT)
 
-int flash_write_short(uint16_t data, uint16_t *p) {
-    *p = data;  
-    return 0;
+#define FLASH_SIM_DEVICES 8
+#ifdef FLASH_SECTORS
+static const flash_sector_t m_sectors[] = FLASH_SECTORS;
+#endif
+/* Every mapped image is a device, sectors and banks are located from its start */
+static uint8_t *m_devices[FLASH_SIM_DEVICES];
+
+/*
+ * Timing model of the part. Nothing waits for it, durations of operations
+ * are added to the virtual clock flash_sim_clock_ns: FLASH_SIM_PROGRAM_NS
+ * per FLASH_SIM_PROGRAM_BITS programmed, FLASH_SIM_ERASE_US per page erase
+ * and FLASH_SIM_READ_NS per FLASH_SIM_READ_BITS read (wait states of
+ * the bus). The simulation doesn't see reads, the application reports
+ * them by flash_sim_read(). Parts: FLASH_SIM_STM32F3 (default),
+ * FLASH_SIM_STM32F4, FLASH_SIM_SPI_NOR, every value may be set alone.
+ */
+#if defined(FLASH_SIM_STM32F4)
+/* word programming at 2.7-3.6 V, 16 KB sector, 168 MHz with 5 wait states */
+#define FLASH_SIM_PART_PROGRAM_BITS 32
+#define FLASH_SIM_PART_PROGRAM_NS 16000
+#define FLASH_SIM_PART_ERASE_US 250000
+#define FLASH_SIM_PART_READ_BITS 128
+#define FLASH_SIM_PART_READ_NS 36
+#elif defined(FLASH_SIM_SPI_NOR)
+/* serial NOR: 256-byte page in 0.4 ms, 4 KB sector, single SPI at 50 MHz */
+#define FLASH_SIM_PART_PROGRAM_BITS 8
+#define FLASH_SIM_PART_PROGRAM_NS 1600
+#define FLASH_SIM_PART_ERASE_US 45000
+#define FLASH_SIM_PART_READ_BITS 8
+#define FLASH_SIM_PART_READ_NS 160
+#else
+/* STM32F3: half-word programming, 2 KB page, 72 MHz with 2 wait states */
+#define FLASH_SIM_PART_PROGRAM_BITS 16
+#define FLASH_SIM_PART_PROGRAM_NS 52500
+#define FLASH_SIM_PART_ERASE_US 20000
+#define FLASH_SIM_PART_READ_BITS 64
+#define FLASH_SIM_PART_READ_NS 42
+#endif
+
+#ifndef FLASH_SIM_PROGRAM_BITS
+#define FLASH_SIM_PROGRAM_BITS FLASH_SIM_PART_PROGRAM_BITS
+#endif
+#ifndef FLASH_SIM_PROGRAM_NS
+#define FLASH_SIM_PROGRAM_NS FLASH_SIM_PART_PROGRAM_NS
+#endif
+#ifndef FLASH_SIM_ERASE_US
+#define FLASH_SIM_ERASE_US FLASH_SIM_PART_ERASE_US
+#endif
+#ifndef FLASH_SIM_READ_BITS
+#define FLASH_SIM_READ_BITS FLASH_SIM_PART_READ_BITS
+#endif
+#ifndef FLASH_SIM_READ_NS
+#define FLASH_SIM_READ_NS FLASH_SIM_PART_READ_NS
+#endif
+
+#define FLASH_SIM_UNITS(bits, unit) (((bits) + (unit) - 1) / (unit))
+#define FLASH_SIM_CHUNK_NS \
+    ((uint64_t)FLASH_SIM_UNITS(VEEPROM_CHUNK_WIDTH, FLASH_SIM_PROGRAM_BITS) * FLASH_SIM_PROGRAM_NS)
+
+uint64_t flash_sim_clock_ns;
+long flash_sim_programs;    /* chunks */
+long flash_sim_erases;
+
+/* Stores of all devices share the erase in progress and the counters */
+#ifdef VEEPROM_THREADS
+static VEEPROM_MUTEX_DECL(m_flash_mutex);
+#define FLASH_SIM_LOCK()    VEEPROM_MUTEX_LOCK(&m_flash_mutex)
+#define FLASH_SIM_UNLOCK()  VEEPROM_MUTEX_UNLOCK(&m_flash_mutex)
+#else
+#define FLASH_SIM_LOCK()
+#define FLASH_SIM_UNLOCK()
+#endif
+
+#ifdef VEEPROM_ASYNC_ERASE
+static int flash_sim_access_unlocked(const void *p);
+#endif
+
+
+#if defined(FLASH_SECTORS) || defined(VEEPROM_ASYNC_ERASE)
+/* Index of the device which contains p, -1 if none */
+static int flash_sim_device(const void *p) {
+    for (int d = 0; d < FLASH_SIM_DEVICES; d++) {
+        uint8_t *start = m_devices[d];
+        if (start != NULL && (uint8_t*)p >= start && (uint8_t*)p < start + FLASH_SIM_LENGTH)
+            return d;
+    }
+    return -1;
 }
+#endif
 
 
-int flash_write_int(uint32_t data, uint32_t *p) {
-    *p = data;  
-    return 0;
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    return flash_write_range(p, &data, 1);
 }
 
 
-int flash_zero_short(uint16_t *p) {
-    *p = 0;
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    int ret = OK;
+    FLASH_SIM_LOCK();
+#ifdef VEEPROM_ASYNC_ERASE
+    ret = flash_sim_access_unlocked(dst);
+#endif
+    if (ret == OK) {
+        memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+        flash_sim_programs += chunks;
+        flash_sim_clock_ns += chunks * FLASH_SIM_CHUNK_NS;
+    }
+    FLASH_SIM_UNLOCK();
+    VEEPROM_THROW(ret == OK, ERROR_FLASH_WRITE);
     return OK;
 }
 
 
-int flash_erase_page(uint16_t *p) {
-    return !((void*)p == memset((void*)p, 0xFF, FLASH_PAGE_SIZE));
+/* Erases the page at once, the time is charged by the callers */
+static int flash_sim_wipe(flash_chunk_t *p) {
+    int size = FLASH_PAGE_SIZE;
+#ifdef FLASH_SECTORS
+    size = 0;
+    int d = flash_sim_device(p);
+    uint8_t *start = d >= 0 ? m_devices[d] : NULL;
+    for (int i = 0; start != NULL && i < sizeof(m_sectors) / sizeof(*m_sectors); i++)
+        if (start + m_sectors[i].offset == (uint8_t*)p)
+            size = m_sectors[i].size;
+    VEEPROM_THROW(size > 0, ERROR_PARAM);
+#endif
+    return !((void*)p == memset((void*)p, 0xFF, size));
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    FLASH_SIM_LOCK();
+    flash_sim_erases++;
+    flash_sim_clock_ns += (uint64_t)FLASH_SIM_ERASE_US * 1000;
+    int ret = flash_sim_wipe(p);
+    FLASH_SIM_UNLOCK();
+    return ret;
+}
+
+
+/* A read of bytes by the application takes the bus */
+int flash_sim_read(const void *p, int bytes) {
+    FLASH_SIM_LOCK();
+    flash_sim_clock_ns += (uint64_t)FLASH_SIM_UNITS(bytes * 8, FLASH_SIM_READ_BITS) * FLASH_SIM_READ_NS;
+    FLASH_SIM_UNLOCK();
+    return OK;
+}
+
+
+#ifdef VEEPROM_ASYNC_ERASE
+/*
+ * An erase in the background takes FLASH_SIM_ASYNC_ERASE_US of real time,
+ * the page keeps its data meanwhile. Every device erases one page at
+ * a time, devices erase independently. A device consists of
+ * FLASH_SIM_BANKS banks of equal size, programming and flash_sim_access()
+ * of the bank being erased wait for the end of the erase. The waits are
+ * counted by flash_sim_stalls, flash_sim_stall_us and go to the virtual
+ * clock. Nothing sleeps with the lock held, other devices go on.
+ */
+#ifndef FLASH_SIM_BANKS
+#define FLASH_SIM_BANKS 1
+#endif
+#ifndef FLASH_SIM_ASYNC_ERASE_US
+#define FLASH_SIM_ASYNC_ERASE_US 1000
+#endif
+
+typedef struct {
+    flash_chunk_t *page;    /* NULL - no erase in progress */
+    uint64_t end_us;
+} flash_sim_erase_t;
+
+static flash_sim_erase_t m_erases[FLASH_SIM_DEVICES];
+long flash_sim_stalls;
+uint64_t flash_sim_stall_us;
+
+
+static uint64_t flash_sim_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void flash_sim_sleep_us(uint64_t us) {
+    struct timespec ts = { us / 1000000, us % 1000000 * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+
+static int flash_sim_bank(int d, const void *p) {
+    return ((uint8_t*)p - m_devices[d]) / (FLASH_SIM_LENGTH / FLASH_SIM_BANKS);
+}
+
+
+/* The erase in progress of the device is over, its page is erased */
+static int flash_sim_erase_end(flash_sim_erase_t *e) {
+    flash_chunk_t *p = e->page;
+    e->page = NULL;
+    flash_sim_erases++;
+    return flash_sim_wipe(p);
+}
+
+
+/*
+ * Waits until the erase of device d doesn't block p, any erase of
+ * the device blocks NULL. The lock is dropped while it sleeps.
+ */
+static int flash_sim_wait_unlocked(int d, const void *p) {
+    flash_sim_erase_t *e = &m_erases[d];
+    while (e->page != NULL && (p == NULL || flash_sim_bank(d, p) == flash_sim_bank(d, e->page))) {
+        uint64_t now_us = flash_sim_time_us();
+        if (now_us >= e->end_us)
+            return flash_sim_erase_end(e);
+
+        uint64_t wait_us = e->end_us - now_us;
+        /* a new erase waiting for the previous one isn't a stall */
+        if (p != NULL) {
+            flash_sim_stalls++;
+            flash_sim_stall_us += wait_us;
+        }
+        flash_sim_clock_ns += wait_us * 1000;
+        FLASH_SIM_UNLOCK();
+        flash_sim_sleep_us(wait_us);
+        FLASH_SIM_LOCK();
+    }
+    return OK;
+}
+
+
+/* An access to p waits while its bank is erased */
+static int flash_sim_access_unlocked(const void *p) {
+    int d = flash_sim_device(p);
+    if (d < 0)
+        return OK;
+    return flash_sim_wait_unlocked(d, p);
+}
+
+
+int flash_sim_access(const void *p) {
+    FLASH_SIM_LOCK();
+    int ret = flash_sim_access_unlocked(p);
+    FLASH_SIM_UNLOCK();
+    return ret;
+}
+
+
+int flash_erase_start(flash_chunk_t *p) {
+    FLASH_SIM_LOCK();
+    int d = flash_sim_device(p);
+    int ret = d >= 0 ? flash_sim_wait_unlocked(d, NULL) : ERROR_PARAM;
+    if (ret == OK) {
+        m_erases[d].page = p;
+        m_erases[d].end_us = flash_sim_time_us() + FLASH_SIM_ASYNC_ERASE_US;
+    }
+    FLASH_SIM_UNLOCK();
+    VEEPROM_THROW(ret == OK, ERROR_FLASH_ERASE);
+    return OK;
+}
+
+
+int flash_erase_poll(flash_chunk_t *p, int *done) {
+    int ret = OK;
+    *done = 1;
+    FLASH_SIM_LOCK();
+    int d = flash_sim_device(p);
+    if (d < 0) {
+        ret = ERROR_PARAM;
+    } else if (m_erases[d].page == p) {
+        /* otherwise it's over, finished by the start of another erase */
+        *done = flash_sim_time_us() >= m_erases[d].end_us;
+        if (*done)
+            ret = flash_sim_erase_end(&m_erases[d]);
+    }
+    FLASH_SIM_UNLOCK();
+    return ret;
 }
+#endif
 
 
 void* flash_init(int fd) {
     VEEPROM_TRACE(fd > 2, ERROR_PARAM, return NULL;);
-    int length = FLASH_PAGE_SIZE * FLASH_PAGE_COUNT;
-    return mmap(NULL, length, PROT_READ | PROT_WRITE,
+    void *p = mmap(NULL, FLASH_SIM_LENGTH, PROT_READ | PROT_WRITE,
             MAP_SHARED, fd, 0);
+    FLASH_SIM_LOCK();
+    int d = 0;
+    while (d < FLASH_SIM_DEVICES && m_devices[d] != NULL)
+        d++;
+    if (p != MAP_FAILED && d < FLASH_SIM_DEVICES)
+        m_devices[d] = p;
+    FLASH_SIM_UNLOCK();
+    VEEPROM_TRACE(p != MAP_FAILED && d < FLASH_SIM_DEVICES, ERROR_PARAM, return NULL;);
+    return p;
 }
 
 
 int flash_uninit(void *p) {
     int ret = OK;
-    VEEPROM_THROW((ret=munmap(p, FLASH_PAGE_SIZE * FLASH_PAGE_COUNT)) == 0,
+    FLASH_SIM_LOCK();
+    for (int d = 0; d < FLASH_SIM_DEVICES; d++)
+        if (m_devices[d] == p) {
+            m_devices[d] = NULL;
+#ifdef VEEPROM_ASYNC_ERASE
+            m_erases[d].page = NULL;
+#endif
+        }
+    FLASH_SIM_UNLOCK();
+    VEEPROM_THROW((ret=munmap(p, FLASH_SIM_LENGTH)) == 0,
             ERROR_SYSTEM);
     return OK;
 }
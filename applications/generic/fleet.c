@@ -0,0 +1,386 @@
+/*
+ *  fleet.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Lifetime of a fleet of devices: every device is a store in RAM driven
+ * by its own random workload for the given number of years, the devices
+ * are simulated by threads in parallel. Reports erases per page, write
+ * amplification (bytes programmed per byte written), the day the first
+ * store expired (ERROR_FLASH_EXPIRED, virtnums are used up), the first
+ * page worn out (erased endurance times) and writes failing with NOMEM.
+ * Any other failure of a write stops the device, such devices are
+ * reported with the first error and fail the run.
+ *
+ * fleet [-d devices] [-j threads] [-y years] [-w writes/day] [-p pages]
+ *       [-s min:max record bytes] [-i ids] [-h hot %] [-e endurance] [-S seed]
+ *
+ * hot % of the writes go to the tenth of ids, a record keeps its length.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "eeprom.h"
+#include "errnum.h"
+#include "errmsg.h"
+
+#define FLEET_THREADS_MAX 64
+#define FLEET_BUCKETS 24        /* erases per page, powers of two */
+#define FLEET_FLASH_CHUNKS (FLASH_PAGE_COUNT * FLASH_PAGE_CHUNKS)
+/* a record of max_length bytes, data[0] is set even for empty ones */
+#define FLEET_DATA_SIZE ((size_t)m_load.max_length + 1)
+
+
+typedef struct {
+    int devices;
+    int years;
+    int writes_per_day;
+    int pages;
+    int min_length;
+    int max_length;
+    int ids;
+    int hot_percent;
+    int endurance;
+    uint32_t seed;
+} workload_t;
+
+
+typedef struct {
+    long writes;
+    uint64_t user_bytes;
+    uint64_t flash_bytes;
+    uint32_t max_erases;
+    int expired_day;        /* -1 - never */
+    int worn_day;
+    int nomem_day;
+    long nomem_events;
+    int error_day;          /* the device stopped on error */
+    int error;
+} device_result_t;
+
+
+typedef struct {
+    veeprom_thread_t thread;
+    veeprom_t veeprom;
+    flash_chunk_t *flash;   /* the slice of m_flash */
+    uint8_t *data;          /* the slice of m_data */
+    uint32_t erases[FLASH_PAGE_COUNT];
+    uint64_t programmed;    /* chunks */
+    int day;
+    int worn_day;
+    uint64_t histogram[FLEET_BUCKETS];
+} worker_t;
+
+
+static workload_t m_load = { 256, 5, 20, FLASH_PAGE_COUNT, 16, 256, 32, 80, 10000, 1 };
+static device_result_t *m_results;
+static worker_t m_workers[FLEET_THREADS_MAX];
+static flash_chunk_t *m_flash;
+static uint8_t *m_data;
+static veeprom_mutex_t m_mutex;
+static int m_next_device;
+
+
+/* Every worker programs its own slice of m_flash */
+static worker_t* flash_worker(const flash_chunk_t *p) {
+    return &m_workers[(p - m_flash) / FLEET_FLASH_CHUNKS];
+}
+
+
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    *p = data;
+    flash_worker(p)->programmed++;
+    return OK;
+}
+
+
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+    flash_worker(dst)->programmed += chunks;
+    return OK;
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    worker_t *w = flash_worker(p);
+    memset(p, 0xFF, FLASH_PAGE_SIZE);
+    int page = (p - w->flash) / FLASH_PAGE_CHUNKS;
+    if (++w->erases[page] == m_load.endurance && w->worn_day == -1)
+        w->worn_day = w->day;
+    return OK;
+}
+
+
+/* xorshift32, every device has its own sequence */
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+
+static flash_chunk_t workload_id(uint32_t *state) {
+    int hot = m_load.ids / 10 > 0 ? m_load.ids / 10 : 1;
+    if (hot == m_load.ids || next_random(state) % 100 < m_load.hot_percent)
+        return 1 + next_random(state) % hot;
+    return 1 + hot + next_random(state) % (m_load.ids - hot);
+}
+
+
+static int workload_length(flash_chunk_t id) {
+    uint32_t h = id * 2654435761u;
+    return m_load.min_length + (h >> 8) % (m_load.max_length - m_load.min_length + 1);
+}
+
+
+static void simulate_device(worker_t *w, int device, device_result_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->expired_day = r->worn_day = r->nomem_day = r->error_day = -1;
+    memset(w->flash, 0xFF, FLEET_FLASH_CHUNKS * sizeof(flash_chunk_t));
+    memset(w->erases, 0, sizeof(w->erases));
+    w->programmed = 0;
+    w->day = 0;
+    w->worn_day = -1;
+
+    uint32_t state = m_load.seed * 7919u + device + 1;
+    uint8_t *data = w->data;
+    memset(data, 0, FLEET_DATA_SIZE);
+
+    if (veeprom_init(&w->veeprom, w->flash, m_load.pages) != OK) {
+        fprintf(stderr, "device %d: mount failed\n", device);
+        return;
+    }
+    long total = (long)m_load.writes_per_day * 365 * m_load.years;
+    for (long i = 0; i < total; i++) {
+        w->day = i / m_load.writes_per_day;
+        flash_chunk_t id = workload_id(&state);
+        int length = workload_length(id);
+        data[0] = i;
+        int ret = veeprom_write(&w->veeprom, id, data, length);
+        if (ret == ERROR_FLASH_EXPIRED) {
+            r->expired_day = w->day;
+            break;
+        }
+        if (ret == VEEPROM_ERROR_NOMEM) {
+            if (r->nomem_day == -1)
+                r->nomem_day = w->day;
+            r->nomem_events++;
+            continue;
+        }
+        if (ret != OK) {
+            r->error_day = w->day;
+            r->error = ret;
+            break;
+        }
+        r->writes++;
+        r->user_bytes += length;
+    }
+    veeprom_deinit(&w->veeprom);
+
+    r->flash_bytes = w->programmed * sizeof(flash_chunk_t);
+    r->worn_day = w->worn_day;
+    for (int page = 0; page < m_load.pages; page++) {
+        uint32_t erases = w->erases[page];
+        if (erases > r->max_erases)
+            r->max_erases = erases;
+        int bucket = 0;
+        while (erases > 0 && bucket < FLEET_BUCKETS - 1) {
+            erases >>= 1;
+            bucket++;
+        }
+        w->histogram[bucket]++;
+    }
+}
+
+
+static VEEPROM_THREAD(fleet_worker, arg) {
+    worker_t *w = arg;
+    for (;;) {
+        VEEPROM_MUTEX_LOCK(&m_mutex);
+        int device = m_next_device < m_load.devices ? m_next_device++ : -1;
+        VEEPROM_MUTEX_UNLOCK(&m_mutex);
+        if (device == -1)
+            break;
+        simulate_device(w, device, &m_results[device]);
+    }
+    VEEPROM_THREAD_EXIT();
+}
+
+
+static int compare_erases(const void *a, const void *b) {
+    uint32_t x = ((const device_result_t*)a)->max_erases;
+    uint32_t y = ((const device_result_t*)b)->max_erases;
+    return (x > y) - (x < y);
+}
+
+
+/* Devices which had the event, the earliest day is returned in first */
+static int count_days(size_t offset, int *first) {
+    int devices = 0;
+    *first = -1;
+    for (int i = 0; i < m_load.devices; i++) {
+        int day = *(const int*)((const uint8_t*)&m_results[i] + offset);
+        if (day == -1)
+            continue;
+        devices++;
+        if (*first == -1 || day < *first)
+            *first = day;
+    }
+    return devices;
+}
+
+
+static void print_event(const char *name, size_t offset) {
+    int first;
+    int devices = count_days(offset, &first);
+    if (devices == 0)
+        printf("%-8s none\n", name);
+    else
+        printf("%-8s %d devices, first on day %d (year %.1f)\n", name, devices,
+                first, first / 365.0);
+}
+
+
+/* Returns the number of devices stopped on error */
+static int report(int threads) {
+    uint64_t writes = 0, user_bytes = 0, flash_bytes = 0, nomem = 0;
+    for (int i = 0; i < m_load.devices; i++) {
+        writes += m_results[i].writes;
+        user_bytes += m_results[i].user_bytes;
+        flash_bytes += m_results[i].flash_bytes;
+        nomem += m_results[i].nomem_events;
+    }
+    printf("%d devices x %d pages, %d years of %d writes/day, records %d..%d bytes,"
+            " %d ids, %d%% hot\n", m_load.devices, m_load.pages, m_load.years,
+            m_load.writes_per_day, m_load.min_length, m_load.max_length, m_load.ids,
+            m_load.hot_percent);
+    printf("writes   %llu, %.1f MB written, %.1f MB programmed, amplification %.2f\n",
+            (unsigned long long)writes, user_bytes / 1e6, flash_bytes / 1e6,
+            user_bytes ? (double)flash_bytes / user_bytes : 0.0);
+
+    qsort(m_results, m_load.devices, sizeof(*m_results), compare_erases);
+    int n = m_load.devices;
+    printf("erases   most erased page of a device: p50 %u p90 %u p99 %u max %u\n",
+            m_results[n / 2].max_erases, m_results[n * 9 / 10].max_erases,
+            m_results[n * 99 / 100].max_erases, m_results[n - 1].max_erases);
+
+    uint64_t histogram[FLEET_BUCKETS] = { 0 };
+    for (int i = 0; i < threads; i++)
+        for (int b = 0; b < FLEET_BUCKETS; b++)
+            histogram[b] += m_workers[i].histogram[b];
+    printf("erases   pages by erase count:");
+    for (int b = 0; b < FLEET_BUCKETS; b++)
+        if (histogram[b])
+            printf(" <%lu:%llu", 1UL << b, (unsigned long long)histogram[b]);
+    printf("\n");
+
+    print_event("expired", offsetof(device_result_t, expired_day));
+    print_event("worn", offsetof(device_result_t, worn_day));
+    print_event("nomem", offsetof(device_result_t, nomem_day));
+    if (nomem)
+        printf("nomem    %llu failed writes\n", (unsigned long long)nomem);
+
+    int first;
+    int errors = count_days(offsetof(device_result_t, error_day), &first);
+    print_event("error", offsetof(device_result_t, error_day));
+    for (int i = 0; i < m_load.devices && errors; i++)
+        if (m_results[i].error_day == first) {
+            printf("error    %s\n", emsg(m_results[i].error));
+            break;
+        }
+    return errors;
+}
+
+
+static int parse_args(int argc, char **argv, int *threads) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:y:w:p:s:i:h:e:S:")) != -1) {
+        switch (opt) {
+        case 'd': m_load.devices = atoi(optarg); break;
+        case 'j': *threads = atoi(optarg); break;
+        case 'y': m_load.years = atoi(optarg); break;
+        case 'w': m_load.writes_per_day = atoi(optarg); break;
+        case 'p': m_load.pages = atoi(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%d:%d", &m_load.min_length, &m_load.max_length) != 2)
+                return 0;
+            break;
+        case 'i': m_load.ids = atoi(optarg); break;
+        case 'h': m_load.hot_percent = atoi(optarg); break;
+        case 'e': m_load.endurance = atoi(optarg); break;
+        case 'S': m_load.seed = strtoul(optarg, NULL, 0); break;
+        default: return 0;
+        }
+    }
+    return m_load.devices > 0 && m_load.years > 0 && m_load.writes_per_day > 0 &&
+        m_load.pages > 0 && m_load.pages <= FLASH_PAGE_COUNT &&
+        m_load.min_length >= 0 && m_load.min_length <= m_load.max_length &&
+        m_load.max_length < VEEPROM_LENGTH_LIMIT &&
+        m_load.ids > 0 && m_load.ids < VEEPROM_KEY_ID_MIN &&
+        m_load.hot_percent >= 0 && m_load.hot_percent <= 100 && m_load.endurance > 0;
+}
+
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!parse_args(argc, argv, &threads)) {
+        fprintf(stderr, "usage: %s [-d devices] [-j threads] [-y years] [-w writes/day]"
+                " [-p pages] [-s min:max] [-i ids] [-h hot%%] [-e endurance] [-S seed]\n",
+                argv[0]);
+        return 2;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > FLEET_THREADS_MAX)
+        threads = FLEET_THREADS_MAX;
+    if (threads > m_load.devices)
+        threads = m_load.devices;
+
+    m_results = calloc(m_load.devices, sizeof(*m_results));
+    m_flash = malloc((size_t)threads * FLEET_FLASH_CHUNKS * sizeof(flash_chunk_t));
+    m_data = malloc((size_t)threads * FLEET_DATA_SIZE);
+    if (m_results == NULL || m_flash == NULL || m_data == NULL)
+        return 2;
+    VEEPROM_MUTEX_INIT(&m_mutex);
+
+    int started = 0;
+    for (; started < threads; started++) {
+        worker_t *w = &m_workers[started];
+        w->flash = m_flash + (size_t)started * FLEET_FLASH_CHUNKS;
+        w->data = m_data + (size_t)started * FLEET_DATA_SIZE;
+        if (VEEPROM_THREAD_START(&w->thread, fleet_worker, w) != 0)
+            break;
+    }
+    if (started == 0) {
+        fprintf(stderr, "no threads\n");
+        return 2;
+    }
+    for (int i = 0; i < started; i++)
+        VEEPROM_THREAD_JOIN(&m_workers[i].thread);
+
+    int errors = report(started);
+    VEEPROM_MUTEX_DESTROY(&m_mutex);
+    free(m_flash);
+    free(m_data);
+    free(m_results);
+    return errors != 0;
+}
@@ -0,0 +1,69 @@
+/*
+ *  lock.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VEEPROM_LOCK_H
+#define VEEPROM_LOCK_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+typedef pthread_rwlock_t veeprom_lock_t;
+
+#define VEEPROM_LOCK_INIT(l)        pthread_rwlock_init(l, NULL)
+#define VEEPROM_LOCK_DESTROY(l)     pthread_rwlock_destroy(l)
+#define VEEPROM_READ_LOCK(l)        pthread_rwlock_rdlock(l)
+#define VEEPROM_READ_UNLOCK(l)      pthread_rwlock_unlock(l)
+#define VEEPROM_WRITE_LOCK(l)       pthread_rwlock_wrlock(l)
+#define VEEPROM_WRITE_UNLOCK(l)     pthread_rwlock_unlock(l)
+#define VEEPROM_YIELD()             sched_yield()
+
+
+/* Queue and worker thread of VEEPROM_ASYNC */
+typedef pthread_mutex_t veeprom_mutex_t;
+typedef pthread_cond_t veeprom_cond_t;
+typedef pthread_t veeprom_thread_t;
+
+/* a mutex initialized statically, e.g. of a flash driver */
+#define VEEPROM_MUTEX_DECL(m)       veeprom_mutex_t m = PTHREAD_MUTEX_INITIALIZER
+#define VEEPROM_MUTEX_INIT(m)       pthread_mutex_init(m, NULL)
+#define VEEPROM_MUTEX_DESTROY(m)    pthread_mutex_destroy(m)
+#define VEEPROM_MUTEX_LOCK(m)       pthread_mutex_lock(m)
+#define VEEPROM_MUTEX_UNLOCK(m)     pthread_mutex_unlock(m)
+#define VEEPROM_COND_INIT(c)        pthread_cond_init(c, NULL)
+#define VEEPROM_COND_DESTROY(c)     pthread_cond_destroy(c)
+#define VEEPROM_COND_WAIT(c, m)     pthread_cond_wait(c, m)
+#define VEEPROM_COND_BROADCAST(c)   pthread_cond_broadcast(c)
+
+#define VEEPROM_THREAD(name, arg)   void* name(void *arg)
+#define VEEPROM_THREAD_EXIT()       return NULL
+/* 0 if the thread is started */
+#define VEEPROM_THREAD_START(t, fn, arg) pthread_create(t, NULL, fn, arg)
+#define VEEPROM_THREAD_JOIN(t)      pthread_join(*(t), NULL)
+
+
+static inline uint32_t veeprom_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+#define VEEPROM_TIME_US()           veeprom_time_us()
+
+#endif
@@ -25,7 +25,14 @@
 #include "errmsg.h"
 #include "wrappers.h"
 #include "gen_testcases.h"
+#include "writeback.h"
+#include "shard.h"
 #include <fcntl.h>
+#include <time.h>
+#ifdef VEEPROM_THREADS
+#include <pthread.h>
+#include "async.h"
+#endif
 
 void* flash_init(int fd);
 int flash_uninit();
@@ -33,1401 +40,1016 @@ int flash_uninit();
 
 struct alloc_res {
     void *mapped_mem;
-    veeprom_status *vstatus;
+    veeprom_t veeprom;
     int fd;
 };
 typedef struct alloc_res alloc_res;
 
 
-struct vdata_adapter {
-    uint16_t *p;
-    uint16_t id;
-};
-typedef struct vdata_adapter vdata_adapter;
-
-
-void print_int(rbnode *node) {
-    if (node == NULL || node->data == NULL)
-        fprintf(stderr, "NULL");
-    else
-        fprintf(stderr, "%d", *(int*)node->data);
+/*
+ * Maps the testcase image and mounts it through the current API.
+ */
+int mount_flash(alloc_res *a) {
+    a->fd = open("./testcases/tmp_testcase", O_RDWR);
+    VEEPROM_THROW(a->fd != -1, ERROR_SYSTEM);
+    a->mapped_mem = flash_init(a->fd);
+    VEEPROM_THROW(a->mapped_mem != NULL, ERROR_NULLPTR);
+    return veeprom_init(&a->veeprom, a->mapped_mem, 0);
 }
 
 
-static void
-print_node(rbtree *tree, rbnode* node, int level, int mode,
-        void (*print_data)(rbnode*)) {
-    int i = 0;
-    for (; i < level; i++)
-        fprintf(stderr, "            ");
-
-    const char *color;
-    if (node->color == RB_BLACK)
-        color = "black";
-    else
-        color = "red";
-
-    if (mode == -1) {
-        (*print_data)(node);
-        fprintf(stderr, "(%s)\n", color);
-    } else if (mode == 1) {
-        fprintf(stderr, "/========= ");
-        (*print_data)(node);
-        fprintf(stderr, " (%s)(L)\n", color);
-    } else {
-        fprintf(stderr, "\\========= ");
-        (*print_data)(node);
-        fprintf(stderr, " (%s)(R)\n", color);
-    }
-}
-
-void print_tree(rbtree *tree, rbnode *node, void (*print_data)(rbnode*)) {
-    if (tree == 0 || node == 0)
-        return;
-
-    rbnode *cur = node;
-    rbnode *prev = tree->nullnode;
-    int level = 0;
-    int mode = -1;
-
-    while (cur != tree->nullnode) {
-        if (prev != tree->nullnode) {
-            if (prev == cur->left && cur->right != tree->nullnode) {
-                cur = cur->right;
-                prev = tree->nullnode;
-                ++level;
-                mode = 0;
-            } else {
-                prev = cur;
-                --level;
-                cur = cur->parent;
-            }
-            continue;
-        }
-
-        print_node(tree, cur, level, mode, print_data);
-
-        if (cur->left != tree->nullnode) {
-            mode = 1;
-            cur = cur->left;
-            prev = tree->nullnode;
-            ++level;
-        } else if (cur->right != tree->nullnode) {
-            mode = 0;
-            cur = cur->right;
-            prev = tree->nullnode;
-            ++level;
-        } else {
-            prev = cur;
-            cur = cur->parent;
-            --level;
-        }
-    }
-    fprintf(stderr, "++++++++++++++++++++++++++++++++++++\n");
+/*
+ * Data LZSS can't shorten: their stored length is known with
+ * VEEPROM_COMPRESSION too.
+ */
+void fill_random(uint8_t *data, int length) {
+    srand(length);
+    for (int i = 0; i < length; i++)
+        data[i] = rand();
 }
 
 
-int cmp_int(void *pdata1, void *pdata2) {
-    VEEPROM_THROW((pdata1 != NULL || pdata2 != NULL), ERROR_NULLPTR);
-
-    int v1 = *((int*)pdata1);
-    int v2 = *((int*)pdata2);
-
-    if (v1 == v2)
-        return 0;
-    else if (v1 < v2)
-        return -1;
-    return 1;
+/*
+ * Start and size in bytes of the page physnum of the mapped image.
+ */
+flash_chunk_t* flash_page(alloc_res *a, int physnum, int *size) {
+#ifdef FLASH_SECTORS
+    static const flash_sector_t sectors[] = FLASH_SECTORS;
+    *size = sectors[physnum].size;
+    return (flash_chunk_t*)((uint8_t*)a->mapped_mem + sectors[physnum].offset);
+#else
+    *size = FLASH_PAGE_SIZE;
+    return (flash_chunk_t*)a->mapped_mem + physnum * FLASH_PAGE_CHUNKS;
+#endif
 }
 
 
-int verify_rbtree_1(alloc_res *a) {
-    rbtree *tree = rb_create_tree(&cmp_int);
-
-    int i = 0;
-    for (; i < 6; i++) {
-        int *data = malloc(sizeof(int));
-        *data = i;
-        rbnode *node = rb_create_node();
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        node->data = data;
-        tree = rb_insert_node(tree, node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
-
-    i = 0;
-    for (; i < 2; i++) {
-        rbnode *node = rb_search_node(tree, &i);
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        free(node->data);
-        tree = rb_delete_node(tree, node);
-        free(node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
-
-    i = 6;
-    for (; i < 9; i++) {
-        int *data = malloc(sizeof(int));
-        *data = i;
-        rbnode *node = rb_create_node();
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        node->data = data;
-        tree = rb_insert_node(tree, node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+/*
+ * Compare-and-swap write: stale version is rejected, current one accepted,
+ * version 0 means the record must not exist. Append changes the version and
+ * a deleted then rewritten record doesn't get an old one back.
+ */
+int verify_37(alloc_res *a) {
+    int ret = mount_flash(a);
+    VEEPROM_THROW(ret == OK, ret);
 
-    i = 3;
-    for (; i < 5; i++) {
-        rbnode *node = rb_search_node(tree, &i);
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        free(node->data);
-        tree = rb_delete_node(tree, node);
-        free(node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+    uint8_t data[] = { 1, 2, 3, 4, 5 };
+    uint32_t version = 0;
 
-    i = 9;
-    for (; i < 12; i++) {
-        int *data = malloc(sizeof(int));
-        *data = i;
-        rbnode *node = rb_create_node();
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        node->data = data;
-        tree = rb_insert_node(tree, node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+    ret = veeprom_write_if_version(&a->veeprom, 77, 0, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_get_version(&a->veeprom, 77, &version);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(version > 0, ERROR_VALUE);
 
-    i = 6;
-    for (; i < 8; i++) {
-        rbnode *node = rb_search_node(tree, &i);
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        free(node->data);
-        tree = rb_delete_node(tree, node);
-        free(node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+    ret = veeprom_write_if_version(&a->veeprom, 77, 0, data, sizeof(data));
+    VEEPROM_THROW(ret == VEEPROM_ERROR_VERSION, ERROR_VALUE);
 
+    uint32_t prev = version;
+    ret = veeprom_write_if_version(&a->veeprom, 77, prev, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_get_version(&a->veeprom, 77, &version);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(version > prev, ERROR_VALUE);
 
-    i = 12;
-    for (; i < 15; i++) {
-        int *data = malloc(sizeof(int));
-        *data = i;
-        rbnode *node = rb_create_node();
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        node->data = data;
-        tree = rb_insert_node(tree, node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+    ret = veeprom_write_if_version(&a->veeprom, 77, prev, data, sizeof(data));
+    VEEPROM_THROW(ret == VEEPROM_ERROR_VERSION, ERROR_VALUE);
 
-    i = 9;
-    for (; i < 10; i++) {
-        rbnode *node = rb_search_node(tree, &i);
-        VEEPROM_THROW(node != NULL, ERROR_NULLPTR);
-        free(node->data);
-        tree = rb_delete_node(tree, node);
-        free(node);
-        VEEPROM_THROW(tree != NULL, ERROR_NULLPTR);
-        print_tree(tree, tree->root, &print_int);
-    }
+    prev = version;
+    ret = veeprom_append(&a->veeprom, 77, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_get_version(&a->veeprom, 77, &version);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(version > prev, ERROR_VALUE);
 
-    rbnode *node = rb_min_node(tree, tree->root);
-    while (!rb_is_nullnode(tree, node)) {
-        free(node->data);
-        node = rb_next_node(tree, node);
-    }
+    /* the old record may land on the same pages again */
+    prev = version;
+    ret = veeprom_delete(&a->veeprom, 77);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_write_if_version(&a->veeprom, 77, 0, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_get_version(&a->veeprom, 77, &version);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(version > prev, ERROR_VALUE);
+    ret = veeprom_write_if_version(&a->veeprom, 77, prev, data, sizeof(data));
+    VEEPROM_THROW(ret == VEEPROM_ERROR_VERSION, ERROR_VALUE);
 
-    rb_release_tree(tree);
     return OK;
 }
 
 
-int create_vstatus(alloc_res *a) {
-    VEEPROM_THROW(a->mapped_mem != NULL, ERROR_NULLPTR);
-    veeprom_status *vstatus = veeprom_create_status();
-    VEEPROM_THROW(vstatus != NULL, ERROR_NULLPTR);
-    a->vstatus = vstatus;
-    int ret = veeprom_status_init(vstatus, a->mapped_mem);
+/*
+ * Counter survives area rollover and remount.
+ */
+int verify_38(alloc_res *a) {
+    int ret = mount_flash(a);
+    VEEPROM_THROW(ret == OK, ret);
+
+    ret = veeprom_counter_init(&a->veeprom, 9, 100);
     VEEPROM_THROW(ret == OK, ret);
-    VEEPROM_THROW(vstatus->page_order != NULL, ERROR_NULLPTR);
-    VEEPROM_THROW(vstatus->ids != NULL, ERROR_NULLPTR);
-    VEEPROM_THROW(vstatus->page_order != NULL, ERROR_NULLPTR);
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem,
-            ERROR_VALUE);
 
     int i = 0;
-    for (i = 0; i < FLASH_PAGE_COUNT; i++) {
-         VEEPROM_THROW(vstatus->busy_map[i] == -1,
-                ERROR_DCNSTY);
+    for (; i < 2000; i++) {
+        ret = veeprom_counter_inc(&a->veeprom, 9);
+        VEEPROM_THROW(ret == OK, ret);
     }
 
-    return OK;
-}
-
-int init_flash(alloc_res *a) {
-    int ret = OK;
-    a->fd = open("./testcases/tmp_testcase", O_RDWR);
-    VEEPROM_THROW(a->fd != -1, ERROR_SYSTEM);
-    a->mapped_mem = flash_init(a->fd);
-    VEEPROM_THROW(a->mapped_mem != NULL, ERROR_NULLPTR);
-    VEEPROM_THROW((ret = create_vstatus(a)) == OK, ret);
-    ret = veeprom_init(a->vstatus);
+    uint32_t value = 0;
+    ret = veeprom_counter_get(&a->veeprom, 9, &value);
     VEEPROM_THROW(ret == OK, ret);
-    return OK;
-}
-
+    VEEPROM_THROW(value == 2100, ERROR_VALUE);
 
-/*
- * Verification of correct inititalization in the case
- * of clear flash (all pages are ERASED and not contaning data).
- */
-int verify_clear(alloc_res *a) {
-    int ret = init_flash(a);
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
     VEEPROM_THROW(ret == OK, ret);
-
-    veeprom_status *vstatus = a->vstatus;
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i,
-                ERROR_DCNSTY);
-    }
-    VEEPROM_THROW(vstatus->ids->root == vstatus->ids->nullnode, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->page_order->root == vstatus->page_order->nullnode, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem,
-            ERROR_VALUE);
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->next_alloc == 0, ERROR_VALUE);
+    ret = veeprom_counter_get(&a->veeprom, 9, &value);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(value == 2100, ERROR_VALUE);
 
     return OK;
 }
 
 
 /*
- * Verify that after initialization of empty flash with
- * three pages having RECEIVING states, vstatus:
- * 1. was correctly initialized;
- * 2. the next allocated page is the maximum of
- * the three virtual numbers of RECEIVING pages plus 1.
+ * Appends spread over the tail page and extension pages read back as one
+ * value, also after remount. Rewriting the record releases extensions.
  */
-int verify_2(alloc_res *a) {
-    int ret = init_flash(a);
+int verify_39(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
+    int length = 0;
+    uint8_t *expected = malloc(8192);
+    uint8_t *buf = malloc(8192);
+    uint8_t data[600];
+
     int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i,
-                ERROR_DCNSTY);
+    for (; i < 20; i++) {
+        int n = 37 * (i + 1) % 600 + 1;
+        memset(data, i, n);
+        ret = veeprom_append(&a->veeprom, 55, data, n);
+        VEEPROM_THROW(ret == OK, ret, free(expected); free(buf));
+        memcpy(expected + length, data, n);
+        length += n;
     }
-    VEEPROM_THROW(vstatus->ids->root == vstatus->ids->nullnode,
-            ret);
-    VEEPROM_THROW(vstatus->page_order->root == vstatus->page_order->nullnode,
-            ERROR_VALUE);
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem,
-            ERROR_VALUE);
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-
-    return OK;
-}
 
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret, free(expected); free(buf));
 
-/*
- * Verify that after initialization of empty flash with
- * three pages having RECEIVING states, vstatus:
- * 1. was correctly initialized;
- * 2. the next allocated page is the maximum of
- * the three virtual numbers of RECEIVING pages plus 1.
- */
-int verify_3(alloc_res *a) {
-    int ret = init_flash(a);
-    VEEPROM_THROW(ret == OK, ret);
+    veeprom_read_t read_buf = { .id = 55, .buf = buf, .buf_size = 8192 };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret, free(expected); free(buf));
+    VEEPROM_THROW(read_buf.length == length, ERROR_VALUE, free(expected); free(buf));
+    VEEPROM_THROW(memcmp(buf, expected, length) == 0, ERROR_VALUE,
+            free(expected); free(buf));
 
-    veeprom_status *vstatus = a->vstatus;
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i,
-                ERROR_DCNSTY);
-    }
-    VEEPROM_THROW(vstatus->ids->root == vstatus->ids->nullnode, ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->page_order->root == vstatus->page_order->nullnode, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    ret = veeprom_write(&a->veeprom, 55, data, 1);
+    VEEPROM_THROW(ret == OK, ret, free(expected); free(buf));
+    VEEPROM_THROW(veeprom_get_pages_size(&a->veeprom) == 1, ERROR_DCNSTY,
+            free(expected); free(buf));
 
+    free(expected);
+    free(buf);
     return OK;
 }
 
 
 /*
- * Verify that after initialization of empty flash with
- * three pages having RECEIVING states and one page having
- * VALID state and not having data, vstatus:
- * 1. was correctly initialized;
- * 2. the next allocated page is the maximum of
- * the three virtual numbers of RECEIVING pages plus 1
- * 3. the page that being VALID is set to ERASED
+ * Space accounting is consistent, survives remount and counts released
+ * pages.
  */
-int verify_4(alloc_res *a) {
-    int ret = init_flash(a);
+int verify_40(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->ids->root == vstatus->ids->nullnode, ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->page_order->root == vstatus->page_order->nullnode, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
-}
-
-
-int verify_5(alloc_res *a) {
-    int ret = init_flash(a);
+    uint8_t data[2000];
+    fill_random(data, sizeof(data));
+    ret = veeprom_write(&a->veeprom, 1, data, 2000);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_write(&a->veeprom, 2, data, 10);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_append(&a->veeprom, 2, data, 1500);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->flash_start == a->mapped_mem, ERROR_VALUE);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
-
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-
-    return OK;
-}
-
 
-int verify_6(alloc_res *a) {
-    int ret = init_flash(a);
+    veeprom_space_t before;
+    ret = veeprom_space_info(&a->veeprom, &before);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
+    VEEPROM_THROW(before.live_bytes == 3510, ERROR_VALUE);
+    VEEPROM_THROW(before.free_bytes + before.live_bytes + before.overhead_bytes
+            + before.unused_bytes + before.reclaimable_bytes == before.total_bytes,
+            ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    veeprom_space_t after;
+    ret = veeprom_space_info(&a->veeprom, &after);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(memcmp(&before, &after, sizeof(before)) == 0, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    /* pages of the deleted record are free or wait for the erase */
+    ret = veeprom_delete(&a->veeprom, 1);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_space_info(&a->veeprom, &after);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(after.free_bytes + after.live_bytes + after.overhead_bytes
+            + after.unused_bytes + after.reclaimable_bytes == after.total_bytes,
+            ERROR_DCNSTY);
+    VEEPROM_THROW(after.free_bytes + after.reclaimable_bytes
+            > before.free_bytes + before.reclaimable_bytes, ERROR_VALUE);
+#ifdef VEEPROM_ASYNC_ERASE
+    VEEPROM_THROW(after.reclaimable_bytes > 0, ERROR_VALUE);
+#else
+    VEEPROM_THROW(after.reclaimable_bytes == 0, ERROR_VALUE);
+#endif
 
     return OK;
 }
 
 
-int verify_7(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Checksum is verified on read: a record with the checksum split
+ * between two pages (CRC-32 on 16-bit flash) is read back, a damaged
+ * record is rejected.
+ */
+int verify_41(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
-
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->next_alloc == 0, ERROR_VALUE);
-
-    return OK;
-}
-
-
-int verify_8(alloc_res *a) {
-    int ret = init_flash(a);
+    static uint8_t data[GEN_PAGE_RECORD_LENGTH];
+    fill_random(data, sizeof(data));
+    ret = veeprom_write(&a->veeprom, 1, data, sizeof(data));
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    static uint8_t buf[GEN_PAGE_RECORD_LENGTH + sizeof(flash_chunk_t)];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data), ERROR_VALUE);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    flash_chunk_t *p = veeprom_find(&a->veeprom, 1);
+    VEEPROM_THROW(p != NULL, ERROR_NULLPTR);
+    *(p + 2 + 100) = ~*(p + 2 + 100);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == VEEPROM_ERROR_CHECKSUM, ERROR_DCNSTY);
 
     return OK;
 }
 
 
-int verify_9(alloc_res *a) {
-    int ret = OK;
+#ifdef VEEPROM_BLANK_CHECK
+/*
+ * A page with ERASED status holding programmed chunks is detected
+ * at mount and erased before it's used.
+ */
+int verify_42(alloc_res *a) {
     a->fd = open("./testcases/tmp_testcase", O_RDWR);
     VEEPROM_THROW(a->fd != -1, ERROR_SYSTEM);
     a->mapped_mem = flash_init(a->fd);
     VEEPROM_THROW(a->mapped_mem != NULL, ERROR_NULLPTR);
-    VEEPROM_THROW((ret = create_vstatus(a)) == OK, ret);
-    ret = veeprom_init(a->vstatus);
-    VEEPROM_THROW(ret == ERROR_DFG, ret);
-    return OK;
-}
 
+    int size = 0;
+    flash_chunk_t *page = flash_page(a, 0, &size);
+    flash_chunk_t *dirty = page + size / sizeof(flash_chunk_t) / 2;
+    *dirty = 0x1234;
 
-int verify_10(alloc_res *a) {
-    int ret = init_flash(a);
+    int ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    veeprom_status_t *vstatus = veeprom_get_status(&a->veeprom);
+    VEEPROM_THROW(vstatus->dirty_map[0] == 1, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    uint8_t data[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    ret = veeprom_write(&a->veeprom, 1, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(vstatus->dirty_map[0] == 0, ERROR_DCNSTY);
+    VEEPROM_THROW(*dirty == VEEPROM_ERASED_CHUNK, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    /* the last chunk is read whole */
+    uint8_t buf[TO_CHUNKS(sizeof(data)) * sizeof(flash_chunk_t)];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
     return OK;
 }
+#endif
 
 
-
-int verify_11(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Write with read back: the data and the statuses of all pages of
+ * the record are verified.
+ */
+int verify_43(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    uint8_t data[1500];
+    fill_random(data, sizeof(data));
+    ret = veeprom_write_verify(&a->veeprom, 1, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    veeprom_status_t *vstatus = veeprom_get_status(&a->veeprom);
+    VEEPROM_THROW(vstatus->verify_mismatches == 0, ERROR_DCNSTY);
+    VEEPROM_THROW(vstatus->verify_bytes == sizeof(data)
+            + vstatus->busy_pages * sizeof(flash_chunk_t), ERROR_VALUE);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    uint8_t buf[TO_CHUNKS(sizeof(data)) * sizeof(flash_chunk_t)];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
     return OK;
 }
 
 
-int verify_12(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Several interrupted updates and a torn write are recovered by
+ * a single mount: old versions of two records were not removed,
+ * the last page of a three-page record is lost.
+ */
+int verify_44(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 1,
-            ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 44) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
+    static flash_chunk_t snapshot[FLASH_PAGE_COUNT * FLASH_PAGE_CHUNKS];
+    /* three pages, on sectors the largest ones */
+    static uint8_t data[2 * FLASH_PAGE_SIZE + 500];
+    fill_random(data, sizeof(data));
+
+    VEEPROM_THROW((ret = veeprom_write(&a->veeprom, 1, data, 100)) == OK, ret);
+    VEEPROM_THROW((ret = veeprom_write(&a->veeprom, 2, data, 1500)) == OK, ret);
+    memcpy(snapshot, a->mapped_mem, sizeof(snapshot));
+
+    VEEPROM_THROW((ret = veeprom_write(&a->veeprom, 1, data + 1, 200)) == OK, ret);
+    VEEPROM_THROW((ret = veeprom_write(&a->veeprom, 2, data + 1, 500)) == OK, ret);
+    VEEPROM_THROW((ret = veeprom_write(&a->veeprom, 3, data, sizeof(data))) == OK, ret);
+    /* the pages of the record written last end the index */
+    flash_chunk_t **pages = veeprom_get_pages(&a->veeprom);
+    flash_chunk_t torn_virtnum = *pages[veeprom_get_pages_size(&a->veeprom) - 1];
+    VEEPROM_THROW(torn_virtnum == *(veeprom_find(&a->veeprom, 3) - 1) + 2, ERROR_DCNSTY);
+    veeprom_deinit(&a->veeprom);
+
+    for (int i = 0; i < FLASH_PAGE_COUNT; i++) {
+        int size = 0;
+        flash_chunk_t *page = flash_page(a, i, &size);
+        flash_chunk_t *old = snapshot + (page - (flash_chunk_t*)a->mapped_mem);
+        if (*page == PAGE_ERASED && *old == PAGE_VALID)
+            memcpy(page, old, size);
+        else if (*page == PAGE_VALID && *(page + 1) == torn_virtnum)
+            flash_erase_page(page);
     }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 44, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 1014, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+2) == 243,
-            ERROR_DCNSTY);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_get_ids_size(&a->veeprom) == 2, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_get_status(&a->veeprom)->busy_pages == 2, ERROR_DCNSTY);
+    VEEPROM_THROW(*(veeprom_find(&a->veeprom, 1) + 1) == 200, ERROR_DCNSTY);
+    VEEPROM_THROW(*(veeprom_find(&a->veeprom, 2) + 1) == 500, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 3) == NULL, ERROR_DCNSTY);
 
     return OK;
 }
 
 
-int verify_13(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Data spanning three pages are programmed by ranges from an aligned
+ * and from an unaligned buffer, the odd last byte is padded.
+ */
+int verify_46(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 1,
-            ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 44) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
-    }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 44, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 40, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 974, ERROR_DCNSTY);
+    static flash_chunk_t aligned[1600];
+    static uint8_t buf[3200];
+    uint8_t *data = (uint8_t*)aligned;
+    for (int i = 0; i < sizeof(aligned); i++)
+        data[i] = i * 3 + 1;
 
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    for (int offset = 0; offset < 2; offset++) {
+        ret = veeprom_write(&a->veeprom, 1, data + offset, 2999);
+        VEEPROM_THROW(ret == OK, ret);
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+2) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+        veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+        ret = veeprom_read(&a->veeprom, &read_buf);
+        VEEPROM_THROW(ret == OK, ret);
+        VEEPROM_THROW(read_buf.length == 2999, ERROR_VALUE);
+        VEEPROM_THROW(memcmp(buf, data + offset, 2999) == 0, ERROR_DCNSTY);
+        VEEPROM_THROW(buf[2999] == 0, ERROR_DCNSTY);
+    }
 
     return OK;
 }
 
 
-int verify_14(alloc_res *a) {
-    int ret = init_flash(a);
+#ifdef VEEPROM_COMPRESSION
+/*
+ * Repetitive data are stored compressed on a single page and read back,
+ * random data are stored as is.
+ */
+int verify_45(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 1, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 100) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
-    }
+    static uint8_t data[4000];
+    static uint8_t buf[4000];
+    const char *text = "{\"key\": 1, \"value\": \"text\"}, ";
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = text[i % strlen(text)];
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 100, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 1014, ERROR_DCNSTY);
+    ret = veeprom_write(&a->veeprom, 1, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    flash_chunk_t *p = veeprom_find(&a->veeprom, 1);
+    VEEPROM_THROW(*(p+1) & VEEPROM_LENGTH_COMPRESSED, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_get_status(&a->veeprom)->busy_pages == 1, ERROR_DCNSTY);
 
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data), ERROR_VALUE);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+2) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 101, ERROR_VALUE);
+    for (int i = 0; i < 100; i++)
+        data[i] = rand();
+    ret = veeprom_write(&a->veeprom, 2, data, 100);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(*(veeprom_find(&a->veeprom, 2) + 1) == 100, ERROR_DCNSTY);
 
     return OK;
 }
+#endif
 
 
-int verify_15(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * A record of the largest length that fits a page takes exactly one page
+ * for the configured chunk width, one more byte takes the next page.
+ */
+int verify_47(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    int length = (FLASH_PAGE_CHUNKS - VEEPROM_HEADER_CHUNKS - 2
+            - VEEPROM_CHECKSUM_CHUNKS) * sizeof(flash_chunk_t);
+    static uint8_t data[FLASH_PAGE_SIZE];
+    fill_random(data, sizeof(data));
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-
-    return OK;
-}
-
-
-int verify_16(alloc_res *a) {
-    int ret = init_flash(a);
+    ret = veeprom_write(&a->veeprom, 1, data, length);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    VEEPROM_THROW(veeprom_get_status(&a->veeprom)->busy_pages == 1, ERROR_DCNSTY);
+    flash_chunk_t *p = veeprom_find(&a->veeprom, 1);
+    VEEPROM_THROW(*(p + 1) == length, ERROR_DCNSTY);
+    VEEPROM_THROW(p + 2 + TO_CHUNKS(length) + VEEPROM_CHECKSUM_CHUNKS ==
+            p - VEEPROM_HEADER_CHUNKS + FLASH_PAGE_CHUNKS, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    ret = veeprom_write(&a->veeprom, 2, data, length + 1);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_get_status(&a->veeprom)->busy_pages == 3, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+    static uint8_t buf[FLASH_PAGE_SIZE];
+    veeprom_read_t read_buf = { .id = 2, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == length + 1, ERROR_VALUE);
+    VEEPROM_THROW(memcmp(buf, data, length + 1) == 0, ERROR_DCNSTY);
 
     return OK;
 }
 
 
-int verify_17(alloc_res *a) {
-    int ret = init_flash(a);
+#ifdef FLASH_SECTORS
+/*
+ * Sectors of different sizes: a small record takes the smallest sector,
+ * a record larger than it takes one larger sector instead of several
+ * small ones. Records are read back after remount.
+ */
+int verify_48(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    static const flash_sector_t sectors[] = FLASH_SECTORS;
+    static uint8_t data[3000];
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = rand();
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root == tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data == NULL,
+    ret = veeprom_write(&a->veeprom, 1, data, 10);
+    VEEPROM_THROW(ret == OK, ret);
+    flash_chunk_t *p = veeprom_find(&a->veeprom, 1);
+    VEEPROM_THROW((uint8_t*)p - (uint8_t*)a->mapped_mem < sectors[0].offset + sectors[0].size,
             ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-
-    return OK;
-}
-
-
-int verify_18(alloc_res *a) {
-    int ret = init_flash(a);
+    ret = veeprom_write(&a->veeprom, 2, data, sizeof(data));
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_get_status(&a->veeprom)->busy_pages == 2, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
+    static uint8_t buf[sizeof(data)];
+    veeprom_read_t read_buf = { .id = 2, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data), ERROR_VALUE);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
     return OK;
 }
+#endif
 
 
-int verify_19(alloc_res *a) {
-    int ret = init_flash(a);
+#ifndef FLASH_SECTORS
+/*
+ * Two stores in halves of one flash: the same id keeps different data
+ * in each of them and pages are allocated within the own half only.
+ */
+int verify_49(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
-
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
-}
+    veeprom_deinit(&a->veeprom);
 
-
-int verify_20(alloc_res *a) {
-    int ret = init_flash(a);
+    static veeprom_t first;
+    static veeprom_t second;
+    int half = FLASH_PAGE_COUNT / 2;
+    flash_chunk_t *flash = a->mapped_mem;
+    ret = veeprom_init(&first, flash, half);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_init(&second, flash + half * FLASH_PAGE_CHUNKS, half);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
+    uint8_t data[3000];
+    memset(data, 1, sizeof(data));
+    for (int i = 0; i < half; i++) {
+        ret = veeprom_write(&first, 1, data, 10);
+        VEEPROM_THROW(ret == OK, ret);
     }
+    memset(data, 2, sizeof(data));
+    ret = veeprom_write(&second, 1, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    veeprom_deinit(&first);
+    veeprom_deinit(&second);
+    ret = veeprom_init(&first, flash, half);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_init(&second, flash + half * FLASH_PAGE_CHUNKS, half);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_get_status(&first)->busy_pages == 1, ERROR_DCNSTY);
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root == tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data == NULL,
+    uint8_t buf[sizeof(data)];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&first, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == 10 && buf[0] == 1, ERROR_DCNSTY);
+    ret = veeprom_read(&second, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data) && memcmp(buf, data, sizeof(data)) == 0,
             ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
+
     return OK;
 }
+#endif
 
 
-int verify_21(alloc_res *a) {
-    int ret = init_flash(a);
+#ifdef VEEPROM_KEYS
+/*
+ * Records with string and 32-bit keys: rewritten, deleted and found
+ * again through the key index built at remount.
+ */
+int verify_50(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 1,
-            ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 44) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
-    }
-
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 44, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 1012, ERROR_DCNSTY);
+    const char *mtu = "net.mtu";
+    uint32_t serial = 0xC0FFEE;
+    uint8_t data[100];
+    memset(data, 1, sizeof(data));
 
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    ret = veeprom_write(&a->veeprom, VEEPROM_KEY_ID_MIN, data, 10);
+    VEEPROM_THROW(ret == VEEPROM_ERROR_ID, ERROR_DCNSTY);
+    ret = veeprom_write_key(&a->veeprom, mtu, strlen(mtu), data, 10);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_write_key(&a->veeprom, &serial, sizeof(serial), data, 20);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_write_key(&a->veeprom, "net.ip", 6, data, 30);
+    VEEPROM_THROW(ret == OK, ret);
+    memset(data, 2, sizeof(data));
+    ret = veeprom_write_key(&a->veeprom, mtu, strlen(mtu), data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_delete_key(&a->veeprom, "net.ip", 6);
+    VEEPROM_THROW(ret == OK, ret);
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_get_ids_size(&a->veeprom) == 2, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find_key(&a->veeprom, "net.ip", 6) == NULL, ERROR_DCNSTY);
 
-    uint16_t *page = vstatus->flash_start +
-        FLASH_PAGE_SIZE_2B * 44;
-    VEEPROM_THROW(*page == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 1) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 2) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 3) == 1,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 4) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 5) == 242,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 6) == 0xFFFF,
+    uint8_t buf[sizeof(data) + TO_CHUNKS(VEEPROM_KEY_MAX + 1) * sizeof(flash_chunk_t)];
+    veeprom_read_t read_buf = { .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read_key(&a->veeprom, mtu, strlen(mtu), &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data) && memcmp(buf, data, sizeof(data)) == 0,
             ERROR_DCNSTY);
+    ret = veeprom_read_key(&a->veeprom, &serial, sizeof(serial), &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == 20 && buf[0] == 1, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
     return OK;
 }
+#endif
 
 
-int verify_22(alloc_res *a) {
-    int ret = init_flash(a);
-    VEEPROM_THROW(ret == OK, ret);
+#ifdef VEEPROM_THREADS
+struct verify_51_reader {
+    veeprom_t *veeprom;
+    volatile int *done;
+    int ret;
+};
 
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 1,
-            ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 44) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
+static void* verify_51_read(void *arg) {
+    struct verify_51_reader *r = arg;
+    uint8_t buf[2000];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    while (!*r->done && r->ret == OK) {
+        r->ret = veeprom_read(r->veeprom, &read_buf);
+        for (int i = 1; r->ret == OK && i < read_buf.length; i++)
+            if (buf[i] != buf[0])
+                r->ret = ERROR_DCNSTY;
     }
-
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 44, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 40, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 972, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 1,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+2) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+3) == 242,
-            ERROR_DCNSTY);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
+    return NULL;
 }
 
 
-int verify_23(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Readers in threads see every version of a record rewritten by the main
+ * thread either entirely or not at all.
+ */
+int verify_51(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
 
-    VEEPROM_THROW(vstatus->busy_pages == 1, ERROR_DCNSTY);
+    uint8_t data[2000];
+    memset(data, 0, sizeof(data));
+    ret = veeprom_write(&a->veeprom, 1, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 100) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
+    volatile int done = 0;
+    pthread_t threads[4];
+    struct verify_51_reader readers[4];
+    for (int i = 0; i < ARRAY_SIZE(threads); i++) {
+        readers[i] = (struct verify_51_reader){ &a->veeprom, &done, OK };
+        VEEPROM_THROW(pthread_create(&threads[i], NULL, verify_51_read, &readers[i]) == 0,
+                ERROR_SYSTEM);
     }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 100, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 1012, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 1,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+2) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+3) == 242,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 101, ERROR_VALUE);
+    for (int i = 1; i <= 1000 && ret == OK; i++) {
+        memset(data, i, sizeof(data));
+        ret = veeprom_write(&a->veeprom, 1, data, 1 + rand() % sizeof(data));
+    }
+    done = 1;
+    for (int i = 0; i < ARRAY_SIZE(threads); i++)
+        pthread_join(threads[i], NULL);
+    VEEPROM_THROW(ret == OK, ret);
+    for (int i = 0; i < ARRAY_SIZE(readers); i++)
+        VEEPROM_THROW(readers[i].ret == OK, readers[i].ret);
 
     return OK;
 }
 
 
-int verify_24(alloc_res *a) {
-    int ret = init_flash(a);
-    VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
+struct verify_52_result {
+    int count;
+    int ret;
+};
 
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
 
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
+static void verify_52_done(void *context, flash_chunk_t id, int status) {
+    struct verify_52_result *r = context;
+    r->count++;
+    if (status != OK)
+        r->ret = status;
 }
 
 
-int verify_25(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Asynchronous writes overflow the queue and are written in order:
+ * the last queued version of every record is read after the flush.
+ */
+int verify_52(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
+    static veeprom_async_t queue;
+    ret = veeprom_async_start(&queue, &a->veeprom);
+    VEEPROM_THROW(ret == OK, ret);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
+    struct verify_52_result result = { 0, OK };
+    /* the longest record is the last one */
+    uint8_t data[1 + 200 * 5];
+    for (int i = 1; i <= 200 && ret == OK; i++) {
+        memset(data, i, sizeof(data));
+        ret = veeprom_write_async(&queue, 1 + i % 4, data, 1 + i * 5, verify_52_done, &result);
     }
-
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
-}
-
-
-int verify_26(alloc_res *a) {
-    int ret = init_flash(a);
+    if (ret == OK)
+        ret = veeprom_async_flush(&queue);
+    veeprom_async_stats_t stats;
+    veeprom_async_get_stats(&queue, &stats);
+    veeprom_async_stop(&queue);
     VEEPROM_THROW(ret == OK, ret);
-
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
+    VEEPROM_THROW(result.ret == OK, result.ret);
+    VEEPROM_THROW(result.count == 200 && stats.ops == 200, ERROR_DCNSTY);
+
+    uint8_t buf[TO_CHUNKS(sizeof(data)) * sizeof(flash_chunk_t)];
+    veeprom_read_t read_buf = { .buf = buf, .buf_size = sizeof(buf) };
+    for (int i = 197; i <= 200; i++) {
+        read_buf.id = 1 + i % 4;
+        ret = veeprom_read(&a->veeprom, &read_buf);
+        VEEPROM_THROW(ret == OK, ret);
+        VEEPROM_THROW(read_buf.length == 1 + i * 5 && buf[0] == i && buf[i * 5] == i,
+                ERROR_DCNSTY);
     }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root == tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data == NULL,
-            ERROR_DCNSTY);
-
-    uint16_t *page = vstatus->flash_start +
-        FLASH_PAGE_SIZE_2B * 44;
-    VEEPROM_THROW(*page == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 1) == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 508) == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 509) == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 510) == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 511) == 0xFFFF, ERROR_DCNSTY);
-
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
     return OK;
 }
+#endif
 
 
-int verify_27(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Rewrites of a record are kept in the write-back buffer and read from
+ * there, the record is written to flash once when it ages.
+ */
+int verify_53(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 1, ERROR_DCNSTY);
+    static veeprom_wb_t wb;
+    ret = veeprom_wb_init(&wb, &a->veeprom);
+    VEEPROM_THROW(ret == OK, ret);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 43) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
+    uint8_t data[16];
+    for (int i = 0; i < 1000 && ret == OK; i++) {
+        memset(data, i, sizeof(data));
+        ret = veeprom_wb_write(&wb, 1, data, sizeof(data));
+        if (ret == OK && i % 10 == 0)
+            ret = veeprom_wb_tick(&wb, i / 10);
     }
+    VEEPROM_THROW(ret == OK, ret);
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 43, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 0, ERROR_DCNSTY);
+    uint8_t buf[sizeof(data)];
+    veeprom_read_t read_buf = { .id = 1, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == VEEPROM_ERROR_ID_NOTFOUND, ERROR_DCNSTY);
+    ret = veeprom_wb_read(&wb, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data) && buf[0] == (uint8_t)999, ERROR_DCNSTY);
 
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
+    ret = veeprom_wb_tick(&wb, VEEPROM_WB_MAX_AGE_MS);
+    VEEPROM_THROW(ret == OK, ret);
+    veeprom_wb_stats_t stats;
+    veeprom_wb_get_stats(&wb, &stats);
+    VEEPROM_THROW(stats.writes == 1000 && stats.flash_writes == 1, ERROR_DCNSTY);
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(buf[0] == (uint8_t)999, ERROR_DCNSTY);
 
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
+    /* after a power fail writes go to flash directly */
+    ret = veeprom_wb_power_fail(&wb);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_wb_write(&wb, 2, data, 1);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 2) != NULL, ERROR_DCNSTY);
 
-    uint16_t *page = vstatus->flash_start +
-        FLASH_PAGE_SIZE_2B * 43;
-    VEEPROM_THROW(*page == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 1) == 0,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 2) == 243,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 3) == 1014,
-            ERROR_DCNSTY);
+    return veeprom_wb_deinit(&wb);
+}
 
-    i = 0;
-    for (; i < 507; i++) {
-        uint16_t expected = i;
-        uint16_t actual = *(page + 4 + i);
-        VEEPROM_THROW(expected == actual, ERROR_DCNSTY);
-    }
 
-    VEEPROM_THROW(*(page + 511) == 0x02FE, ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
+#if defined(VEEPROM_ASYNC_ERASE) && !defined(VEEPROM_DUAL_REGION)
+static int verify_54_pending(alloc_res *a) {
+    veeprom_status_t *status = veeprom_get_status(&a->veeprom);
+    int pending = 0;
+    for (int i = 0; i < VEEPROM_DIRTY_WORDS; i++)
+        pending += status->erase_map[i] != 0;
+    return pending;
 }
 
 
-int verify_28(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Released pages are erased in the background by veeprom_poll(), a page
+ * which is not erased yet doesn't bring a deleted record back at mount.
+ */
+int verify_54(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-    }
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root == tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data == NULL,
-            ERROR_DCNSTY);
-
-    uint16_t *page = vstatus->flash_start +
-        FLASH_PAGE_SIZE_2B * 43;
-    VEEPROM_THROW(*page == 0xFFFF,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 1) == 0xFFFF,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(page + 2) == 0xFFFF,
-            ERROR_DCNSTY);
+    uint8_t data[1000];
+    memset(data, 1, sizeof(data));
+    for (int i = 0; i < 10 && ret == OK; i++)
+        ret = veeprom_write(&a->veeprom, 1 + i % 2, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(verify_54_pending(a), ERROR_DCNSTY);
 
-    i = 0;
-    for (; i < 508; i++) {
-        VEEPROM_THROW(*(page + 3 + i) == 0xFFFF, ERROR_DCNSTY);
+    for (int i = 0; i < 1000 && verify_54_pending(a) && ret == OK; i++) {
+        struct timespec delay = { 0, 100000 };
+        nanosleep(&delay, NULL);
+        ret = veeprom_poll(&a->veeprom);
     }
-
-    VEEPROM_THROW(*(page + 511) == 0xFFFF, ERROR_DCNSTY);
-    VEEPROM_THROW(vstatus->next_alloc == 100, ERROR_VALUE);
-    return OK;
-}
-
-
-int verify_29(alloc_res *a) {
-    int ret = init_flash(a);
     VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(!verify_54_pending(a), ERROR_DCNSTY);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 3, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 100 || i == 32 || i == 1) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
-    }
+    ret = veeprom_write(&a->veeprom, 2, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_delete(&a->veeprom, 2);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(verify_54_pending(a), ERROR_DCNSTY);
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 100, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 0, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 32, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 0, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 2, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 984, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    rbtree *tree = vstatus->ids;
-    VEEPROM_THROW(tree->root != tree->nullnode,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(tree->root->data != NULL,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p) == 123,
-            ERROR_DCNSTY);
-    VEEPROM_THROW(*(((vdata*)tree->root->data)->p+1) == 2069,
-            ERROR_DCNSTY);
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 2) == NULL, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 1) != NULL, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 101, ERROR_VALUE);
     return OK;
 }
+#endif
+
+
+#ifdef VEEPROM_DUAL_REGION
+/* Counts pages of the region waiting for the erase */
+static int verify_55_pending(alloc_res *a, int region) {
+    veeprom_status_t *status = veeprom_get_status(&a->veeprom);
+    int half = a->veeprom.page_count / 2;
+    int pending = 0;
+    for (int physnum = region * half; physnum < a->veeprom.page_count && physnum < (region + 1) * half; physnum++)
+        pending += (status->erase_map[physnum >> 5] >> (physnum & 31)) & 1;
+    return pending;
+}
 
 
-int verify_30(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * Only the inactive region is erased, released pages of the active
+ * region wait until it changes and the records stay readable.
+ */
+int verify_55(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 0, ERROR_DCNSTY);
-
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
+    uint8_t data[1000];
+    uint8_t buf[sizeof(data) + sizeof(flash_chunk_t)];
+    memset(data, 1, sizeof(data));
+    veeprom_status_t *status = veeprom_get_status(&a->veeprom);
+    int half = a->veeprom.page_count / 2;
+    for (int i = 0; i < 200 && ret == OK; i++) {
+        ret = veeprom_write(&a->veeprom, 1 + i % 2, data, sizeof(data));
+        if (ret == OK)
+            ret = veeprom_poll(&a->veeprom);
+        VEEPROM_THROW(status->erasing == -1 ||
+                (status->erasing >= half) != status->active_region, ERROR_DCNSTY);
     }
-
-    VEEPROM_THROW(vstatus->page_order->root ==
-            vstatus->page_order->nullnode, ERROR_VALUE);
-
-    VEEPROM_THROW(vstatus->next_alloc == 101, ERROR_VALUE);
-    return OK;
-}
-
-
-int verify_31(alloc_res *a) {
-    int ret = init_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
-
-    VEEPROM_THROW(vstatus->busy_pages == 4, ERROR_DCNSTY);
 
-    int i = 0;
-    for (; i < FLASH_PAGE_COUNT; i++) {
-        if (i == 24 || i == 12 || i == 14 || i == 1) {
-            VEEPROM_THROW(vstatus->busy_map[i] == -1, ERROR_DCNSTY);
-        } else {
-            VEEPROM_THROW(vstatus->busy_map[i] == i, ERROR_DCNSTY);
-        }
+    int inactive = !status->active_region;
+    for (int i = 0; i < 1000 && verify_55_pending(a, inactive) && ret == OK; i++) {
+        struct timespec delay = { 0, 100000 };
+        nanosleep(&delay, NULL);
+        ret = veeprom_poll(&a->veeprom);
     }
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(!verify_55_pending(a, inactive), ERROR_DCNSTY);
 
-    rbnode *n = rb_min_node(vstatus->page_order, vstatus->page_order->root);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    vpage_status *pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 24, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 984, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 12, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 0, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 2, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 14, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 0, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(!rb_is_nullnode(vstatus->page_order, n), ERROR_NULLPTR);
-    VEEPROM_THROW(n->data != NULL, ERROR_NULLPTR);
-    pstatus = (vpage_status*)n->data;
-    VEEPROM_THROW(pstatus->counter == 3, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->physnum == 1, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->fragments == 0, ERROR_DCNSTY);
-    VEEPROM_THROW(pstatus->free_space == 1014, ERROR_DCNSTY);
-
-    n = rb_next_node(vstatus->page_order, n);
-    VEEPROM_THROW(rb_is_nullnode(vstatus->page_order, n), ERROR_DCNSTY);
-
-    vdata_adapter data;
-    data.p = &data.id;
-    data.id = 12345;
-    rbnode *node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node == vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 123;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 456;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 1;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 12;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 12777;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
-
-    data.id = 888;
-    node = rb_search_node(vstatus->ids, &data);
-    VEEPROM_THROW(node != vstatus->ids->nullnode,
-            ERROR_DCNSTY);
+    veeprom_read_t read_buf = { .id = 2, .buf = buf, .buf_size = sizeof(buf) };
+    ret = veeprom_read(&a->veeprom, &read_buf);
+    VEEPROM_THROW(ret == OK, ret);
+    VEEPROM_THROW(read_buf.length == sizeof(data), ERROR_VALUE);
+    VEEPROM_THROW(memcmp(buf, data, sizeof(data)) == 0, ERROR_DCNSTY);
 
-    VEEPROM_THROW(vstatus->next_alloc == 25, ERROR_VALUE);
     return OK;
 }
+#endif
 
 
-int verify_32(alloc_res *a) {
-    int ret = init_flash(a);
+#ifndef FLASH_SECTORS
+/*
+ * Four shards, each on its own quarter of the flash, are mounted in
+ * parallel. Every id lands in the shard veeprom_shard() picks for it
+ * and is found there again after the shards are mounted once more.
+ */
+int verify_56(alloc_res *a) {
+    int ret = mount_flash(a);
+    VEEPROM_THROW(ret == OK, ret);
+    veeprom_deinit(&a->veeprom);
+
+    static veeprom_shards_t shards;
+    int quarter = FLASH_PAGE_COUNT / 4;
+    veeprom_region_t regions[4];
+    for (int i = 0; i < 4; i++)
+        regions[i] = (veeprom_region_t){ (flash_chunk_t*)a->mapped_mem + i * quarter * FLASH_PAGE_CHUNKS, quarter };
+    ret = veeprom_shards_init(&shards, regions, 4);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    int id1 = 123;
-    int id2 = 456;
-    int id3 = 789;
-    int length = 255;
-    uint8_t *data = malloc(length);
-    int i = 0;
-    for (; i < length; i++)
-        *(data + i) = i;
-
-    i = 0;
-    for (; i < 43690; i++) {
-        ret = veeprom_write(id1, data, length, vstatus);
-        VEEPROM_THROW(ret == OK, ret, free(data));
-        ret = veeprom_write(id2, data, length, vstatus);
-        VEEPROM_THROW(ret == OK, ret, free(data));
-        ret = veeprom_write(id3, data, length, vstatus);
-        VEEPROM_THROW(ret == OK, ret, free(data));
+    uint8_t data[32];
+    for (int id = 1; id <= 40 && ret == OK; id++) {
+        memset(data, id, sizeof(data));
+        ret = veeprom_shards_write(&shards, id, data, sizeof(data));
     }
-
-    ret = veeprom_write(id1, data, length, vstatus);
-    VEEPROM_THROW(ret == OK, ret, free(data));
-    ret = veeprom_write(id2, data, length, vstatus);
-    VEEPROM_THROW(ret == ERROR_FLASH_EXPIRED, ERROR_EFAIL, free(data));
-
-    free(data);
-    return OK;
-}
-
-
-int verify_33(alloc_res *a) {
-    int ret = init_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
+    veeprom_shards_deinit(&shards);
+    ret = veeprom_shards_init(&shards, regions, 4);
+    VEEPROM_THROW(ret == OK, ret);
 
-    int id1 = 123;
-    int length = 2069;
-    uint8_t *data = malloc(length);
-    int i = 0;
-    for (; i < length; i++) {
-        if (i % 2)
-            *(data + i) = 'a';
-        else
-            *(data + i) = 'b';
-    }
-    i = 0;
-    for (; i < 123; i++) {
-        ret = veeprom_write(id1, data, length, vstatus);
-        VEEPROM_THROW(ret == OK, ret, free(data));
+    for (int i = 0; i < 4; i++)
+        VEEPROM_THROW(veeprom_get_ids_size(&shards.stores[i]) > 0, ERROR_DCNSTY);
+    uint8_t buf[sizeof(data)];
+    veeprom_read_t read_buf = { .buf = buf, .buf_size = sizeof(buf) };
+    for (int id = 1; id <= 40; id++) {
+        read_buf.id = id;
+        ret = veeprom_shards_read(&shards, &read_buf);
+        VEEPROM_THROW(ret == OK, ret);
+        VEEPROM_THROW(read_buf.length == sizeof(data) && buf[0] == id, ERROR_DCNSTY);
+        VEEPROM_THROW(veeprom_find(veeprom_shard(&shards, id), id) != NULL, ERROR_DCNSTY);
     }
-    ret = veeprom_write(id1, data, length, vstatus);
-    VEEPROM_THROW(ret == ERROR_NOMEM, ret, free(data));
-    free(data);
 
-    return OK;
+    return veeprom_shards_deinit(&shards);
 }
 
 
-int verify_34(alloc_res *a) {
-    int ret = init_flash(a);
+/*
+ * The mount counts a record which lost its last page as torn and
+ * the pages it releases.
+ */
+int verify_57(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
 
-    int length = 1;
-    uint8_t data[] = { "q" };
+    uint8_t data[2500];
+    fill_random(data, sizeof(data));
+    ret = veeprom_write(&a->veeprom, 1, data, 10);
+    VEEPROM_THROW(ret == OK, ret);
+    ret = veeprom_write(&a->veeprom, 2, data, sizeof(data));
+    VEEPROM_THROW(ret == OK, ret);
 
-    int i = 1;
-    for (; i < 16257; i++) {
-        ret = veeprom_write(i, &data[0], length, vstatus);
-        VEEPROM_THROW(ret == OK, ret);
-    }
-    ret = veeprom_write(i, &data[0], length, vstatus);
-    VEEPROM_THROW(ret == ERROR_NOMEM, ret);
-    i = 1;
-    for (; i < 16257; i++) {
-        ret = veeprom_delete(i, vstatus);
-        VEEPROM_THROW(ret == OK, ret);
-    }
+    flash_chunk_t **pages = veeprom_get_pages(&a->veeprom);
+    int pages_size = veeprom_get_pages_size(&a->veeprom);
+    VEEPROM_THROW(pages_size == 4, ERROR_DCNSTY);
+    ret = flash_erase_page(pages[pages_size - 1] - 1);
+    VEEPROM_THROW(ret == OK, ret);
 
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
+    veeprom_status_t *status = veeprom_get_status(&a->veeprom);
+    VEEPROM_THROW(status->torn_records == 1 && status->recovered_pages == 2, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 2) == NULL, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 1) != NULL, ERROR_DCNSTY);
 
     return OK;
 }
 
 
-int verify_35(alloc_res *a) {
-    int ret = init_flash(a);
+#ifndef VEEPROM_COMPRESSION
+/*
+ * Pages of a record whose head was erased (as older firmware removed
+ * records) are not taken for records even if their data look like
+ * a length.
+ */
+int verify_58(alloc_res *a) {
+    int ret = mount_flash(a);
     VEEPROM_THROW(ret == OK, ret);
 
-    veeprom_status *vstatus = a->vstatus;
-
-    int id = 123;
-    int length = 0xFFFF - 1;
-    uint8_t *data = malloc(length);
-    memset((void*)data, 3, length);
-    ret = veeprom_write(id, &data[0], length, vstatus);
+    /* every chunk of the continuation pages reads as length 4 */
+    flash_chunk_t data[2500 / sizeof(flash_chunk_t)];
+    for (int i = 0; i < ARRAY_SIZE(data); i++)
+        data[i] = 4;
+    ret = veeprom_write(&a->veeprom, 1, (uint8_t*)data, 10);
     VEEPROM_THROW(ret == OK, ret);
-    ret = veeprom_write(id, &data[0], length, vstatus);
-    VEEPROM_THROW(ret == ERROR_NOMEM, ret);
-    free(data);
-
-    return OK;
-}
-
-
-int verify_36(alloc_res *a) {
-    int ret = init_flash(a);
+    ret = veeprom_write(&a->veeprom, 2, (uint8_t*)data, sizeof(data));
     VEEPROM_THROW(ret == OK, ret);
-    veeprom_status *vstatus = a->vstatus;
 
-    int id = 1;
-    int length = 6;
-    uint8_t *data = malloc(length);
+    flash_chunk_t **pages = veeprom_get_pages(&a->veeprom);
+    int pages_size = veeprom_get_pages_size(&a->veeprom);
+    VEEPROM_THROW(pages_size >= 3, ERROR_DCNSTY);
+    ret = flash_erase_page(pages[1] - 1);
+    VEEPROM_THROW(ret == OK, ret);
 
-    for (; id < 86; id++) {
-        memset((void*)data, id, length);
-        ret = veeprom_write(id, &data[0], length, vstatus);
-        VEEPROM_THROW(ret == OK, ret);
-    }
-    free(data);
+    veeprom_deinit(&a->veeprom);
+    ret = veeprom_init(&a->veeprom, a->mapped_mem, 0);
+    VEEPROM_THROW(ret == OK, ret);
+    veeprom_status_t *status = veeprom_get_status(&a->veeprom);
+    VEEPROM_THROW(status->torn_records == 1
+            && status->recovered_pages == pages_size - 2, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 2) == NULL, ERROR_DCNSTY);
+    VEEPROM_THROW(veeprom_find(&a->veeprom, 1) != NULL, ERROR_DCNSTY);
 
     return OK;
 }
+#endif
+#endif
 
 
 int unlink_testcase(const char *filename) {
@@ -1447,49 +1069,52 @@ struct verification_suite {
 
 
 static struct verification_suite VERIFICATION_SUITE[] = {
-    { "verify_rbtree_1", &verify_rbtree_1, NULL },
-    { "verify_clear", &verify_clear, &gen_clear },
-    { "verify_2", &verify_2, &gen_verify_2 },
-    { "verify_3", &verify_3, &gen_verify_3 },
-    { "verify_4", &verify_4, &gen_verify_4 },
-    { "verify_5", &verify_5, &gen_verify_5 },
-    { "verify_6", &verify_6, &gen_verify_6 },
-    { "verify_7", &verify_7, &gen_verify_7 },
-    { "verify_8", &verify_8, &gen_verify_8 },
-    { "verify_9", &verify_9, &gen_verify_9 },
-    { "verify_10", &verify_10, &gen_verify_10 },
-    { "verify_11", &verify_11, &gen_verify_11 },
-    { "verify_12", &verify_12, &gen_verify_12 },
-    { "verify_13", &verify_13, &gen_verify_13 },
-    { "verify_14", &verify_14, &gen_verify_14 },
-    { "verify_15", &verify_15, &gen_verify_15 },
-    { "verify_16", &verify_16, &gen_verify_16 },
-    { "verify_17", &verify_17, &gen_verify_17 },
-    { "verify_18", &verify_18, &gen_verify_18 },
-    { "verify_19", &verify_19, &gen_verify_19 },
-    { "verify_20", &verify_20, &gen_verify_20 },
-    { "verify_21", &verify_21, &gen_verify_21 },
-    { "verify_22", &verify_22, &gen_verify_22 },
-    { "verify_23", &verify_23, &gen_verify_23 },
-    { "verify_24", &verify_24, &gen_verify_24 },
-    { "verify_25", &verify_25, &gen_verify_25 },
-    { "verify_26", &verify_26, &gen_verify_26 },
-    { "verify_27", &verify_27, &gen_verify_27 },
-    { "verify_28", &verify_28, &gen_verify_28 },
-    { "verify_29", &verify_29, &gen_verify_29 },
-    { "verify_30", &verify_30, &gen_verify_30 },
-    { "verify_31", &verify_31, &gen_verify_31 },
-    { "verify_32", &verify_32, &gen_clear },
-    { "verify_33", &verify_33, &gen_clear },
-    { "verify_34", &verify_34, &gen_clear },
-    { "verify_35", &verify_35, &gen_clear },
-    { "verify_36", &verify_36, &gen_clear },
+    { "verify_37", &verify_37, &gen_clear },
+    { "verify_38", &verify_38, &gen_clear },
+    { "verify_39", &verify_39, &gen_clear },
+    { "verify_40", &verify_40, &gen_clear },
+    { "verify_41", &verify_41, &gen_clear },
+#ifdef VEEPROM_BLANK_CHECK
+    { "verify_42", &verify_42, &gen_clear },
+#endif
+    { "verify_43", &verify_43, &gen_clear },
+    { "verify_44", &verify_44, &gen_clear },
+#ifdef VEEPROM_COMPRESSION
+    { "verify_45", &verify_45, &gen_clear },
+#endif
+    { "verify_46", &verify_46, &gen_clear },
+    { "verify_47", &verify_47, &gen_clear },
+#ifdef FLASH_SECTORS
+    { "verify_48", &verify_48, &gen_clear },
+#else
+    { "verify_49", &verify_49, &gen_clear },
+#endif
+#ifdef VEEPROM_KEYS
+    { "verify_50", &verify_50, &gen_clear },
+#endif
+#ifdef VEEPROM_THREADS
+    { "verify_51", &verify_51, &gen_clear },
+    { "verify_52", &verify_52, &gen_clear },
+#endif
+    { "verify_53", &verify_53, &gen_clear },
+#if defined(VEEPROM_ASYNC_ERASE) && !defined(VEEPROM_DUAL_REGION)
+    { "verify_54", &verify_54, &gen_clear },
+#endif
+#ifdef VEEPROM_DUAL_REGION
+    { "verify_55", &verify_55, &gen_clear },
+#endif
+#ifndef FLASH_SECTORS
+    { "verify_56", &verify_56, &gen_clear },
+    { "verify_57", &verify_57, &gen_clear },
+#ifndef VEEPROM_COMPRESSION
+    { "verify_58", &verify_58, &gen_clear },
+#endif
+#endif
 };
 
 
 void reset(alloc_res *a) {
     a->mapped_mem = NULL;
-    a->vstatus = NULL;
     a->fd = -1;
 }
 
@@ -1527,8 +1152,6 @@ int main() {
             fprintf(stderr, "FAILED\n");
         }
 
-        VEEPROM_TRACE((ret=veeprom_status_release(a->vstatus)) == OK, ret);
-
         if (a->mapped_mem != NULL)
             VEEPROM_TRACE((ret = flash_uninit(a->mapped_mem)) == OK, ret);
 
@@ -1545,5 +1168,5 @@ int main() {
 
     fprintf(stderr, "_________________________\n");
     fprintf(stderr, "PASSED: %d FAILED: %d\n", passed, failed);
-    return 0;
+    return failed != 0;
 }
@@ -20,106 +20,97 @@
 #include <stdlib.h>
 #include <string.h>
 #include "wrappers.h"
-#include "flash_cfg.h"
-#include "flash.h"
+#include "eeprom.h"
 #include "errnum.h"
 #include "errmsg.h"
 #include "gen_testcases.h"
 
 
-#define PAGE_RECEIVING 0xAAAA
-#define PAGE_VALID 0x0000
-#define PAGE_ERASED 0xFFFF
-
-#define VEEPROM_PAGE_HEADER 4
-#define VEEPROM_PAGE_HEADER_2B 2
-
-#define VEEPROM_PAGE_STATUS_BITS 0xc000
-#define VEEPROM_PAGE_STATUS_SHIFT 14
-
-#define VEEPROM_COUNTER_BITS 0x3FFF
-
-
+/*
+ * Images are generated for the configured chunk width, all sizes below
+ * are in chunks and lengths of records are derived from them.
+ */
+#define PAGE_CHUNKS FLASH_PAGE_CHUNKS
 
-#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+/* Odd length of a record spanning two pages */
+#define TWO_PAGE_LENGTH ((PAGE_CHUNKS - 2) * sizeof(flash_chunk_t) - 1)
 
 
-static int write_hw(int value, FILE *file) {
-    uint16_t hw = value & 0xFFFF;
-    return fwrite(&hw, sizeof(hw), 1, file);
+static int write_chunk(flash_chunk_t value, FILE *file) {
+    return fwrite(&value, sizeof(value), 1, file);
 }
 
 
-static int write_id_length(uint16_t id, uint16_t length, FILE *file) {
-    int hw_written = 0;
-    int written = fwrite(&id, sizeof(uint16_t), 1, file);
+static int write_id_length(flash_chunk_t id, flash_chunk_t length, FILE *file) {
+    int chunks_written = 0;
+    int written = fwrite(&id, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, ERROR_WRT);
-    hw_written += 1;
+    chunks_written += 1;
 
-    written = fwrite(&length, sizeof(uint16_t), 1, file);
+    written = fwrite(&length, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, -ERROR_WRT);
-    hw_written += 1;
+    chunks_written += 1;
 
-    return hw_written;
+    return chunks_written;
 }
 
 
-static int write_data(uint16_t id, uint16_t length, FILE *file) {
-    int hw_written = write_id_length(id, length, file);
+static int write_data(flash_chunk_t id, flash_chunk_t length, FILE *file) {
+    int chunks_written = write_id_length(id, length, file);
 
-    uint16_t checksum = id ^ length;
+    flash_chunk_t checksum = id ^ length;
     int i = 0;
-    int aligned_length_2b = (length + (length & 1)) >> 1;
-    for (; i < aligned_length_2b; i++) {
-        int written = fwrite(&i, sizeof(uint16_t), 1, file);
+    int aligned_chunks = TO_CHUNKS(length);
+    for (; i < aligned_chunks; i++) {
+        int written = write_chunk(i, file);
         VEEPROM_THROW(written == 1, -ERROR_WRT);
-        hw_written += 1;
+        chunks_written += 1;
         checksum ^= i; 
     }
 
-    int written = fwrite(&checksum, sizeof(uint16_t), 1, file);
+    int written = fwrite(&checksum, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, -ERROR_WRT);
-    hw_written += 1;
+    chunks_written += 1;
 
-    return hw_written;
+    return chunks_written;
 }
 
 
-static int write_raw(uint16_t num, uint16_t sval, FILE *file) {
+static int write_raw(flash_chunk_t num, flash_chunk_t sval, FILE *file) {
     int i = 0;
-    int hw_written = 0;
+    int chunks_written = 0;
     for (; i < num; i++, sval++) {
-        int written = fwrite(&sval, sizeof(uint16_t), 1, file);
+        int written = fwrite(&sval, sizeof(flash_chunk_t), 1, file);
         VEEPROM_THROW(written == 1, -ERROR_WRT);
-        hw_written += 1;
+        chunks_written += 1;
     }
-    return hw_written;
+    return chunks_written;
 }
 
 
-static int write_data_checksum(uint16_t id, uint16_t length,
-        uint16_t checksum, FILE *file) {
-    int hw_written = write_id_length(id, length, file);
+static int write_data_checksum(flash_chunk_t id, flash_chunk_t length,
+        flash_chunk_t checksum, FILE *file) {
+    int chunks_written = write_id_length(id, length, file);
     int i = 0;
-    int aligned_length_2b = (length + (length & 1)) >> 1;
-    for (; i < aligned_length_2b; i++) {
-        int written = fwrite(&i, sizeof(uint16_t), 1, file);
+    int aligned_chunks = TO_CHUNKS(length);
+    for (; i < aligned_chunks; i++) {
+        int written = write_chunk(i, file);
         VEEPROM_THROW(written == 1, -ERROR_WRT);
-        hw_written += 1;
+        chunks_written += 1;
     }
 
-    int written = fwrite(&checksum, sizeof(uint16_t), 1, file);
+    int written = fwrite(&checksum, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, -ERROR_WRT);
-    hw_written += 1;
+    chunks_written += 1;
 
-    return hw_written;
+    return chunks_written;
 }
 
 
-int write_header(FILE *file, int status, int num) {
-    int written = fwrite(&status, sizeof(uint16_t), 1, file);
+int write_header(FILE *file, flash_chunk_t status, flash_chunk_t num) {
+    int written = fwrite(&status, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, ERROR_WRT);
-    written = fwrite(&num, sizeof(uint16_t), 1, file);
+    written = fwrite(&num, sizeof(flash_chunk_t), 1, file);
     VEEPROM_THROW(written == 1, ERROR_WRT);
     return 2;
 }
@@ -127,10 +118,10 @@ int write_header(FILE *file, int status, int num) {
 
 static int fill_empty(int num, FILE *file) {
     int total_written = 0;
-    uint16_t empty = 0xFFFF;
+    flash_chunk_t empty = PAGE_ERASED;
     int i = 0;
     for (; i < num; i++) {
-        int written = fwrite(&empty, sizeof(uint16_t), 1, file);
+        int written = fwrite(&empty, sizeof(flash_chunk_t), 1, file);
         VEEPROM_THROW(written == 1, -ERROR_WRT);
         total_written++;
     }
@@ -138,10 +129,10 @@ static int fill_empty(int num, FILE *file) {
 }
 
 
-uint16_t calc_checksum(int id, int length) {
-    uint16_t checksum = id ^ length;
-    int alen = (length + (length & 1)) >> 1;
-    uint16_t i = 0;
+flash_chunk_t calc_checksum(flash_chunk_t id, int length) {
+    flash_chunk_t checksum = id ^ length;
+    int alen = TO_CHUNKS(length);
+    flash_chunk_t i = 0;
     for (; i < alen; i++)
         checksum ^= i;
     return checksum;
@@ -153,19 +144,19 @@ uint16_t calc_checksum(int id, int length) {
  */
 int gen_verify_2(const char *filename) {
     FILE *file = fopen(filename, "w+");
-    uint16_t e = 0xFFFF;
-    uint16_t r = 0xAAAA;
+    flash_chunk_t e = PAGE_ERASED;
+    flash_chunk_t r = PAGE_RECEIVING;
     int i = 0;
     int written = 0;
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
-        for (i = 0; i < FLASH_PAGE_SIZE_2B; i++) {
+        for (i = 0; i < PAGE_CHUNKS; i++) {
             if (i == 0 && (page == 2 || page == 4 || page == 99))
-                written = fwrite(&r, sizeof(uint16_t), 1, file);
+                written = fwrite(&r, sizeof(flash_chunk_t), 1, file);
             else if (i == 1 && (page == 2 || page == 4 || page == 99))
-                written = fwrite(&page, sizeof(uint16_t), 1, file);
+                written = write_chunk(page, file);
             else
-                written = fwrite(&e, sizeof(uint16_t), 1, file);
+                written = fwrite(&e, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
         }
     }
@@ -179,19 +170,19 @@ int gen_verify_2(const char *filename) {
  */
 int gen_verify_3(const char *filename) {
     FILE *file = fopen(filename, "w+");
-    uint16_t e = 0xFFFF;
-    uint16_t r = 0xAAAA;
+    flash_chunk_t e = PAGE_ERASED;
+    flash_chunk_t r = PAGE_RECEIVING;
     int i = 0;
     int written = 0;
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
-        for (i = 0; i < FLASH_PAGE_SIZE_2B; i++) {
+        for (i = 0; i < PAGE_CHUNKS; i++) {
             if (i == 0 && (page == 0 || page == 1 || page == 99))
-                written = fwrite(&r, sizeof(uint16_t), 1, file);
+                written = fwrite(&r, sizeof(flash_chunk_t), 1, file);
             else if (i == 1 && (page == 0 || page == 1 || page == 99))
-                written = fwrite(&page, sizeof(uint16_t), 1, file);
+                written = write_chunk(page, file);
             else
-                written = fwrite(&e, sizeof(uint16_t), 1, file);
+                written = fwrite(&e, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
         }
     }
@@ -210,18 +201,18 @@ int gen_verify_4(const char *filename) {
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 2) {
-            int hw_written = write_header(file, PAGE_VALID, 123);
+            int chunks_written = write_header(file, PAGE_VALID, 123);
             int ret = OK;
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -236,27 +227,27 @@ int gen_verify_4(const char *filename) {
  */
 int gen_verify_5(const char *filename) {
     FILE *file = fopen(filename, "w+");
-    uint16_t e = 0xFFFF;
-    uint16_t r = 0xAAAA;
-    uint16_t v = 0x0000;
+    flash_chunk_t e = PAGE_ERASED;
+    flash_chunk_t r = PAGE_RECEIVING;
+    flash_chunk_t v = PAGE_VALID;
     int i = 0;
     int written = 0;
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 2) {
-            written = fwrite(&v, sizeof(uint16_t), 1, file);
+            written = fwrite(&v, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            uint16_t virtnum = 0;
-            written = fwrite(&virtnum, sizeof(uint16_t), 1, file);
+            flash_chunk_t virtnum = 0;
+            written = fwrite(&virtnum, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            written = fill_empty(510, file);
-            VEEPROM_THROW(written == 510, ERROR_WRT);
+            written = fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(written == PAGE_CHUNKS - 2, ERROR_WRT);
         } else {
-            for (i = 0; i < FLASH_PAGE_SIZE_2B; i++) {
+            for (i = 0; i < PAGE_CHUNKS; i++) {
                 if (i == 0 && (page == 0 || page == 1 || page == 99))
-                    written = fwrite(&r, sizeof(uint16_t), 1, file);
+                    written = fwrite(&r, sizeof(flash_chunk_t), 1, file);
                 else
-                    written = fwrite(&e, sizeof(uint16_t), 1, file);
+                    written = fwrite(&e, sizeof(flash_chunk_t), 1, file);
                 VEEPROM_THROW(written == 1, ERROR_WRT);
             }
         }
@@ -274,36 +265,36 @@ int gen_verify_5(const char *filename) {
  */
 int gen_verify_6(const char *filename) {
     FILE *file = fopen(filename, "w+");
-    uint16_t e = 0xFFFF;
-    uint16_t r = 0xAAAA;
+    flash_chunk_t e = PAGE_ERASED;
+    flash_chunk_t r = PAGE_RECEIVING;
     int i = 0;
     int written = 0;
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 2) {
-            int page_status = 0x0;
-            written = fwrite(&page_status, sizeof(uint16_t), 1, file);
+            flash_chunk_t page_status = PAGE_VALID;
+            written = fwrite(&page_status, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            int page_number = 0x0000;
-            written = fwrite(&page_number, sizeof(uint16_t), 1, file);
+            flash_chunk_t page_number = 0;
+            written = fwrite(&page_number, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            written = fill_empty(510, file);
-            VEEPROM_THROW(written == 510, ERROR_WRT);
+            written = fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(written == PAGE_CHUNKS - 2, ERROR_WRT);
         } else if (page == 3) {
-            int page_status = 0x0;
-            written = fwrite(&page_status, sizeof(uint16_t), 1, file);
+            flash_chunk_t page_status = PAGE_VALID;
+            written = fwrite(&page_status, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            int page_number = 0x0003;
-            written = fwrite(&page_number, sizeof(uint16_t), 1, file);
+            flash_chunk_t page_number = 3;
+            written = fwrite(&page_number, sizeof(flash_chunk_t), 1, file);
             VEEPROM_THROW(written == 1, ERROR_WRT);
-            written = fill_empty(510, file);
-            VEEPROM_THROW(written == 510, ERROR_WRT);
+            written = fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(written == PAGE_CHUNKS - 2, ERROR_WRT);
         } else {
-            for (i = 0; i < FLASH_PAGE_SIZE_2B; i++) {
+            for (i = 0; i < PAGE_CHUNKS; i++) {
                 if (i == 0 && (page == 0 || page == 1 || page == 99))
-                    written = fwrite(&r, sizeof(uint16_t), 1, file);
+                    written = fwrite(&r, sizeof(flash_chunk_t), 1, file);
                 else
-                    written = fwrite(&e, sizeof(uint16_t), 1, file);
+                    written = fwrite(&e, sizeof(flash_chunk_t), 1, file);
                 VEEPROM_THROW(written == 1, ERROR_WRT);
             }
         }
@@ -328,36 +319,36 @@ int gen_verify_7(const char *filename) {
     // v - 1 v - 2 r - 3 r - 4 r - 5
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 0) {
-            int hw_written = write_header(file, PAGE_RECEIVING, 3);
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            int chunks_written = write_header(file, PAGE_RECEIVING, 3);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 99) {
-            int hw_written = write_header(file, PAGE_RECEIVING, 4);
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            int chunks_written = write_header(file, PAGE_RECEIVING, 4);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 1) {
-            int hw_written = write_header(file, PAGE_RECEIVING, 5);
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            int chunks_written = write_header(file, PAGE_RECEIVING, 5);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 20) {
-            int hw_written = write_header(file, PAGE_VALID, 0);
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            int chunks_written = write_header(file, PAGE_VALID, 0);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 127) {
-            int hw_written = write_header(file, PAGE_VALID, 1);
-            VEEPROM_THROW((ret=fill_empty(510, file)) > 0, ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            int chunks_written = write_header(file, PAGE_VALID, 1);
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS - 2, file)) > 0, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int hw_written = 0;
-            VEEPROM_THROW((ret=fill_empty(512, file)) > 0,    
+            int chunks_written = 0;
+            VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS, file)) > 0,    
                     ERROR_WRT);
-            hw_written += ret;
-            VEEPROM_THROW(hw_written == 512, ERROR_WRT);
+            chunks_written += ret;
+            VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -377,19 +368,19 @@ int gen_verify_8(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 44) {
             int w = write_header(file, PAGE_VALID, 1);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -410,19 +401,19 @@ int gen_verify_9(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -443,24 +434,24 @@ int gen_verify_10(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
             w += fill_empty(10, file);
-            uint16_t jag = 0x0000;
+            flash_chunk_t jag = 0;
             w += fwrite(&jag, sizeof(jag), 1, file);
             w += fill_empty(10, file);
             w += fwrite(&jag, sizeof(jag), 1, file);
-            w += fill_empty(488, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 24, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -480,24 +471,24 @@ int gen_verify_11(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             w += fill_empty(10, file);
-            uint16_t jag = 0x0000;
+            flash_chunk_t jag = 0;
             w += fwrite(&jag, sizeof(jag), 1, file);
             w += fill_empty(10, file);
             w += fwrite(&jag, sizeof(jag), 1, file);
-            w += fill_empty(488, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 24, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -520,25 +511,25 @@ int gen_verify_12(const char *filename) {
             int ret = write_data(243, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += fill_empty(507, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 5, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -562,25 +553,25 @@ int gen_verify_13(const char *filename) {
             int ret = write_data(243, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += fill_empty(487, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 25, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -601,28 +592,28 @@ int gen_verify_14(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(507, file);
+            w += fill_empty(PAGE_CHUNKS - 5, file);
             int ret = write_data(243, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -645,26 +636,26 @@ int gen_verify_15(const char *filename) {
             int ret = write_id_length(243, 0, file);
             VEEPROM_THROW(ret == 2, -ret);
             w += ret;
-            w += write_hw(777, file);
-            w += fill_empty(507, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += write_chunk(777, file);
+            w += fill_empty(PAGE_CHUNKS - 5, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -688,26 +679,26 @@ int gen_verify_16(const char *filename) {
             int ret = write_id_length(243, 0, file);
             VEEPROM_THROW(ret == 2, -ret);
             w += ret;
-            w += write_hw(123, file);
-            w += fill_empty(487, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += write_chunk(123, file);
+            w += fill_empty(PAGE_CHUNKS - 25, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -727,29 +718,29 @@ int gen_verify_17(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(507, file);
+            w += fill_empty(PAGE_CHUNKS - 5, file);
             int ret = write_id_length(243, 0, file);
             VEEPROM_THROW(ret == 2, -ret);
             w += ret;
-            w += write_hw(123, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += write_chunk(123, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -759,7 +750,7 @@ int gen_verify_17(const char *filename) {
 
 /*
  * Pages 0,1,99 - RECEIVING
- * Page 44 - VALID - number=0, top, invalid length (0xFFFF)
+ * Page 44 - VALID - number=0, top, invalid length (erased)
  * Page 77 - VALID - number=0
  */
 int gen_verify_18(const char *filename) {
@@ -768,28 +759,28 @@ int gen_verify_18(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            int ret = write_id_length(243, 0xFFFF, file);
+            int ret = write_id_length(243, VEEPROM_MAX_LENGTH, file);
             VEEPROM_THROW(ret == 2, -ret);
             w += ret;
-            w += fill_empty(508, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 4, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -799,7 +790,7 @@ int gen_verify_18(const char *filename) {
 
 /*
  * Pages 0, 1, 99 - RECEIVING
- * Page 44 - VALID - number=0, middle, invalid length (0xFFFF)
+ * Page 44 - VALID - number=0, middle, invalid length (erased)
  * Page 77 - VALID - number=0
  */
 int gen_verify_19(const char *filename) {
@@ -809,28 +800,28 @@ int gen_verify_19(const char *filename) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
             w += fill_empty(20, file);
-            int ret = write_id_length(243, 0xFFFF, file);
+            int ret = write_id_length(243, VEEPROM_MAX_LENGTH, file);
             VEEPROM_THROW(ret == 2, -ret);
             w += ret;
-            w += fill_empty(488, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 24, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -840,7 +831,7 @@ int gen_verify_19(const char *filename) {
 
 /*
  * Pages 0, 1, 99 - RECEIVING
- * Page 44 - VALID - number=0, bottom, invalid length (0xFFFF)
+ * Page 44 - VALID - number=0, bottom, invalid length (erased)
  * Page 77 - VALID - number=0
  */
 int gen_verify_20(const char *filename) {
@@ -849,28 +840,28 @@ int gen_verify_20(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(508, file);
-            int ret = write_id_length(243, 0xFFFF, file);
+            w += fill_empty(PAGE_CHUNKS - 4, file);
+            int ret = write_id_length(243, VEEPROM_MAX_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 77) {
             int w = write_header(file, PAGE_VALID, 0);
             int i = 0;
             for (; i < 4; i++) {
                 w += fill_empty(10, file);
-                uint16_t jag = 0x0000;
+                flash_chunk_t jag = 0;
                 w += fwrite(&jag, sizeof(jag), 1, file);
             }
-            w += fill_empty(466, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 46, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -888,18 +879,18 @@ int gen_verify_21(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
             int ret = write_data(243, 1, file);
             VEEPROM_THROW(ret == 4, -ret);
             w += ret;
-            w += fill_empty(506, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 6, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -921,15 +912,15 @@ int gen_verify_22(const char *filename) {
             int ret = write_data(243, 1, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += fill_empty(486, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 26, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -949,18 +940,18 @@ int gen_verify_23(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(506, file);
+            w += fill_empty(PAGE_CHUNKS - 6, file);
             int ret = write_data(243, 1, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -978,18 +969,18 @@ int gen_verify_24(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
             int ret = write_data_checksum(243, 1, 123, file);
             VEEPROM_THROW(ret == 4, -ret);
             w += ret;
-            w += fill_empty(506, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 6, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1011,15 +1002,15 @@ int gen_verify_25(const char *filename) {
             int ret = write_data_checksum(243, 1, 123, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += fill_empty(486, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 26, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1037,18 +1028,18 @@ int gen_verify_26(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 44) {
             int w = write_header(file, PAGE_VALID, 0);
-            w += fill_empty(506, file);
+            w += fill_empty(PAGE_CHUNKS - 6, file);
             int ret = write_data_checksum(243, 1, 123, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1059,7 +1050,7 @@ int gen_verify_26(const char *filename) {
 /*
  * Pages 0, 1, 99 - RECEIVING
  * Page 43 - VALID - number=0;
- *      data: length=1014, correct checksum
+ *      data: length fills the page, correct checksum
  */
 int gen_verify_27(const char *filename) {
     FILE *file = fopen(filename, "w+");
@@ -1067,17 +1058,17 @@ int gen_verify_27(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 43) {
             int w = write_header(file, PAGE_VALID, 0);
-            int ret = write_data(243, 1014, file);
+            int ret = write_data(243, GEN_PAGE_RECORD_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1088,7 +1079,7 @@ int gen_verify_27(const char *filename) {
 /*
  * Pages 0, 1, 99 - RECEIVING
  * Page 43 - VALID - number=0;
- *      data: length=1014, wrong checksum
+ *      data: length fills the page, wrong checksum
  */
 int gen_verify_28(const char *filename) {
     FILE *file = fopen(filename, "w+");
@@ -1096,17 +1087,17 @@ int gen_verify_28(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 43) {
             int w = write_header(file, PAGE_VALID, 0);
-            int ret = write_data_checksum(243, 1014, 0, file);
+            int ret = write_data_checksum(243, GEN_PAGE_RECORD_LENGTH, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 0 || page == 1 || page == 99) {
             int w = write_header(file, PAGE_RECEIVING, page);
-            w += fill_empty(510, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - 2, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1115,8 +1106,8 @@ int gen_verify_28(const char *filename) {
 
 
 /*
- * 100 (1018) -> 32 (1022) -> 1 (29) + aligned(0)
- * length = 2069 -> aligned +1
+ * 100 (PAGE_CHUNKS - 4) -> 32 (PAGE_CHUNKS - 2) -> 1 (17) chunks of data
+ * the last byte of data is padding
  * correct checksum
  */
 int gen_verify_29(const char *filename) {
@@ -1125,31 +1116,31 @@ int gen_verify_29(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 100) {
             int w = write_header(file, PAGE_VALID, 0);
-            int ret = write_id_length(123, 2069, file);
+            int ret = write_id_length(123, GEN_THREE_PAGE_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            ret = write_raw(508, 0, file);
+            ret = write_raw(PAGE_CHUNKS - 4, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 32) {
             int w = write_header(file, PAGE_VALID, 1);
-            int ret = write_raw(510, 508, file);
+            int ret = write_raw(PAGE_CHUNKS - 2, PAGE_CHUNKS - 4, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 1) {
             int w = write_header(file, PAGE_VALID, 2);
-            int ret = write_raw(17, 1018, file);
+            int ret = write_raw(17, 2 * PAGE_CHUNKS - 6, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            int checksum = calc_checksum(123, 2069);
-            w += write_hw(checksum, file);
-            w += fill_empty(492, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            flash_chunk_t checksum = calc_checksum(123, GEN_THREE_PAGE_LENGTH);
+            w += write_chunk(checksum, file);
+            w += fill_empty(PAGE_CHUNKS - 20, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1158,8 +1149,8 @@ int gen_verify_29(const char *filename) {
 
 
 /*
- * 100 (1018) -> 32 (1022) -> 1 (29) + aligned(0)
- * length = 2069 -> aligned +1
+ * 100 (PAGE_CHUNKS - 4) -> 32 (PAGE_CHUNKS - 2) -> 1 (17) chunks of data
+ * the last byte of data is padding
  * wrong checksum
  */
 int gen_verify_30(const char *filename) {
@@ -1168,30 +1159,30 @@ int gen_verify_30(const char *filename) {
     for (; page < FLASH_PAGE_COUNT; page++) {
         if (page == 100) {
             int w = write_header(file, PAGE_VALID, 0);
-            int ret = write_id_length(123, 2069, file);
+            int ret = write_id_length(123, GEN_THREE_PAGE_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            ret = write_raw(508, 0, file);
+            ret = write_raw(PAGE_CHUNKS - 4, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 32) {
             int w = write_header(file, PAGE_VALID, 1);
-            int ret = write_raw(510, 508, file);
+            int ret = write_raw(PAGE_CHUNKS - 2, PAGE_CHUNKS - 4, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 1) {
             int w = write_header(file, PAGE_VALID, 2);
-            int ret = write_raw(17, 1018, file);
+            int ret = write_raw(17, 2 * PAGE_CHUNKS - 6, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += write_hw(555, file);
-            w += fill_empty(492, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += write_chunk(555, file);
+            w += fill_empty(PAGE_CHUNKS - 20, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1223,35 +1214,35 @@ int gen_verify_31(const char *filename) {
             ret = write_data(12, 2, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            w += fill_empty(492, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            w += fill_empty(PAGE_CHUNKS - w, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 12) {
             int w = write_header(file, PAGE_VALID, 1);
-            int ret = write_data(12777, 1014, file);
+            int ret = write_data(12777, GEN_PAGE_RECORD_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 14) {
             int w = write_header(file, PAGE_VALID, 2);
-            int ret = write_id_length(888, 1019, file);
+            int ret = write_id_length(888, TWO_PAGE_LENGTH, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            ret = write_raw(508, 0, file);
+            ret = write_raw(PAGE_CHUNKS - 4, 0, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else if (page == 1) {
             int w = write_header(file, PAGE_VALID, 3);
-            int ret = write_raw(2, 508, file);
+            int ret = write_raw(2, PAGE_CHUNKS - 4, file);
             VEEPROM_THROW(ret > 0, -ret);
             w += ret;
-            uint16_t checksum = calc_checksum(888, 1019);
-            w += fwrite(&checksum, sizeof(uint16_t), 1, file);
-            w += fill_empty(507, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            flash_chunk_t checksum = calc_checksum(888, TWO_PAGE_LENGTH);
+            w += fwrite(&checksum, sizeof(flash_chunk_t), 1, file);
+            w += fill_empty(PAGE_CHUNKS - 5, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         } else {
-            int w = fill_empty(512, file);
-            VEEPROM_THROW(w == 512, ERROR_WRT);
+            int w = fill_empty(PAGE_CHUNKS, file);
+            VEEPROM_THROW(w == PAGE_CHUNKS, ERROR_WRT);
         }
     }
     fclose(file);
@@ -1266,15 +1257,15 @@ int gen_clear(const char *filename) {
     int total_written = 0;
     int page = 0;
     for (; page < FLASH_PAGE_COUNT; page++) {
-        int hw_written = 0;
-        VEEPROM_THROW((ret=fill_empty(512, file)) > 0,
+        int chunks_written = 0;
+        VEEPROM_THROW((ret=fill_empty(PAGE_CHUNKS, file)) > 0,
                 ERROR_WRT);
-        hw_written += ret;
-        VEEPROM_THROW(hw_written == 512, ERROR_WRT);
-        total_written += hw_written;
+        chunks_written += ret;
+        VEEPROM_THROW(chunks_written == PAGE_CHUNKS, ERROR_WRT);
+        total_written += chunks_written;
     }
 
-    VEEPROM_THROW(total_written == 512*128, ERROR_WRT);
+    VEEPROM_THROW(total_written == PAGE_CHUNKS * FLASH_PAGE_COUNT, ERROR_WRT);
     VEEPROM_THROW((ret=fclose(file)) == 0, ERROR_SYSTEM);
     return OK;
 }
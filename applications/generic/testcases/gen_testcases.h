@@ -19,6 +19,19 @@
 #ifndef VEEPROM_GEN_TESTCASES
 #define VEEPROM_GEN_TESTCASES
 
+#include "eeprom.h"
+
+
+/* Length of a record which takes a whole page (one-chunk checksum) */
+#define GEN_PAGE_RECORD_LENGTH \
+    ((FLASH_PAGE_CHUNKS - VEEPROM_HEADER_CHUNKS - 3) * sizeof(flash_chunk_t))
+
+/* Odd length of the record of gen_verify_29 and 30, it spans three pages */
+#define GEN_THREE_PAGE_LENGTH \
+    ((2 * FLASH_PAGE_CHUNKS + 11) * sizeof(flash_chunk_t) - 1)
+
+flash_chunk_t calc_checksum(flash_chunk_t id, int length);
+
 
 int gen_verify_2(const char*);
 int gen_verify_3(const char*);
@@ -0,0 +1,344 @@
+/*
+ *  validate.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Offline validation of flash dumps: validate [-j threads] image...
+ * Every image is mounted by the recovery code of the store and all its
+ * records are read with the checksum check. The image is mapped private,
+ * so repairs of the mount stay in memory and the dump isn't changed.
+ * Images are split between the threads, a thread which is done with its
+ * part steals half of the images left to another one. One line per image
+ * is printed in the order of arguments, the exit status is 1 if any of
+ * the images is broken. The tool has to be built with the options of
+ * the firmware which wrote the dumps (VALIDATE_FLAGS of the Makefile).
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "eeprom.h"
+#include "errnum.h"
+#include "errmsg.h"
+
+#define VALIDATE_THREADS_MAX 64
+
+
+typedef struct {
+    int ret;            /* OK or the error of the mount */
+    int page_count;
+    int busy_pages;
+    int records;
+    int corrupt;        /* records failing the checksum */
+    int torn;
+    int recovered;
+    flash_chunk_t virtnum;  /* of the newest page */
+} image_result_t;
+
+
+typedef struct {
+    veeprom_mutex_t mutex;
+    int head;           /* images [head, tail) of the queue */
+    int tail;
+    veeprom_thread_t thread;
+    veeprom_t veeprom;
+    uint8_t *buf;
+    uint8_t *image;     /* mapping being validated, guarded by mutex */
+    off_t image_size;
+} worker_t;
+
+
+static char **m_images;
+static image_result_t *m_results;
+static worker_t m_workers[VALIDATE_THREADS_MAX];
+static int m_worker_count;
+#ifdef FLASH_SECTORS
+static const flash_sector_t m_sectors[] = FLASH_SECTORS;
+#endif
+
+
+/* Pages of an image of size bytes, 0 if it doesn't end on a page */
+static int image_pages(off_t size) {
+#ifdef FLASH_SECTORS
+    for (int i = 0; i < sizeof(m_sectors) / sizeof(*m_sectors); i++)
+        if (m_sectors[i].offset + m_sectors[i].size == size)
+            return i + 1;
+    return 0;
+#else
+    if (size == 0 || size % FLASH_PAGE_SIZE != 0 || size / FLASH_PAGE_SIZE > FLASH_PAGE_COUNT)
+        return 0;
+    return size / FLASH_PAGE_SIZE;
+#endif
+}
+
+
+/* Size of the page at p, sectors are located from the start of its image */
+static int page_size(const flash_chunk_t *p) {
+#ifdef FLASH_SECTORS
+    int size = 0;
+    for (int i = 0; i < m_worker_count; i++) {
+        worker_t *w = &m_workers[i];
+        VEEPROM_MUTEX_LOCK(&w->mutex);
+        uint8_t *start = w->image;
+        if (start != NULL && (uint8_t*)p >= start && (uint8_t*)p < start + w->image_size)
+            for (int j = 0; j < sizeof(m_sectors) / sizeof(*m_sectors); j++)
+                if (start + m_sectors[j].offset == (uint8_t*)p)
+                    size = m_sectors[j].size;
+        VEEPROM_MUTEX_UNLOCK(&w->mutex);
+    }
+    return size;
+#else
+    return FLASH_PAGE_SIZE;
+#endif
+}
+
+
+/* The backend programs the private mapping only */
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    *p = data;
+    return OK;
+}
+
+
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+    return OK;
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    int size = page_size(p);
+    if (size == 0)
+        return ERROR_PARAM;
+    memset(p, 0xFF, size);
+    return OK;
+}
+
+
+#ifdef VEEPROM_ASYNC_ERASE
+/* Memory erases at once, the background erase is over when it starts */
+int flash_erase_start(flash_chunk_t *p) {
+    return flash_erase_page(p);
+}
+
+
+int flash_erase_poll(flash_chunk_t *p, int *done) {
+    *done = 1;
+    return OK;
+}
+#endif
+
+
+static void check_records(worker_t *w, image_result_t *r) {
+    veeprom_t *v = &w->veeprom;
+    veeprom_status_t *status = veeprom_get_status(v);
+    flash_chunk_t **ids = veeprom_get_ids(v);
+    flash_chunk_t **pages = veeprom_get_pages(v);
+    int pages_size = veeprom_get_pages_size(v);
+
+    r->records = veeprom_get_ids_size(v);
+    r->busy_pages = status->busy_pages;
+    r->torn = status->torn_records;
+    r->recovered = status->recovered_pages;
+    r->virtnum = pages_size > 0 ? *pages[pages_size - 1] : 0;
+
+    for (int i = 0; i < r->records; i++) {
+        veeprom_read_t read_buf = { .id = *ids[i], .buf = w->buf,
+            .buf_size = FLASH_PAGE_SIZE * FLASH_PAGE_COUNT };
+        if (veeprom_read(v, &read_buf) != OK)
+            r->corrupt++;
+    }
+}
+
+
+static void validate_image(worker_t *w, const char *path, image_result_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->ret = ERROR_SYSTEM;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || image_pages(st.st_size) == 0) {
+        r->ret = ERROR_PARAM;
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return;
+
+    VEEPROM_MUTEX_LOCK(&w->mutex);
+    w->image = p;
+    w->image_size = st.st_size;
+    VEEPROM_MUTEX_UNLOCK(&w->mutex);
+
+    r->page_count = image_pages(st.st_size);
+    r->ret = veeprom_init(&w->veeprom, p, r->page_count);
+    if (r->ret == OK)
+        check_records(w, r);
+    veeprom_deinit(&w->veeprom);
+
+    VEEPROM_MUTEX_LOCK(&w->mutex);
+    w->image = NULL;
+    VEEPROM_MUTEX_UNLOCK(&w->mutex);
+    munmap(p, st.st_size);
+}
+
+
+/* Takes the next image of the own queue, -1 if it's empty */
+static int take_image(worker_t *w) {
+    int image = -1;
+    VEEPROM_MUTEX_LOCK(&w->mutex);
+    if (w->head < w->tail)
+        image = w->head++;
+    VEEPROM_MUTEX_UNLOCK(&w->mutex);
+    return image;
+}
+
+
+/* Moves the upper half of the longest other queue to the own one */
+static int steal_images(worker_t *w) {
+    for (;;) {
+        worker_t *victim = NULL;
+        int longest = 0;
+        for (int i = 0; i < m_worker_count; i++) {
+            worker_t *other = &m_workers[i];
+            if (other == w)
+                continue;
+            VEEPROM_MUTEX_LOCK(&other->mutex);
+            int left = other->tail - other->head;
+            VEEPROM_MUTEX_UNLOCK(&other->mutex);
+            if (left > longest) {
+                longest = left;
+                victim = other;
+            }
+        }
+        if (victim == NULL)
+            return 0;
+
+        VEEPROM_MUTEX_LOCK(&victim->mutex);
+        int left = victim->tail - victim->head;
+        int mid = victim->tail - (left + 1) / 2;
+        int tail = victim->tail;
+        if (left > 0)
+            victim->tail = mid;
+        VEEPROM_MUTEX_UNLOCK(&victim->mutex);
+        if (left <= 0)
+            continue;
+
+        VEEPROM_MUTEX_LOCK(&w->mutex);
+        w->head = mid;
+        w->tail = tail;
+        VEEPROM_MUTEX_UNLOCK(&w->mutex);
+        return 1;
+    }
+}
+
+
+static VEEPROM_THREAD(validate_worker, arg) {
+    worker_t *w = arg;
+    for (;;) {
+        int image = take_image(w);
+        if (image == -1) {
+            if (!steal_images(w))
+                break;
+            continue;
+        }
+        validate_image(w, m_images[image], &m_results[image]);
+    }
+    VEEPROM_THREAD_EXIT();
+}
+
+
+static int print_result(const char *path, const image_result_t *r) {
+    if (r->ret != OK) {
+        printf("%s: error %s\n", path, emsg(r->ret));
+        return 1;
+    }
+    /* every allocation of a page takes a new virtnum */
+    printf("%s: %s records=%d corrupt=%d torn=%d recovered=%d pages=%d/%d"
+            " wear=%.1f erases/page virtnum=%.1f%%\n", path,
+            r->corrupt ? "corrupt" : "ok", r->records, r->corrupt, r->torn, r->recovered,
+            r->busy_pages, r->page_count, (double)r->virtnum / r->page_count,
+            100.0 * r->virtnum / VEEPROM_MAX_VIRTNUM);
+    return r->corrupt != 0;
+}
+
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j')
+            return 2;
+        threads = atoi(optarg);
+    }
+    int count = argc - optind;
+    if (count == 0) {
+        fprintf(stderr, "usage: %s [-j threads] image...\n", argv[0]);
+        return 2;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > VALIDATE_THREADS_MAX)
+        threads = VALIDATE_THREADS_MAX;
+    if (threads > count)
+        threads = count;
+
+    m_images = argv + optind;
+    m_results = calloc(count, sizeof(*m_results));
+    if (m_results == NULL)
+        return 2;
+
+    m_worker_count = threads;
+    for (int i = 0; i < threads; i++) {
+        worker_t *w = &m_workers[i];
+        VEEPROM_MUTEX_INIT(&w->mutex);
+        w->head = (long)count * i / threads;
+        w->tail = (long)count * (i + 1) / threads;
+        w->buf = malloc(FLASH_PAGE_SIZE * FLASH_PAGE_COUNT);
+        if (w->buf == NULL)
+            return 2;
+    }
+    int started = 0;
+    for (; started < threads; started++)
+        if (VEEPROM_THREAD_START(&m_workers[started].thread, validate_worker,
+                    &m_workers[started]) != 0)
+            break;
+    /* images of threads which didn't start are stolen */
+    if (started == 0)
+        validate_worker(&m_workers[0]);
+    for (int i = 0; i < started; i++)
+        VEEPROM_THREAD_JOIN(&m_workers[i].thread);
+
+    int broken = 0;
+    for (int i = 0; i < count; i++)
+        broken |= print_result(m_images[i], &m_results[i]);
+
+    for (int i = 0; i < threads; i++) {
+        VEEPROM_MUTEX_DESTROY(&m_workers[i].mutex);
+        free(m_workers[i].buf);
+    }
+    free(m_results);
+    return broken;
+}
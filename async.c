@@ -0,0 +1,206 @@
+/*
+ *  async.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "async.h"
+#include "wrappers.h"
+#include "errdef.h"
+
+
+/*
+ * Data of queued records are kept in the arena in the order of ops.
+ * A record which doesn't fit to the end of the arena starts at 0 if
+ * the oldest data leave room there (data_wrapped), the end is skipped.
+ * Returns the offset or -1 if there is no room.
+ */
+VEEPROM_MODULE(int)
+veeprom_async_alloc(veeprom_async_t *q, int length) {
+    if (q->op_count == 0) {
+        q->data_head = q->data_tail = 0;
+        q->data_wrapped = 0;
+    }
+
+    int offset = q->data_tail;
+    if (q->data_wrapped) {
+        if (offset + length > q->data_head)
+            return -1;
+    } else if (offset + length > VEEPROM_ASYNC_BYTES) {
+        if (length > q->data_head)
+            return -1;
+        offset = 0;
+        q->data_wrapped = 1;
+    }
+    if (q->op_count == 0)
+        q->data_head = offset;
+    q->data_tail = offset + length;
+    return offset;
+}
+
+
+/* Removes the oldest op, its data are freed */
+VEEPROM_MODULE(void)
+veeprom_async_pop(veeprom_async_t *q) {
+    q->op_head = (q->op_head + 1) % VEEPROM_ASYNC_OPS;
+    q->op_count--;
+    if (q->op_count == 0) {
+        q->data_head = q->data_tail = 0;
+        q->data_wrapped = 0;
+        return;
+    }
+
+    int next = q->ops[q->op_head].offset;
+    if (next < q->data_head)
+        q->data_wrapped = 0;
+    q->data_head = next;
+}
+
+
+VEEPROM_MODULE(void)
+veeprom_async_account(veeprom_async_t *q, uint32_t queue_us, uint32_t exec_us) {
+    veeprom_async_stats_t *stats = &q->stats;
+    stats->ops++;
+    stats->queue_us += queue_us;
+    if (queue_us > stats->queue_max_us)
+        stats->queue_max_us = queue_us;
+    stats->exec_us += exec_us;
+    if (exec_us > stats->exec_max_us)
+        stats->exec_max_us = exec_us;
+}
+
+
+/*
+ * The op stays in the queue while it's written, so its data aren't
+ * overwritten and veeprom_async_flush() waits for it.
+ */
+static VEEPROM_THREAD(veeprom_async_worker, arg) {
+    veeprom_async_t *q = arg;
+
+    VEEPROM_MUTEX_LOCK(&q->mutex);
+    for (;;) {
+        while (q->op_count == 0 && !q->stop)
+            VEEPROM_COND_WAIT(&q->not_empty, &q->mutex);
+        if (q->op_count == 0)
+            break;
+
+        veeprom_async_op_t op = q->ops[q->op_head];
+        VEEPROM_MUTEX_UNLOCK(&q->mutex);
+
+        uint32_t start_us = VEEPROM_TIME_US();
+        int status = veeprom_write(q->v, op.id, q->data + op.offset, op.length);
+        uint32_t end_us = VEEPROM_TIME_US();
+        if (op.done)
+            op.done(op.context, op.id, status);
+
+        VEEPROM_MUTEX_LOCK(&q->mutex);
+        veeprom_async_pop(q);
+        veeprom_async_account(q, start_us - op.queued_us, end_us - start_us);
+        VEEPROM_COND_BROADCAST(&q->not_full);
+    }
+    VEEPROM_MUTEX_UNLOCK(&q->mutex);
+
+    VEEPROM_THREAD_EXIT();
+}
+
+
+int veeprom_async_start(veeprom_async_t *q, veeprom_t *v) {
+    THROW (q != NULL && v != NULL, ERROR_NULLPTR);
+
+    memset(q, 0, sizeof(*q));
+    q->v = v;
+    VEEPROM_MUTEX_INIT(&q->mutex);
+    VEEPROM_COND_INIT(&q->not_empty);
+    VEEPROM_COND_INIT(&q->not_full);
+
+    if (VEEPROM_THREAD_START(&q->worker, veeprom_async_worker, q) != 0) {
+        VEEPROM_COND_DESTROY(&q->not_full);
+        VEEPROM_COND_DESTROY(&q->not_empty);
+        VEEPROM_MUTEX_DESTROY(&q->mutex);
+        THROW (0, VEEPROM_ERROR_NOMEM);
+    }
+    return OK;
+}
+
+
+int veeprom_async_stop(veeprom_async_t *q) {
+    VEEPROM_MUTEX_LOCK(&q->mutex);
+    q->stop = 1;
+    VEEPROM_COND_BROADCAST(&q->not_empty);
+    /* callers waiting for room give up */
+    VEEPROM_COND_BROADCAST(&q->not_full);
+    VEEPROM_MUTEX_UNLOCK(&q->mutex);
+
+    VEEPROM_THREAD_JOIN(&q->worker);
+
+    VEEPROM_COND_DESTROY(&q->not_full);
+    VEEPROM_COND_DESTROY(&q->not_empty);
+    VEEPROM_MUTEX_DESTROY(&q->mutex);
+    return OK;
+}
+
+
+int veeprom_write_async(veeprom_async_t *q, flash_chunk_t id, uint8_t *data, flash_chunk_t length,
+        veeprom_async_done_t done, void *context) {
+    THROW (data != NULL, ERROR_NULLPTR);
+    THROW (id > 0 && id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+    THROW (length >= 0 && length < VEEPROM_LENGTH_LIMIT, VEEPROM_ERROR_LENGTH);
+    THROW (length <= VEEPROM_ASYNC_BYTES, VEEPROM_ERROR_LENGTH);
+
+    VEEPROM_MUTEX_LOCK(&q->mutex);
+    int offset = -1;
+    int waited = 0;
+    while (!q->stop && (q->op_count == VEEPROM_ASYNC_OPS ||
+            (offset = veeprom_async_alloc(q, length)) < 0)) {
+        waited = 1;
+        VEEPROM_COND_WAIT(&q->not_full, &q->mutex);
+    }
+    THROW (!q->stop, VEEPROM_ERROR_INIT, VEEPROM_MUTEX_UNLOCK(&q->mutex));
+
+    memcpy(q->data + offset, data, length);
+    veeprom_async_op_t *op = &q->ops[(q->op_head + q->op_count) % VEEPROM_ASYNC_OPS];
+    op->id = id;
+    op->length = length;
+    op->offset = offset;
+    op->done = done;
+    op->context = context;
+    op->queued_us = VEEPROM_TIME_US();
+    q->op_count++;
+    q->stats.full_waits += waited;
+
+    VEEPROM_COND_BROADCAST(&q->not_empty);
+    VEEPROM_MUTEX_UNLOCK(&q->mutex);
+    return OK;
+}
+
+
+int veeprom_async_flush(veeprom_async_t *q) {
+    VEEPROM_MUTEX_LOCK(&q->mutex);
+    while (q->op_count > 0)
+        VEEPROM_COND_WAIT(&q->not_full, &q->mutex);
+    VEEPROM_MUTEX_UNLOCK(&q->mutex);
+    return OK;
+}
+
+
+int veeprom_async_get_stats(veeprom_async_t *q, veeprom_async_stats_t *stats) {
+    THROW (stats != NULL, ERROR_NULLPTR);
+
+    VEEPROM_MUTEX_LOCK(&q->mutex);
+    *stats = q->stats;
+    VEEPROM_MUTEX_UNLOCK(&q->mutex);
+    return OK;
+}
@@ -0,0 +1,108 @@
+/*
+ *  async.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VEEPROM_ASYNC_H
+#define VEEPROM_ASYNC_H
+
+#include "eeprom.h"
+
+#ifndef VEEPROM_THREADS
+#error "asynchronous writes require VEEPROM_THREADS"
+#endif
+
+
+/*
+ * Asynchronous writes. veeprom_write_async() copies the data into the
+ * queue and returns, a worker thread writes queued records to the store
+ * in order by veeprom_write() and reports the result to the callback.
+ * The queue holds up to VEEPROM_ASYNC_OPS records and VEEPROM_ASYNC_BYTES
+ * bytes of their data, a caller waits while it's full. lock.h of
+ * the application provides the mutex, condition and thread macros.
+ */
+#ifndef VEEPROM_ASYNC_OPS
+#define VEEPROM_ASYNC_OPS 16
+#endif
+#ifndef VEEPROM_ASYNC_BYTES
+#define VEEPROM_ASYNC_BYTES 4096
+#endif
+
+
+/* Called by the worker with the status of veeprom_write() */
+typedef void (*veeprom_async_done_t)(void *context, flash_chunk_t id, int status);
+
+
+typedef struct {
+    flash_chunk_t id;
+    flash_chunk_t length;
+    int offset;             /* of the data in the arena */
+    veeprom_async_done_t done;
+    void *context;
+    uint32_t queued_us;
+} veeprom_async_op_t;
+
+
+/*
+ * Latencies in microseconds: queue - from veeprom_write_async() to
+ * the start of the write, exec - the write itself.
+ */
+typedef struct {
+    uint32_t ops;
+    uint32_t full_waits;    /* calls which waited for room in the queue */
+    uint64_t queue_us;
+    uint32_t queue_max_us;
+    uint64_t exec_us;
+    uint32_t exec_max_us;
+} veeprom_async_stats_t;
+
+
+typedef struct {
+    veeprom_t *v;
+    veeprom_async_op_t ops[VEEPROM_ASYNC_OPS];
+    int op_head;
+    int op_count;
+    uint8_t data[VEEPROM_ASYNC_BYTES];
+    int data_head;          /* data of the oldest op */
+    int data_tail;          /* end of data of the newest op */
+    int data_wrapped;       /* newer data start again at 0 */
+    int stop;
+    veeprom_async_stats_t stats;
+    veeprom_mutex_t mutex;
+    veeprom_cond_t not_empty;
+    veeprom_cond_t not_full;   /* also signals a completed op */
+    veeprom_thread_t worker;
+} veeprom_async_t;
+
+
+/* Starts the worker writing to the store v, the store must be mounted */
+int veeprom_async_start(veeprom_async_t *q, veeprom_t *v);
+
+/* Writes the queued records and stops the worker */
+int veeprom_async_stop(veeprom_async_t *q);
+
+/*
+ * Queues the record and returns, waits if the queue is full. done may
+ * be NULL. Length of a record is limited by VEEPROM_ASYNC_BYTES.
+ */
+int veeprom_write_async(veeprom_async_t *q, flash_chunk_t id, uint8_t *data, flash_chunk_t length,
+        veeprom_async_done_t done, void *context);
+
+/* Waits until all queued records are written */
+int veeprom_async_flush(veeprom_async_t *q);
+
+int veeprom_async_get_stats(veeprom_async_t *q, veeprom_async_stats_t *stats);
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ *  crc32.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "crc32.h"
+
+#ifndef VEEPROM_CRC32_HW
+
+#if VEEPROM_CRC32_SLICES != 1 && VEEPROM_CRC32_SLICES != 8
+#error "VEEPROM_CRC32_SLICES must be 1 or 8"
+#endif
+
+#include "crc32_table.h"
+
+
+static inline uint32_t
+crc32_bytes(uint32_t c, const uint8_t *p, int length) {
+    while (length-- > 0)
+        c = (c >> 8) ^ m_crc32_table[0][(c ^ *p++) & 0xFF];
+    return c;
+}
+
+
+#if VEEPROM_CRC32_SLICES == 8
+/* Processes 8 bytes, little-endian byte order is assumed */
+static inline uint32_t
+crc32_slice8(uint32_t c, const uint8_t *p) {
+    uint32_t one;
+    uint32_t two;
+    memcpy(&one, p, sizeof(one));
+    memcpy(&two, p + 4, sizeof(two));
+    one ^= c;
+    return m_crc32_table[7][one & 0xFF] ^
+        m_crc32_table[6][(one >> 8) & 0xFF] ^
+        m_crc32_table[5][(one >> 16) & 0xFF] ^
+        m_crc32_table[4][one >> 24] ^
+        m_crc32_table[3][two & 0xFF] ^
+        m_crc32_table[2][(two >> 8) & 0xFF] ^
+        m_crc32_table[1][(two >> 16) & 0xFF] ^
+        m_crc32_table[0][two >> 24];
+}
+#endif
+
+
+uint32_t veeprom_crc32(uint32_t crc, const void *buf, int length) {
+    const uint8_t *p = buf;
+    uint32_t c = ~crc;
+
+#if VEEPROM_CRC32_SLICES == 8
+    for (; length >= 8; length -= 8, p += 8)
+        c = crc32_slice8(c, p);
+#endif
+
+    return ~crc32_bytes(c, p, length);
+}
+
+
+uint32_t veeprom_crc32_copy(uint32_t crc, void *dst, const void *src, int length) {
+    const uint8_t *p = src;
+    uint8_t *d = dst;
+    uint32_t c = ~crc;
+
+#if VEEPROM_CRC32_SLICES == 8
+    for (; length >= 8; length -= 8, p += 8, d += 8) {
+        memcpy(d, p, 8);
+        c = crc32_slice8(c, p);
+    }
+#endif
+
+    memcpy(d, p, length);
+    return ~crc32_bytes(c, p, length);
+}
+
+#else
+
+uint32_t veeprom_crc32(uint32_t crc, const void *buf, int length) {
+    return veeprom_crc32_hw(crc, buf, length);
+}
+
+
+uint32_t veeprom_crc32_copy(uint32_t crc, void *dst, const void *src, int length) {
+    memcpy(dst, src, length);
+    return veeprom_crc32_hw(crc, src, length);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *  crc32.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VEEPROM_CRC32_H
+#define VEEPROM_CRC32_H
+
+#include "types.h"
+
+/*
+ * CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320).
+ * The functions take and return the final CRC value, so the computation
+ * starts with 0 and may be continued with the next piece of data.
+ *
+ * Software implementation uses slicing-by-VEEPROM_CRC32_SLICES tables
+ * (8 by default, 8 KB of constant data; 1 gives the classic 1 KB table).
+ * If VEEPROM_CRC32_HW is defined the platform provides
+ * veeprom_crc32_hw() which is used instead, e.g. with a CRC unit
+ * configured for reflected input and output.
+ */
+#ifndef VEEPROM_CRC32_SLICES
+#define VEEPROM_CRC32_SLICES 8
+#endif
+
+uint32_t veeprom_crc32(uint32_t crc, const void *buf, int length);
+
+/* Copies length bytes from src to dst and updates CRC in the same pass */
+uint32_t veeprom_crc32_copy(uint32_t crc, void *dst, const void *src, int length);
+
+#ifdef VEEPROM_CRC32_HW
+uint32_t veeprom_crc32_hw(uint32_t crc, const void *buf, int length);
+#endif
+
+#endif
@@ -23,60 +23,231 @@
 #include "wrappers.h"
 #include "errdef.h"
 #include "mem.h"
+#include "crc32.h"
+#include "lzss.h"
 
-static int VEEPROM_PAGE_COUNT;
 
-static veeprom_status_t m_status;
-static veeprom_cursor_t m_cursor;
+#ifdef FLASH_SECTORS
+static const flash_sector_t m_sectors[] = FLASH_SECTORS;
+#endif
 
-static flash_chunk_t* m_veeprom_ids[FLASH_PAGE_COUNT];
-static int            m_veeprom_ids_size;
 
-static flash_chunk_t* m_veeprom_pages[FLASH_PAGE_COUNT];
-static int            m_veeprom_pages_size;
+#define VEEPROM_SET_PHYSNUM(v, p, physnum) \
+    physnum = veeprom_physnum(v, p);
 
+#define VEEPROM_IS_INIT(v) ((v)->status.flags & VEEPROM_INITIALIZED)
 
+#define VEEPROM_PAGE_STATUS(page) (*page)
 
-#define VEEPROM_SET_PHYSNUM(p, physnum) \
-    unsigned long delta = (unsigned long)((void*)(p)) - (unsigned long)((void*)(m_status.flash_start));\
-    physnum = delta / FLASH_PAGE_SIZE;
+/* Sequence of reads which hold the update mutex, real ones are even */
+#define VEEPROM_SEQ_LOCKED 1
+
+#define VEEPROM_HAS_EXTENSION(v, physnum) \
+    ((v)->status.extension_map[(physnum) >> 5] & (1UL << ((physnum) & 31)))
+#define VEEPROM_SET_EXTENSION(v, physnum) \
+    ((v)->status.extension_map[(physnum) >> 5] |= (1UL << ((physnum) & 31)))
+#define VEEPROM_CLEAR_EXTENSION(v, physnum) \
+    ((v)->status.extension_map[(physnum) >> 5] &= ~(1UL << ((physnum) & 31)))
+
+#ifdef VEEPROM_BLANK_CHECK
+#define VEEPROM_IS_DIRTY(v, physnum) \
+    ((v)->status.dirty_map[(physnum) >> 5] & (1UL << ((physnum) & 31)))
+#define VEEPROM_SET_DIRTY(v, physnum) \
+    ((v)->status.dirty_map[(physnum) >> 5] |= (1UL << ((physnum) & 31)))
+#define VEEPROM_CLEAR_DIRTY(v, physnum) \
+    ((v)->status.dirty_map[(physnum) >> 5] &= ~(1UL << ((physnum) & 31)))
+#endif
 
-#define VEEPROM_IS_INIT() (m_status.flags & VEEPROM_INITIALIZED)
+#ifdef VEEPROM_ASYNC_ERASE
+#define VEEPROM_ERASE_PENDING(v, physnum) \
+    ((v)->status.erase_map[(physnum) >> 5] & (1UL << ((physnum) & 31)))
+#define VEEPROM_SET_ERASE_PENDING(v, physnum) \
+    ((v)->status.erase_map[(physnum) >> 5] |= (1UL << ((physnum) & 31)))
+#define VEEPROM_CLEAR_ERASE_PENDING(v, physnum) \
+    ((v)->status.erase_map[(physnum) >> 5] &= ~(1UL << ((physnum) & 31)))
+#else
+#define VEEPROM_ERASE_PENDING(v, physnum) 0
+#endif
 
-#define VEEPROM_PAGE_STATUS(page) (*page)
+#ifdef VEEPROM_DUAL_REGION
+#define VEEPROM_REGION(v, physnum) ((physnum) >= (v)->page_count / 2)
+#define VEEPROM_IN_ACTIVE_REGION(v, physnum) \
+    (VEEPROM_REGION(v, physnum) == (v)->status.active_region)
+#else
+#define VEEPROM_IN_ACTIVE_REGION(v, physnum) 1
+#endif
+
+
+/*
+ * Geometry of the VEEPROM area. All pages are FLASH_PAGE_SIZE unless
+ * flash_cfg.h describes sectors of different sizes by FLASH_SECTORS,
+ * then every sector is a page.
+ */
+VEEPROM_MODULE(flash_chunk_t*)
+veeprom_page_addr(veeprom_t *v, int physnum) {
+#ifdef FLASH_SECTORS
+    return v->status.flash_start + m_sectors[physnum].offset / sizeof(flash_chunk_t);
+#else
+    return v->status.flash_start + physnum * FLASH_PAGE_CHUNKS;
+#endif
+}
+
+
+/* Number of the page which contains p */
+VEEPROM_MODULE(int)
+veeprom_physnum(veeprom_t *v, flash_chunk_t *p) {
+    unsigned long delta = (unsigned long)((void*)p) - (unsigned long)((void*)v->status.flash_start);
+#ifdef FLASH_SECTORS
+    int l = 0;
+    int r = v->page_count - 1;
+    while (l < r) {
+        int m = (l + r + 1) >> 1;
+        if (m_sectors[m].offset <= delta)
+            l = m;
+        else
+            r = m - 1;
+    }
+    return l;
+#else
+    return delta / FLASH_PAGE_SIZE;
+#endif
+}
+
+
+/* End of the page which contains p */
+VEEPROM_MODULE(flash_chunk_t*)
+veeprom_page_end(veeprom_t *v, flash_chunk_t *p) {
+#ifdef FLASH_SECTORS
+    int physnum = veeprom_physnum(v, p);
+    return veeprom_page_addr(v, physnum) + m_sectors[physnum].size / sizeof(flash_chunk_t);
+#else
+    return veeprom_page_addr(v, veeprom_physnum(v, p)) + FLASH_PAGE_CHUNKS;
+#endif
+}
+
+
+/* Chunks of the page after header and id */
+VEEPROM_MODULE(int)
+veeprom_page_space(int physnum) {
+#ifdef FLASH_SECTORS
+    return m_sectors[physnum].size / sizeof(flash_chunk_t) - VEEPROM_HEADER_CHUNKS - 1;
+#else
+    return FLASH_PAGE_CHUNKS - VEEPROM_HEADER_CHUNKS - 1;
+#endif
+}
+
+
+/* Bytes of the page with header and id */
+VEEPROM_MODULE(int)
+veeprom_page_bytes(int physnum) {
+    return (veeprom_page_space(physnum) + VEEPROM_HEADER_CHUNKS + 1) * sizeof(flash_chunk_t);
+}
 
 
 VEEPROM_MODULE(int)
-veeprom_init_cursor() {
-    memset(&m_cursor, 0, sizeof(veeprom_cursor_t));
-    m_cursor.index = -1;
+veeprom_init_cursor(veeprom_t *v) {
+    memset(&v->cursor, 0, sizeof(veeprom_cursor_t));
+    v->cursor.index = -1;
     return OK;
 }
 
 
 VEEPROM_MODULE(int)
-veeprom_iterate_cursor() {
-    if ((m_cursor.p_current - m_cursor.p_start_page + 1) >= FLASH_PAGE_CHUNKS) {
-        THROW (m_cursor.index + 1 < m_veeprom_pages_size, ERROR_DCNSTY);
-        THROW (m_veeprom_pages[m_cursor.index + 1] != NULL, ERROR_NULLPTR);
-        m_cursor.index++;
-        flash_chunk_t id = *(m_cursor.p_start_page + VEEPROM_HEADER_CHUNKS);
-        m_cursor.p_start_page = m_veeprom_pages[m_cursor.index] - 1;
-        THROW (VEEPROM_PAGE_STATUS(m_cursor.p_start_page) == PAGE_RECEIVING, ERROR_DCNSTY);
-        m_cursor.p_current = m_veeprom_pages[m_cursor.index];
-        THROW (*m_cursor.p_current > 0 && *m_cursor.p_current < VEEPROM_MAX_VIRTNUM, VEEPROM_ERROR_VIRTNUM);
-        m_cursor.p_current++;
-        RIFER (flash_write_chunk(id, m_cursor.p_current));
+veeprom_iterate_cursor(veeprom_t *v) {
+    if (v->cursor.p_current + 1 >= veeprom_page_end(v, v->cursor.p_start_page)) {
+        THROW (v->cursor.index + 1 < v->pages_size, ERROR_DCNSTY);
+        THROW (v->pages[v->cursor.index + 1] != NULL, ERROR_NULLPTR);
+        v->cursor.index++;
+        flash_chunk_t id = *(v->cursor.p_start_page + VEEPROM_HEADER_CHUNKS);
+        v->cursor.p_start_page = v->pages[v->cursor.index] - 1;
+        THROW (VEEPROM_PAGE_STATUS(v->cursor.p_start_page) == PAGE_RECEIVING, ERROR_DCNSTY);
+        v->cursor.p_current = v->pages[v->cursor.index];
+        THROW (*v->cursor.p_current > 0 && *v->cursor.p_current < VEEPROM_MAX_VIRTNUM, VEEPROM_ERROR_VIRTNUM);
+        v->cursor.p_current++;
+        RIFER (flash_write_chunk(id, v->cursor.p_current));
+    }
+    v->cursor.p_current++;
+    return OK;
+}
+
+
+VEEPROM_MODULE(veeprom_checksum_t)
+veeprom_checksum(veeprom_checksum_t checksum, flash_chunk_t *p, int chunks) {
+#ifdef VEEPROM_CHECKSUM_CRC32
+    return veeprom_crc32(checksum, p, chunks * sizeof(flash_chunk_t));
+#else
+    while (chunks-- > 0)
+        checksum ^= *p++;
+    return checksum;
+#endif
+}
+
+
+/*
+ * Copies chunks to buf and updates the checksum in the same pass,
+ * so the data are read from flash only once.
+ */
+VEEPROM_MODULE(veeprom_checksum_t)
+veeprom_checksum_copy(veeprom_checksum_t checksum, uint8_t *buf,
+        flash_chunk_t *p, int chunks) {
+#ifdef VEEPROM_CHECKSUM_CRC32
+    return veeprom_crc32_copy(checksum, buf, p, chunks * sizeof(flash_chunk_t));
+#else
+    for (; chunks > 0; chunks--, p++, buf += sizeof(flash_chunk_t)) {
+        flash_chunk_t c = *p;
+        memcpy(buf, &c, sizeof(flash_chunk_t));
+        checksum ^= c;
+    }
+    return checksum;
+#endif
+}
+
+
+/*
+ * Reads the stored checksum which ends right before end. CRC-32 takes
+ * several chunks on 16-bit flash and may start on the previous page of
+ * the record, index is the page of end.
+ */
+VEEPROM_MODULE(int)
+veeprom_stored_checksum(veeprom_t *v, flash_chunk_t *end, int index, veeprom_checksum_t *checksum,
+        flash_chunk_t **first) {
+    flash_chunk_t chunks[VEEPROM_CHECKSUM_CHUNKS];
+    flash_chunk_t *p = end;
+    flash_chunk_t *page = v->pages[index] - 1;
+
+    for (int i = VEEPROM_CHECKSUM_CHUNKS - 1; i >= 0; i--) {
+        /* the data area of a page starts after header and id */
+        if (--p < page + VEEPROM_HEADER_CHUNKS + 1) {
+            THROW (index > 0 && v->pages[index - 1] != NULL, ERROR_DCNSTY);
+            page = v->pages[--index] - 1;
+            p = veeprom_page_end(v, page) - 1;
+        }
+        chunks[i] = *p;
     }
-    m_cursor.p_current++;
+
+    if (first != NULL)
+        *first = p;
+    *checksum = 0;
+    memcpy(checksum, chunks, sizeof(veeprom_checksum_t));
     return OK;
 }
 
 
+/*
+ * Pages taken by data of the record which starts on the page index.
+ * With sectors of different sizes the pages are walked, if they end
+ * before the data the result exceeds the number of pages left.
+ */
 VEEPROM_MODULE(int)
-veeprom_calculate_pages(flash_chunk_t length) {
-    /* 2 additional chunks: length and checksum */
-    int chunks = TO_CHUNKS(length) + 2;
+veeprom_record_pages(veeprom_t *v, flash_chunk_t length, int index) {
+    /* additional chunks: length and checksum */
+    int chunks = TO_CHUNKS(length) + 1 + VEEPROM_CHECKSUM_CHUNKS;
+#ifdef FLASH_SECTORS
+    int pages = 0;
+    for (; chunks > 0 && index + pages < v->pages_size; pages++)
+        chunks -= veeprom_page_space(veeprom_physnum(v, v->pages[index + pages]));
+    return chunks > 0 ? pages + 1 : pages;
+#else
     /* Each page has header, page with data has id.
      * id is not part of a page header. The first page has additional length field,
      * the last page has checksum. */
@@ -85,6 +256,7 @@ veeprom_calculate_pages(flash_chunk_t length) {
     if (chunks % free_page_space)
         pages++;
     return pages;
+#endif
 }
 
 
@@ -151,11 +323,11 @@ veeprom_sortedinsert(flash_chunk_t* a[FLASH_PAGE_COUNT], int *size, flash_chunk_
         if (*a[i] <= *p)
             break;
 
-    (*size)++;
-    for (int j = *size - 1; j > i+1; j--)
+    for (int j = *size; j > i+1; j--)
         a[j] = a[j-1];
 
     a[i+1] = p;
+    (*size)++;
     return OK;
 }
 
@@ -165,8 +337,8 @@ veeprom_vectorpush(flash_chunk_t* a[FLASH_PAGE_COUNT], int *size, flash_chunk_t
     THROW (size != NULL && a != NULL && p != NULL, ERROR_NULLPTR);
     THROW (*size < FLASH_PAGE_COUNT, VEEPROM_ERROR_NOMEM);
 
+    a[*size] = p;
     (*size)++;
-    a[*size-1] = p;
     return OK;
 }
 
@@ -180,7 +352,7 @@ veeprom_sortedrm(flash_chunk_t* a[FLASH_PAGE_COUNT], int *size, int index) {
     for (int i = index+1; i < *size; i++) {
         a[i-1] = a[i];
     }
-    a[*size - 1] = 0;
+    /* the last slot keeps its pointer, readers may still follow it */
     (*size)--;
     return OK;
 }
@@ -203,422 +375,1489 @@ veeprom_binsearch(flash_chunk_t* a[FLASH_PAGE_COUNT], int size, flash_chunk_t va
 }
 
 
+/*
+ * Readers don't take the lock of the store (seqlock): they run and then
+ * check that the sequence hasn't changed, otherwise they start again.
+ * Writers make the sequence odd while they change the index in RAM,
+ * programming and erasing of flash go outside of these updates. Pages
+ * are unlinked from the index before they're erased, so a reader which
+ * could see the old pages fails the check. Updates may nest.
+ */
+VEEPROM_MODULE(void)
+veeprom_update_begin(veeprom_t *v) {
+#ifdef VEEPROM_THREADS
+    if (v->update_depth++ == 0) {
+        VEEPROM_MUTEX_LOCK(&v->update_mutex);
+        __atomic_store_n(&v->seq, v->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+#endif
+}
+
+
+VEEPROM_MODULE(void)
+veeprom_update_end(veeprom_t *v) {
+#ifdef VEEPROM_THREADS
+    if (--v->update_depth == 0) {
+        __atomic_store_n(&v->seq, v->seq + 1, __ATOMIC_RELEASE);
+        VEEPROM_MUTEX_UNLOCK(&v->update_mutex);
+    }
+#endif
+}
+
+
+/*
+ * Returns the sequence the read is checked against, an update in progress
+ * is waited for. A reader which was retried VEEPROM_READ_RETRIES times
+ * takes the update mutex instead: on a single core a reader which
+ * preempted the writer would wait for it forever. The mutex keeps the
+ * index unchanged during the read and is held by the writer only for
+ * the update, so the reader doesn't wait for programming or erases.
+ */
+VEEPROM_MODULE(uint32_t)
+veeprom_read_begin(veeprom_t *v, int attempt) {
+#ifdef VEEPROM_THREADS
+    for (; attempt < VEEPROM_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&v->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1))
+            return seq;
+        VEEPROM_YIELD();
+    }
+    VEEPROM_MUTEX_LOCK(&v->update_mutex);
+    return VEEPROM_SEQ_LOCKED;
+#else
+    return 0;
+#endif
+}
+
+
+/* Returns non zero if the read has to be repeated */
+VEEPROM_MODULE(int)
+veeprom_read_retry(veeprom_t *v, uint32_t seq) {
+#ifdef VEEPROM_THREADS
+    if (seq == VEEPROM_SEQ_LOCKED) {
+        VEEPROM_MUTEX_UNLOCK(&v->update_mutex);
+        return 0;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&v->seq, __ATOMIC_RELAXED) != seq;
+#else
+    return 0;
+#endif
+}
+
+
 VEEPROM_MODULE(int)
-veeprom_set_next_alloc() {
-    for (int16_t i = m_status.next_alloc + 1; i < VEEPROM_PAGE_COUNT; i++)
+veeprom_set_next_alloc(veeprom_t *v) {
+    for (int16_t i = v->status.next_alloc + 1; i < v->page_count; i++)
     {
-        if (m_status.busy_map[i] != -1) {
-            m_status.next_alloc = i;
+        if (v->status.busy_map[i] != -1) {
+            v->status.next_alloc = i;
             return OK;
         }
     }
 
-    for (int i = 0; i < m_status.next_alloc; i++) {
-        if (m_status.busy_map[i] != -1) {
-            m_status.next_alloc = i;
+    for (int i = 0; i < v->status.next_alloc; i++) {
+        if (v->status.busy_map[i] != -1) {
+            v->status.next_alloc = i;
             return OK;
         }
     }
 
-    m_status.next_alloc = -1;
+    v->status.next_alloc = -1;
     return OK;
 }
 
 
-VEEPROM_MODULE(int)
-veeprom_rm_dereg_page(flash_chunk_t *page, int index) {
-    THROW (page != NULL, ERROR_NULLPTR);
-    flash_chunk_t physnum = 0;
-    VEEPROM_SET_PHYSNUM(page, physnum);
-    VEEPROM_LOGDEBUG("rm page physnum=%" VEEPROM_FLASH_CHUNK_FMT
-            " virtnum=%" VEEPROM_FLASH_CHUNK_FMT, physnum, *(page+1));
-
-    m_status.busy_map[physnum] = physnum;
-    if (m_status.next_alloc == -1)
-        m_status.next_alloc = physnum;
-    m_status.busy_pages--;
-
-    RIFER (veeprom_sortedrm(m_veeprom_pages, &m_veeprom_pages_size, index));
-    return flash_erase_page(page);
+#ifdef VEEPROM_ASYNC_ERASE
+/* The released page is erased, its bytes are free */
+VEEPROM_MODULE(void)
+veeprom_erase_cleared(veeprom_t *v, int physnum) {
+    veeprom_update_begin(v);
+    VEEPROM_CLEAR_ERASE_PENDING(v, physnum);
+    v->status.reclaimable_bytes -= veeprom_page_bytes(physnum);
+    v->status.free_bytes += veeprom_page_bytes(physnum);
+    veeprom_update_end(v);
 }
 
 
+/* Ends the erase in progress with the status of flash_erase_poll() */
 VEEPROM_MODULE(int)
-veeprom_rm_data_dereg_pages(flash_chunk_t *p) {
-    THROW (p != NULL, ERROR_NULLPTR);
-
-    THROW (*(p+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
-
-    int pages = veeprom_calculate_pages(*(p+1));
+veeprom_erase_done(veeprom_t *v, int ret) {
+    if (ret == OK)
+        veeprom_erase_cleared(v, v->status.erasing);
+    v->status.erasing = -1;
+    return ret;
+}
 
-    int index = veeprom_binsearch(m_veeprom_pages, m_veeprom_pages_size, *(p-1));
 
-    while (pages-- > 0) {
-        THROW (index != -1, ERROR_DCNSTY);
-        THROW (m_veeprom_pages[index] != NULL, ERROR_NULLPTR);
+/* Waits for the erase in progress */
+VEEPROM_MODULE(int)
+veeprom_erase_settle(veeprom_t *v) {
+    while (v->status.erasing != -1) {
+        int done = 0;
+        int ret = flash_erase_poll(veeprom_page_addr(v, v->status.erasing), &done);
+        if (ret != OK || done)
+            return veeprom_erase_done(v, ret);
+        VEEPROM_YIELD();
+    }
+    return OK;
+}
 
-        flash_chunk_t *page = m_veeprom_pages[index] - 1;
-        THROW (VEEPROM_PAGE_STATUS(page) == PAGE_VALID, ERROR_DCNSTY);
 
-        RIFER (veeprom_rm_dereg_page(page, index));
+/* Checks the erase in progress and starts the next one, doesn't wait */
+VEEPROM_MODULE(int)
+veeprom_erase_progress(veeprom_t *v) {
+    if (v->status.erasing != -1) {
+        int done = 0;
+        int ret = flash_erase_poll(veeprom_page_addr(v, v->status.erasing), &done);
+        if (ret == OK && !done)
+            return OK;
+        RIFER (veeprom_erase_done(v, ret));
     }
 
+    for (int physnum = 0; physnum < v->page_count; physnum++) {
+#ifdef VEEPROM_DUAL_REGION
+        /* the active region is read, it's not erased */
+        if (VEEPROM_IN_ACTIVE_REGION(v, physnum))
+            continue;
+#endif
+        if (VEEPROM_ERASE_PENDING(v, physnum)) {
+            RIFER (flash_erase_start(veeprom_page_addr(v, physnum)));
+            v->status.erasing = physnum;
+            return OK;
+        }
+    }
     return OK;
 }
 
 
+/* A page which is allocated before its erase is over is waited for */
 VEEPROM_MODULE(int)
-veeprom_reg_id_rm_prev(flash_chunk_t *addr) {
-    int index = veeprom_binsearch(m_veeprom_ids, m_veeprom_ids_size, *addr);
-    if (index != -1) {
-        flash_chunk_t *addr_prev = m_veeprom_ids[index];
-        THROW (addr_prev != NULL, ERROR_NULLPTR);
-        THROW (*addr_prev == *(flash_chunk_t*)addr, ERROR_DCNSTY);
-        RIFER (veeprom_rm_data_dereg_pages(addr_prev));
-        m_veeprom_ids[index] = addr;
-    } else {
-        return veeprom_sortedinsert(m_veeprom_ids, &m_veeprom_ids_size, addr);
+veeprom_erase_pending(veeprom_t *v, int physnum) {
+    if (!VEEPROM_ERASE_PENDING(v, physnum))
+        return OK;
+
+    RIFER (veeprom_erase_settle(v));
+    if (VEEPROM_ERASE_PENDING(v, physnum)) {
+        RIFER (flash_erase_page(veeprom_page_addr(v, physnum)));
+        veeprom_erase_cleared(v, physnum);
     }
     return OK;
 }
+#endif
 
 
+/* Marks the page free and erases it, the page index is not changed */
 VEEPROM_MODULE(int)
-veeprom_resolve_collision() {
-    if (m_veeprom_ids_size < 2)
-        return OK;
+veeprom_release_page(veeprom_t *v, flash_chunk_t *page) {
+    THROW (page != NULL, ERROR_NULLPTR);
+    flash_chunk_t physnum = 0;
+    VEEPROM_SET_PHYSNUM(v, page, physnum);
+    VEEPROM_LOGDEBUG("rm page physnum=%" VEEPROM_FLASH_CHUNK_FMT
+            " virtnum=%" VEEPROM_FLASH_CHUNK_FMT, physnum, *(page+1));
 
-    THROW (m_veeprom_ids[0] != NULL, ERROR_NULLPTR);
-    flash_chunk_t prev_id = *m_veeprom_ids[0];
+    veeprom_update_begin(v);
+    v->status.busy_map[physnum] = physnum;
+    VEEPROM_CLEAR_EXTENSION(v, physnum);
+    if (v->status.next_alloc == -1)
+        v->status.next_alloc = physnum;
+    v->status.busy_pages--;
+#ifdef VEEPROM_ASYNC_ERASE
+    VEEPROM_SET_ERASE_PENDING(v, physnum);
+    v->status.reclaimable_bytes += veeprom_page_bytes(physnum);
+#else
+    v->status.free_bytes += veeprom_page_bytes(physnum);
+#endif
+    v->status.free_chunks += veeprom_page_space(physnum);
+    veeprom_update_end(v);
 
-    for (int i=1; i < m_veeprom_ids_size; i++) {
-        THROW (m_veeprom_ids[i] != NULL, ERROR_NULLPTR);
+#ifdef VEEPROM_ASYNC_ERASE
+    /* virtnum 0 marks a page which is erased at mount */
+    RIFER (flash_write_chunk(0, page + 1));
+    return veeprom_erase_progress(v);
+#else
+    return flash_erase_page(page);
+#endif
+}
 
-        flash_chunk_t id = *m_veeprom_ids[i];
 
-        if (prev_id != id) {
-            prev_id = id;
-            continue;
-        }
+VEEPROM_MODULE(int)
+veeprom_rm_dereg_page(veeprom_t *v, flash_chunk_t *page, int index) {
+    veeprom_update_begin(v);
+    int ret = veeprom_sortedrm(v->pages, &v->pages_size, index);
+    veeprom_update_end(v);
+    RIFER (ret);
+    return veeprom_release_page(v, page);
+}
 
-        /* The case of collision */
-        flash_chunk_t prev_virtnum = *(m_veeprom_ids[i-1] - 1);
-        flash_chunk_t virtnum      = *(m_veeprom_ids[i] - 1);
 
-        THROW (prev_virtnum != virtnum, ERROR_DCNSTY);
+/*
+ * Pages occupied by the record or the extension page starting with p_id.
+ */
+VEEPROM_MODULE(int)
+veeprom_unit_pages(veeprom_t *v, flash_chunk_t *p_id, int index) {
+    if (*(p_id+1) == VEEPROM_LENGTH_EXTENSION)
+        return 1;
+    return veeprom_record_pages(v, VEEPROM_STORED_LENGTH(*(p_id+1)), index);
+}
 
-        /* The most latest data with the same id have larger virtnum */
-        if (virtnum > prev_virtnum) {
-            /* There is only one case of collision: when data were added,
-             * corresponding pages were set to VALID, old data were not removed */
-            RIFER (veeprom_rm_data_dereg_pages(m_veeprom_ids[i-1]));
-            RIFER (veeprom_sortedrm(m_veeprom_ids, &m_veeprom_ids_size, i-1));
-            return OK;
-        } else {
-            RIFER (veeprom_rm_data_dereg_pages(m_veeprom_ids[i]));
-            RIFER (veeprom_sortedrm(m_veeprom_ids, &m_veeprom_ids_size, i-1));
-            return OK;
+
+/*
+ * Walks records and extension pages from index (which must be the first
+ * page of one of them) and returns index of the next extension page of
+ * the record id. Returns -1 if there is none or a newer record with
+ * the same id follows. Callers check VEEPROM_HAS_EXTENSION() first,
+ * records without extensions don't pay for the walk.
+ */
+VEEPROM_MODULE(int)
+veeprom_next_extension(veeprom_t *v, flash_chunk_t id, int index) {
+    while (index < v->pages_size) {
+        flash_chunk_t *p = v->pages[index] + 1;
+        if (*p == id) {
+            if (*(p+1) == VEEPROM_LENGTH_EXTENSION)
+                return index;
+            return -1;
         }
+        index += veeprom_unit_pages(v, p, index);
+    }
+    return -1;
+}
+
+
+/*
+ * Skips fragments starting at p, returns the first free chunk of the page.
+ * If a torn fragment runs out of the page the page has no free space.
+ */
+VEEPROM_MODULE(flash_chunk_t*)
+veeprom_fragments_end(flash_chunk_t *p, flash_chunk_t *page_end) {
+    while (p < page_end && *p != VEEPROM_ERASED_CHUNK) {
+        if (VEEPROM_FRAGMENT_LENGTH(*p) > (page_end - p) * sizeof(flash_chunk_t))
+            return page_end;
+        p += VEEPROM_FRAGMENT_CHUNKS(VEEPROM_FRAGMENT_LENGTH(*p));
+        if (p > page_end)
+            return page_end;
     }
+    return p;
+}
 
+
+/*
+ * Finds the last page of the record data (without extensions) and
+ * the chunk next to the record checksum on it.
+ */
+VEEPROM_MODULE(int)
+veeprom_record_end(veeprom_t *v, flash_chunk_t *p_id, int *index, flash_chunk_t **end) {
+    THROW (p_id != NULL && index != NULL && end != NULL, ERROR_NULLPTR);
+    THROW (*(p_id+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
+
+    int i = veeprom_binsearch(v->pages, v->pages_size, *(p_id-1));
+    THROW (i != -1, ERROR_DCNSTY);
+
+    flash_chunk_t length = VEEPROM_STORED_LENGTH(*(p_id+1));
+    int pages = veeprom_record_pages(v, length, i);
+    THROW (i + pages <= v->pages_size, ERROR_DCNSTY);
+
+    /* Preceding pages of the record are filled up after id */
+    int used = TO_CHUNKS(length) + 1 + VEEPROM_CHECKSUM_CHUNKS;
+    for (; pages > 1; pages--, i++)
+        used -= veeprom_page_space(veeprom_physnum(v, v->pages[i]));
+    THROW (v->pages[i] != NULL, ERROR_DCNSTY);
+
+    *index = i;
+    /* pages keep pointers to virtnums, id follows them */
+    *end = v->pages[i] + 2 + used;
     return OK;
 }
 
 
+/*
+ * Computes the checksum of the record which starts with p_id from its
+ * chunks on flash and reads the stored one. Returns VEEPROM_ERROR_VERIFY
+ * if a page of the record holds another id.
+ */
 VEEPROM_MODULE(int)
-veeprom_init_data() {
+veeprom_record_checksum(veeprom_t *v, flash_chunk_t *p_id, veeprom_checksum_t *checksum,
+        veeprom_checksum_t *stored) {
+    int last = -1;
+    flash_chunk_t *end = NULL;
+    RIFER (veeprom_record_end(v, p_id, &last, &end));
+
+    int chunks = TO_CHUNKS(VEEPROM_STORED_LENGTH(*(p_id+1)));
+    int index = veeprom_binsearch(v->pages, v->pages_size, *(p_id-1));
+    THROW (index != -1, ERROR_DCNSTY);
+    *checksum = veeprom_checksum(0, p_id, 2);
+
+    flash_chunk_t *p = p_id + 2;
+    int page_chunks = veeprom_page_space(veeprom_physnum(v, p_id)) - 1;
+    while (chunks > 0) {
+        int n = chunks < page_chunks ? chunks : page_chunks;
+        *checksum = veeprom_checksum(*checksum, p, n);
+        chunks -= n;
+        if (chunks == 0)
+            break;
 
-    if (m_status.busy_pages < 0) {
-        THROW (0, ERROR_DCNSTY);
-    } else if (m_status.busy_pages == 0) {
-        return OK;
+        THROW (++index <= last, ERROR_DCNSTY);
+        p = v->pages[index] + 1;
+        if (*p != *p_id)
+            return VEEPROM_ERROR_VERIFY;
+        p++;
+        page_chunks = veeprom_page_space(veeprom_physnum(v, p));
     }
 
-    int index = -1;
-    flash_chunk_t *p_id = NULL;
-    int pages = 0;
-
-    for (int i=0; i < m_veeprom_pages_size; i++) {
-        THROW (m_veeprom_pages[i] != NULL, ERROR_NULLPTR);
-        flash_chunk_t *p = m_veeprom_pages[i] + 1;
+    return veeprom_stored_checksum(v, end, last, stored, NULL);
+}
 
-        THROW (*p > 0 && *p < VEEPROM_MAX_ID, VEEPROM_ERROR_ID);
 
-        if (p_id == NULL) {
-            /*TODO: simplify code with conception of m_cursor/iterator */
-            index = i;
-            p_id = p;
-            THROW (*(p+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
-            pages = veeprom_calculate_pages(*(p+1));
-            pages--;
-            continue;
+/*
+ * Finds the page where the next fragment of the record has to be written
+ * and the first free chunk on it.
+ */
+VEEPROM_MODULE(int)
+veeprom_record_tail(veeprom_t *v, flash_chunk_t *p_id, flash_chunk_t **page, flash_chunk_t **p_free) {
+    int index = -1;
+    flash_chunk_t *p = NULL;
+    RIFER (veeprom_record_end(v, p_id, &index, &p));
+    *page = v->pages[index] - 1;
+
+    if (VEEPROM_HAS_EXTENSION(v, veeprom_physnum(v, p_id)))
+        while ((index = veeprom_next_extension(v, *p_id, index + 1)) != -1) {
+            *page = v->pages[index] - 1;
+            p = *page + VEEPROM_HEADER_CHUNKS + 2;
         }
 
-        if (*p_id != *p) {
-            if (pages > 0) {
-                /* The case when data were erasing but not completely */
+    *p_free = veeprom_fragments_end(p, veeprom_page_end(v, *page));
+    return OK;
+}
 
-                VEEPROM_LOGDEBUG("previos erasing failed id=%" VEEPROM_FLASH_CHUNK_FMT, *p_id);
 
-                THROW (index > 0 && index < FLASH_PAGE_COUNT &&
-                        index < i && m_veeprom_pages[index] != NULL, ERROR_DCNSTY);
+/*
+ * Verifies and copies fragments located between p and page_end.
+ * Data of a chain are counted in read_buf->length only when the chain
+ * is completed, *pending holds the data of the current chain or -1 if
+ * the chain is broken. *fragments is increased by the number of
+ * fragments occupying the page.
+ */
+VEEPROM_MODULE(int)
+veeprom_read_fragments(flash_chunk_t *p, flash_chunk_t *page_end,
+        veeprom_read_t *read_buf, int *pending, int *fragments) {
+    while (p < page_end && *p != VEEPROM_ERASED_CHUNK) {
+        flash_chunk_t flags = *p & ~VEEPROM_FRAGMENT_LENGTH(*p);
+        /* a reader may race with a writer: the length is checked against
+         * the page before it's used as int */
+        if (VEEPROM_FRAGMENT_LENGTH(*p) > (page_end - p) * sizeof(flash_chunk_t)) {
+            *pending = -1;
+            break;
+        }
+        int length = VEEPROM_FRAGMENT_LENGTH(*p);
+        int chunks = TO_CHUNKS(length);
 
-                for (int j = 0; j < i - index + 1; j++) {
-                    RIFER (veeprom_rm_dereg_page(p_id - VEEPROM_HEADER_CHUNKS, index));
-                    THROW (m_veeprom_pages[index] != NULL, ERROR_DCNSTY);
-                    p_id = m_veeprom_pages[index] + 1;
-                }
+        if (p + VEEPROM_FRAGMENT_CHUNKS(length) > page_end) {
+            *pending = -1;
+            break;
+        }
+        (*fragments)++;
 
-                THROW (*(p+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
-                pages = veeprom_calculate_pages(*(p+1));
-                pages--;
-                p_id = p;
-                index = i;
-                continue;
+        if (flags & VEEPROM_FRAGMENT_FIRST)
+            *pending = 0;
 
-            } else if (pages == 0) {
-                RIFER (veeprom_vectorpush(m_veeprom_ids, &m_veeprom_ids_size, p_id));
+        int offset = read_buf->length + *pending;
+        int copied = read_buf->buf != NULL && *pending != -1 &&
+            offset + chunks * (int)sizeof(flash_chunk_t) <= read_buf->buf_size;
 
-                THROW (*(p+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
-                pages = veeprom_calculate_pages(*(p+1));
-                pages--;
-                p_id = p;
-                index = i;
+        veeprom_checksum_t checksum = veeprom_checksum(0, p, 1);
+        if (copied)
+            checksum = veeprom_checksum_copy(checksum, read_buf->buf + offset, p + 1, chunks);
+        else
+            checksum = veeprom_checksum(checksum, p + 1, chunks);
 
-            } else {
-                /* pages cannot be negative */
-                THROW (0, ERROR_DCNSTY);
-            }
+        veeprom_checksum_t stored = 0;
+        memcpy(&stored, p + 1 + chunks, sizeof(veeprom_checksum_t));
 
+        if (checksum != stored || *pending == -1) {
+            VEEPROM_LOGDEBUG("broken fragment id=%" VEEPROM_FLASH_CHUNK_FMT, read_buf->id);
+            *pending = -1;
         } else {
-            THROW (pages > 0, ERROR_DCNSTY);
-            pages--;
-        }
-    }
-
-    THROW (pages >= 0, ERROR_DCNSTY);
-
-    if (p_id != NULL) {
-        THROW (index != -1, ERROR_DCNSTY);
+            if (!copied && read_buf->buf != NULL && offset + length <= read_buf->buf_size)
+                memcpy(read_buf->buf + offset, p + 1, length);
+            *pending += length;
 
-        if (pages > 0) {
-            /* Remove up to the last node. The case of incompleted writing.  */
-            for (int j = 0; j < m_veeprom_pages_size - index; j--) {
-                RIFER (veeprom_rm_dereg_page(p_id - VEEPROM_HEADER_CHUNKS, index));
-                THROW (m_veeprom_pages[index] != NULL, ERROR_NULLPTR);
-                p_id = m_veeprom_pages[index] + 1;
+            if (!(flags & VEEPROM_FRAGMENT_MORE)) {
+                read_buf->length += *pending;
+                *pending = 0;
             }
-
-        } else {
-            RIFER (veeprom_vectorpush(m_veeprom_ids, &m_veeprom_ids_size, p_id));
         }
-
-    } else {
-        THROW (pages == 0 && index == -1, ERROR_DCNSTY);
+        p += VEEPROM_FRAGMENT_CHUNKS(length);
     }
-
-    int ret = veeprom_heapsort(m_veeprom_ids, m_veeprom_ids_size);
-    THROW (ret == OK, ret);
-    return veeprom_resolve_collision();
+    return OK;
 }
 
 
+#ifdef VEEPROM_COMPRESSION
+/*
+ * Passes a span of a compressed record to the decoder. Stored data start
+ * with the original length, *offset is the position of the span in them,
+ * the padding of the last chunk is skipped.
+ */
 VEEPROM_MODULE(int)
-veeprom_order_pages() {
-    flash_chunk_t *p = m_status.flash_start;
-    flash_chunk_t *flash_end = p + FLASH_PAGE_SIZE * VEEPROM_PAGE_COUNT;
-    int ret = 0;
-    for (int physnum = 0; physnum < VEEPROM_PAGE_COUNT && p < flash_end; physnum++, p += FLASH_PAGE_CHUNKS) {
-        flash_chunk_t s = VEEPROM_PAGE_STATUS(p);
-        switch (s) {
-        case PAGE_VALID:
-            {
-                THROW (*(p+1) > 0 && *(p+1) < VEEPROM_MAX_VIRTNUM, VEEPROM_ERROR_VIRTNUM);
-                RIFER (veeprom_vectorpush(m_veeprom_pages, &m_veeprom_pages_size, p+1));
-                m_status.next_alloc = physnum;
-                m_status.busy_pages++;
-                m_status.busy_map[physnum] = VEEPROM_BUSY_PAGE_FLAG;
-            }
-            break;
-        case PAGE_RECEIVING:
-            THROW ((ret = flash_erase_page(p)) == OK, ret);
-            m_status.busy_map[physnum] = physnum;
-            m_status.next_alloc = physnum;
-            break;
-        case PAGE_ERASED:
-            m_status.busy_map[physnum] = physnum;
-            break;
-        default:
-            THROW (0, ERROR_UNKNOWNSTATUS);
-            break;
-        }
-    }
-    veeprom_set_next_alloc();
-    RIFER (veeprom_heapsort(m_veeprom_pages, m_veeprom_pages_size));
+veeprom_decode_span(veeprom_lzss_decoder_t *decoder, flash_chunk_t *p, int length,
+        int stored, int *offset) {
+    int start = *offset < (int)sizeof(flash_chunk_t) ? (int)sizeof(flash_chunk_t) : *offset;
+    int end = *offset + length < stored ? *offset + length : stored;
+    uint8_t *bytes = (uint8_t*)p + (start - *offset);
+
+    *offset += length;
+    if (end > start)
+        THROW (veeprom_lzss_decode(decoder, bytes, end - start) == 0, VEEPROM_ERROR_DATA);
     return OK;
 }
+#endif
 
 
+/*
+ * Payload and metadata bytes of the record including appended data.
+ */
 VEEPROM_MODULE(int)
-veeprom_check_order() {
-    if (m_veeprom_pages_size < 2) {
-        for (int i = 0; i < m_veeprom_pages_size; i++)
-            THROW (m_veeprom_pages[i] != NULL, ERROR_NULLPTR);
-        return OK;
-    }
+veeprom_record_usage(veeprom_t *v, flash_chunk_t *p_id, int *live, int *overhead) {
+    int last = -1;
+    flash_chunk_t *end = NULL;
+    RIFER (veeprom_record_end(v, p_id, &last, &end));
+
+    int pages = last - veeprom_binsearch(v->pages, v->pages_size, *(p_id-1)) + 1;
+    int pending = 0;
+    int fragments = 0;
+    veeprom_read_t read_buf = { .id = *p_id, .length = VEEPROM_STORED_LENGTH(*(p_id+1)) };
+
+    flash_chunk_t *page = v->pages[last] - 1;
+    RIFER (veeprom_read_fragments(end, veeprom_page_end(v, page), &read_buf,
+                &pending, &fragments));
+
+    int extensions = 0;
+    if (VEEPROM_HAS_EXTENSION(v, veeprom_physnum(v, p_id)))
+        while ((last = veeprom_next_extension(v, *p_id, last + 1)) != -1) {
+            page = v->pages[last] - 1;
+            RIFER (veeprom_read_fragments(page + VEEPROM_HEADER_CHUNKS + 2,
+                        veeprom_page_end(v, page), &read_buf, &pending, &fragments));
+            extensions++;
+        }
 
-    for (int i=1; i < m_veeprom_pages_size; i++) {
-        THROW (m_veeprom_pages[i-1] != NULL && m_veeprom_pages[i] != NULL, ERROR_NULLPTR);
-        THROW (*m_veeprom_pages[i-1] < *m_veeprom_pages[i], VEEPROM_ERROR_VIRTNUM);
-    }
+    *live = read_buf.length;
+    /* header and id on every page, length and checksum once,
+     * marker on extension pages, length and checksum of fragments */
+    *overhead = sizeof(flash_chunk_t) * ((pages + extensions) * (VEEPROM_HEADER_CHUNKS + 1)
+            + 1 + VEEPROM_CHECKSUM_CHUNKS + extensions
+            + (1 + VEEPROM_CHECKSUM_CHUNKS) * fragments);
     return OK;
 }
 
 
 VEEPROM_MODULE(int)
-veeprom_write_chunk(flash_chunk_t data) {
-    RIFER (veeprom_iterate_cursor());
-    RIFER (flash_write_chunk(data, m_cursor.p_current));
-    m_cursor.checksum ^= data;
-    return OK;
-}
+veeprom_rm_data_dereg_pages(veeprom_t *v, flash_chunk_t *p) {
+    THROW (p != NULL, ERROR_NULLPTR);
 
+    THROW (*(p+1) < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
 
-VEEPROM_MODULE(int)
-veeprom_set_receiving(int physnum) {
-    THROW (m_status.busy_pages + 1 <= VEEPROM_PAGE_COUNT, VEEPROM_ERROR_NOMEM);
+    flash_chunk_t id = *p;
+    /* the flag goes with the first page */
+    int extended = VEEPROM_HAS_EXTENSION(v, veeprom_physnum(v, p)) != 0;
 
-    flash_chunk_t *p = m_status.flash_start + physnum * FLASH_PAGE_CHUNKS;
-    int ret = flash_write_chunk(PAGE_RECEIVING, p);
-    THROW (ret == OK, ret);
+    int live = 0;
+    int overhead = 0;
+    RIFER (veeprom_record_usage(v, p, &live, &overhead));
+    v->status.live_bytes -= live;
+    v->status.overhead_bytes -= overhead;
 
-    flash_chunk_t virtnum = 1;
-    if (m_veeprom_pages_size > 0) {
-        flash_chunk_t *virtnum_last = m_veeprom_pages[m_veeprom_pages_size - 1];
-        THROW (virtnum_last != NULL, ERROR_NULLPTR);
-        THROW (*virtnum_last + 1 < VEEPROM_MAX_VIRTNUM, ERROR_FLASH_EXPIRED);
-        virtnum = *virtnum_last + 1;
-    }
+    int index = veeprom_binsearch(v->pages, v->pages_size, *(p-1));
+    THROW (index != -1, ERROR_DCNSTY);
+    int pages = veeprom_record_pages(v, VEEPROM_STORED_LENGTH(*(p+1)), index);
+    THROW (index + pages <= v->pages_size, ERROR_DCNSTY);
 
-    RIFER (flash_write_chunk(virtnum, p + 1));
+    /* Pages are erased from the tail: if it's interrupted the head with
+     * the length remains and the record is recognised as torn at mount. */
+    while (pages-- > 0) {
+        THROW (v->pages[index + pages] != NULL, ERROR_NULLPTR);
 
-    m_status.busy_map[physnum] = -1;
-    /* this insertion doesn't damage sorted order of virtnums */
-    RIFER (veeprom_vectorpush(m_veeprom_pages, &m_veeprom_pages_size, p+1));
+        flash_chunk_t *page = v->pages[index + pages] - 1;
+        THROW (VEEPROM_PAGE_STATUS(page) == PAGE_VALID, ERROR_DCNSTY);
+
+        RIFER (veeprom_rm_dereg_page(v, page, index + pages));
+    }
 
-    m_status.busy_pages++;
+    /* Extension pages go after the record was removed: if it's interrupted
+     * the orphaned extensions are removed during initialization. */
+    while (extended && (index = veeprom_next_extension(v, id, index)) != -1)
+        RIFER (veeprom_rm_dereg_page(v, v->pages[index] - 1, index));
 
     return OK;
 }
 
 
-
+#ifdef VEEPROM_KEYS
 VEEPROM_MODULE(int)
-veeprom_alloc_pages_set_cursor(int count) {
-    int free_pages = VEEPROM_PAGE_COUNT - m_status.busy_pages;
-    THROW (count <= free_pages, VEEPROM_ERROR_NOMEM);
+veeprom_key_insert(veeprom_t *v, flash_chunk_t *p_id);
+#endif
 
-    /*
+
+/* The record starting with p_id was changed, callers are in an update */
+VEEPROM_MODULE(void)
+veeprom_new_version(veeprom_t *v, flash_chunk_t *p_id) {
+    v->versions[veeprom_physnum(v, p_id)] = ++v->version;
+}
+
+
+/*
+ * The index points to the new record before the previous one is erased,
+ * readers never find a record which is being erased.
+ */
+VEEPROM_MODULE(int)
+veeprom_reg_id_rm_prev(veeprom_t *v, flash_chunk_t *addr) {
+    int index = veeprom_binsearch(v->ids, v->ids_size, *addr);
+    flash_chunk_t *addr_prev = NULL;
+    if (index != -1) {
+        addr_prev = v->ids[index];
+        THROW (addr_prev != NULL, ERROR_NULLPTR);
+        THROW (*addr_prev == *(flash_chunk_t*)addr, ERROR_DCNSTY);
+    }
+
+    int ret = OK;
+    veeprom_update_begin(v);
+    if (index != -1)
+        v->ids[index] = addr;
+    else
+        ret = veeprom_sortedinsert(v->ids, &v->ids_size, addr);
+    veeprom_new_version(v, addr);
+#ifdef VEEPROM_KEYS
+    /* the previous version still holds the key to find its slot */
+    if (ret == OK && *addr >= VEEPROM_KEY_ID_MIN)
+        ret = veeprom_key_insert(v, addr);
+#endif
+    veeprom_update_end(v);
+    RIFER (ret);
+
+    if (addr_prev != NULL)
+        RIFER (veeprom_rm_data_dereg_pages(v, addr_prev));
+    return OK;
+}
+
+
+/*
+ * Recovery is a single pass over pages in virtnum order. Pages of a record
+ * are validated from the head and erased from the tail, so the pages of
+ * a record present on flash always start with the head holding the length.
+ * A record is
+ *   complete   - all its pages follow the head with consecutive virtnums
+ *                and the checksum matches, a previous version with the same
+ *                id is superseded;
+ *   torn       - interrupted writing or removal, pages are missing.
+ * Firmware before this layout erased records from the head, so its pages
+ * left behind start with a continuation page whose data look like a length.
+ * The checksum tells them from heads: a page which doesn't start a complete
+ * record is dropped alone and the next one is tried as a head. A run of
+ * such pages is counted as one torn record.
+ * Extension pages are kept if they follow the latest version of the id.
+ * Superseded, torn and orphaned pages are removed in one batch.
+ */
+VEEPROM_MODULE(int)
+veeprom_init_data(veeprom_t *v) {
+
+    if (v->status.busy_pages < 0) {
+        THROW (0, ERROR_DCNSTY);
+    } else if (v->status.busy_pages == 0) {
+        return OK;
+    }
+
+    uint8_t drop[FLASH_PAGE_COUNT];
+    memset(drop, 0, sizeof(drop));
+
+    int i = 0;
+    while (i < v->pages_size) {
+        THROW (v->pages[i] != NULL, ERROR_NULLPTR);
+        flash_chunk_t *p = v->pages[i] + 1;
+
+        THROW (*p > 0 && *p < VEEPROM_MAX_ID, VEEPROM_ERROR_ID);
+
+        if (*(p+1) == VEEPROM_LENGTH_EXTENSION) {
+            i++;
+            continue;
+        }
+
+        int pages = veeprom_record_pages(v, VEEPROM_STORED_LENGTH(*(p+1)), i);
+        int n = 1;
+        while (n < pages && i + n < v->pages_size &&
+                *v->pages[i+n] == *v->pages[i] + n &&
+                *(v->pages[i+n] + 1) == *p)
+            n++;
+
+        veeprom_checksum_t checksum = 0;
+        veeprom_checksum_t stored = 1;
+        if (n == pages)
+            RIFER (veeprom_record_checksum(v, p, &checksum, &stored));
+
+        if (checksum != stored) {
+            /* the previous page was dropped from the same run */
+            if (i == 0 || !drop[i-1] || *v->pages[i-1] + 1 != *v->pages[i] ||
+                    *(v->pages[i-1] + 1) != *p) {
+                VEEPROM_LOGDEBUG("torn record id=%" VEEPROM_FLASH_CHUNK_FMT, *p);
+                v->status.torn_records++;
+            }
+            drop[i++] = 1;
+            continue;
+        }
+
+        int index = veeprom_binsearch(v->ids, v->ids_size, *p);
+        if (index != -1) {
+            /* The record was updated, old data were not removed */
+            flash_chunk_t *prev = v->ids[index];
+            int j = veeprom_binsearch(v->pages, v->pages_size, *(prev-1));
+            THROW (j != -1, ERROR_DCNSTY);
+            VEEPROM_LOGDEBUG("superseded record id=%" VEEPROM_FLASH_CHUNK_FMT, *p);
+            memset(drop + j, 1, veeprom_record_pages(v, VEEPROM_STORED_LENGTH(*(prev+1)), j));
+            v->ids[index] = p;
+        } else {
+            RIFER (veeprom_sortedinsert(v->ids, &v->ids_size, p));
+        }
+        i += pages;
+    }
+
+    for (i = 0; i < v->pages_size; i++) {
+        flash_chunk_t *p = v->pages[i] + 1;
+        if (*(p+1) != VEEPROM_LENGTH_EXTENSION)
+            continue;
+
+        int index = veeprom_binsearch(v->ids, v->ids_size, *p);
+        if (index == -1 || *(v->ids[index] - 1) > *v->pages[i]) {
+            VEEPROM_LOGDEBUG("orphaned extension id=%" VEEPROM_FLASH_CHUNK_FMT, *p);
+            drop[i] = 1;
+        } else {
+            VEEPROM_SET_EXTENSION(v, veeprom_physnum(v, v->ids[index]));
+        }
+    }
+
+    /* Backwards, so every record is erased from the tail */
+    for (i = v->pages_size - 1; i >= 0; i--)
+        if (drop[i]) {
+            RIFER (veeprom_release_page(v, v->pages[i] - 1));
+            v->status.recovered_pages++;
+        }
+
+    int size = 0;
+    for (i = 0; i < v->pages_size; i++)
+        if (!drop[i])
+            v->pages[size++] = v->pages[i];
+    v->pages_size = size;
+
+    return OK;
+}
+
+
+#ifdef VEEPROM_BLANK_CHECK
+/*
+ * Pages are aligned, so the page is compared by 64-bit words. Four words
+ * are combined per iteration which lets the compiler use SIMD.
+ */
+VEEPROM_MODULE(int)
+veeprom_page_blank(veeprom_t *v, flash_chunk_t *page) {
+    const uint64_t *p = (const uint64_t*)page;
+    const uint64_t *end = (const uint64_t*)veeprom_page_end(v, page);
+
+    for (; p < end; p += 4) {
+        if ((p[0] & p[1] & p[2] & p[3]) != ~(uint64_t)0)
+            return 0;
+    }
+    return 1;
+}
+#endif
+
+
+#ifdef FLASH_SECTORS
+/*
+ * Sectors have to be ascending and must not overlap. Blank check
+ * compares pages by 32 bytes, so sizes are multiple of it.
+ */
+VEEPROM_MODULE(int)
+veeprom_check_sectors(veeprom_t *v) {
+    THROW (v->page_count <= FLASH_PAGE_COUNT, ERROR_PARAM);
+    for (int i = 0; i < v->page_count; i++) {
+        THROW (m_sectors[i].size % 32 == 0 && m_sectors[i].size <= FLASH_PAGE_SIZE, ERROR_PARAM);
+        THROW (m_sectors[i].offset % sizeof(uint64_t) == 0, ERROR_PARAM);
+        THROW (i == 0 || m_sectors[i].offset >= m_sectors[i-1].offset + m_sectors[i-1].size,
+                ERROR_PARAM);
+    }
+    return OK;
+}
+#endif
+
+
+VEEPROM_MODULE(int)
+veeprom_order_pages(veeprom_t *v) {
+    int ret = 0;
+    for (int physnum = 0; physnum < v->page_count; physnum++) {
+        flash_chunk_t *p = veeprom_page_addr(v, physnum);
+        flash_chunk_t s = VEEPROM_PAGE_STATUS(p);
+        switch (s) {
+        case PAGE_VALID:
+            if (*(p+1) == 0) {
+                /* released page, the erase was not done */
+                THROW ((ret = flash_erase_page(p)) == OK, ret);
+                v->status.busy_map[physnum] = physnum;
+                v->status.next_alloc = physnum;
+                break;
+            }
+            {
+                THROW (*(p+1) > 0 && *(p+1) < VEEPROM_MAX_VIRTNUM, VEEPROM_ERROR_VIRTNUM);
+                RIFER (veeprom_vectorpush(v->pages, &v->pages_size, p+1));
+                v->status.next_alloc = physnum;
+                v->status.busy_pages++;
+                v->status.busy_map[physnum] = VEEPROM_BUSY_PAGE_FLAG;
+            }
+            break;
+        case PAGE_RECEIVING:
+            THROW ((ret = flash_erase_page(p)) == OK, ret);
+            v->status.recovered_pages++;
+            v->status.busy_map[physnum] = physnum;
+            v->status.next_alloc = physnum;
+            break;
+        case PAGE_ERASED:
+#ifdef VEEPROM_BLANK_CHECK
+            if (!veeprom_page_blank(v, p)) {
+                VEEPROM_LOGDEBUG("page physnum=%d is not blank", physnum);
+                VEEPROM_SET_DIRTY(v, physnum);
+            }
+#endif
+            v->status.busy_map[physnum] = physnum;
+            break;
+        default:
+            THROW (0, ERROR_UNKNOWNSTATUS);
+            break;
+        }
+    }
+    veeprom_set_next_alloc(v);
+    RIFER (veeprom_heapsort(v->pages, v->pages_size));
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_check_order(veeprom_t *v) {
+    if (v->pages_size < 2) {
+        for (int i = 0; i < v->pages_size; i++)
+            THROW (v->pages[i] != NULL, ERROR_NULLPTR);
+        return OK;
+    }
+
+    for (int i=1; i < v->pages_size; i++) {
+        THROW (v->pages[i-1] != NULL && v->pages[i] != NULL, ERROR_NULLPTR);
+        THROW (*v->pages[i-1] < *v->pages[i], VEEPROM_ERROR_VIRTNUM);
+    }
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_write_chunk(veeprom_t *v, flash_chunk_t data) {
+    RIFER (veeprom_iterate_cursor(v));
+    RIFER (flash_write_chunk(data, v->cursor.p_current));
+    v->cursor.checksum = veeprom_checksum(v->cursor.checksum, &data, 1);
+    return OK;
+}
+
+
+/* Writes the checksum accumulated by the cursor */
+VEEPROM_MODULE(int)
+veeprom_write_checksum(veeprom_t *v) {
+    flash_chunk_t chunks[VEEPROM_CHECKSUM_CHUNKS];
+    memset(chunks, 0, sizeof(chunks));
+    memcpy(chunks, &v->cursor.checksum, sizeof(veeprom_checksum_t));
+
+    for (int i = 0; i < VEEPROM_CHECKSUM_CHUNKS; i++) {
+        RIFER (veeprom_iterate_cursor(v));
+        RIFER (flash_write_chunk(chunks[i], v->cursor.p_current));
+    }
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_set_receiving(veeprom_t *v, int physnum) {
+    THROW (v->status.busy_pages + 1 <= v->page_count, VEEPROM_ERROR_NOMEM);
+
+    flash_chunk_t *p = veeprom_page_addr(v, physnum);
+#ifdef VEEPROM_ASYNC_ERASE
+    RIFER (veeprom_erase_pending(v, physnum));
+#endif
+#ifdef VEEPROM_BLANK_CHECK
+    if (VEEPROM_IS_DIRTY(v, physnum)) {
+        RIFER (flash_erase_page(p));
+        VEEPROM_CLEAR_DIRTY(v, physnum);
+    }
+#endif
+    int ret = flash_write_chunk(PAGE_RECEIVING, p);
+    THROW (ret == OK, ret);
+
+    flash_chunk_t virtnum = 1;
+    if (v->pages_size > 0) {
+        flash_chunk_t *virtnum_last = v->pages[v->pages_size - 1];
+        THROW (virtnum_last != NULL, ERROR_NULLPTR);
+        THROW (*virtnum_last + 1 < VEEPROM_MAX_VIRTNUM, ERROR_FLASH_EXPIRED);
+        virtnum = *virtnum_last + 1;
+    }
+
+    RIFER (flash_write_chunk(virtnum, p + 1));
+
+    veeprom_update_begin(v);
+    v->status.busy_map[physnum] = -1;
+    /* this insertion doesn't damage sorted order of virtnums */
+    ret = veeprom_vectorpush(v->pages, &v->pages_size, p+1);
+    v->status.busy_pages++;
+    v->status.free_bytes -= veeprom_page_bytes(physnum);
+    v->status.free_chunks -= veeprom_page_space(physnum);
+    veeprom_update_end(v);
+
+    return ret;
+}
+
+
+
+/*
+ * Picks a free page for the given chunks in the order of allocation
+ * from next_alloc, pages of one size are taken in turn. Among sectors
+ * of different sizes the smallest one which holds the chunks is preferred,
+ * otherwise the largest one: small records don't occupy large sectors
+ * and large records take fewer pages. Erased pages of the active region
+ * are taken first, then other erased pages, pages waiting for an erase
+ * only if there are no other ones.
+ */
+VEEPROM_MODULE(int)
+veeprom_pick_page(veeprom_t *v, int chunks, const uint8_t *taken) {
+    if (v->status.next_alloc == -1)
+        return -1;
+
+    int best = -1;
+    for (int pass = 0; pass < 3 && best == -1; pass++) {
+        for (int i = 0; i < v->page_count; i++) {
+            int physnum = (v->status.next_alloc + i) % v->page_count;
+            if (v->status.busy_map[physnum] == VEEPROM_BUSY_PAGE_FLAG || taken[physnum])
+                continue;
+            if (pass < 2 && VEEPROM_ERASE_PENDING(v, physnum))
+                continue;
+            if (pass == 0 && !VEEPROM_IN_ACTIVE_REGION(v, physnum))
+                continue;
+#ifdef FLASH_SECTORS
+            if (best == -1) {
+                best = physnum;
+                continue;
+            }
+            int space = veeprom_page_space(physnum);
+            int best_space = veeprom_page_space(best);
+            if (space >= chunks ? best_space < chunks || space < best_space
+                    : best_space < chunks && space > best_space)
+                best = physnum;
+#else
+            return physnum;
+#endif
+        }
+    }
+    return best;
+}
+
+
+/*
+ * Allocates pages for the given chunks following ids of the pages, but
+ * not more than max_pages, and sets the cursor to the first one. Pages
+ * are chosen before any of them is taken, so nothing is allocated when
+ * there is no room.
+ */
+VEEPROM_MODULE(int)
+veeprom_alloc_pages_set_cursor(veeprom_t *v, int chunks, int max_pages) {
+    int16_t plan[FLASH_PAGE_COUNT];
+    uint8_t taken[FLASH_PAGE_COUNT];
+    memset(taken, 0, sizeof(taken));
+#ifdef VEEPROM_ASYNC_ERASE
+    RIFER (veeprom_erase_progress(v));
+#endif
+
+    int count = 0;
+    while (chunks > 0 && count < max_pages) {
+        int physnum = veeprom_pick_page(v, chunks, taken);
+        THROW (physnum != -1, VEEPROM_ERROR_NOMEM);
+        taken[physnum] = 1;
+        plan[count++] = physnum;
+        chunks -= veeprom_page_space(physnum);
+    }
+    THROW (count > 0, ERROR_PARAM);
+
+    /*
      * index start page for writing data
      */
-    int index = -1;
+    int index = v->pages_size;
     for (int pageno = 0; pageno < count; pageno++) {
-        int physnum = m_status.next_alloc;
-        THROW (physnum != -1, VEEPROM_ERROR_NOMEM);
+        RIFER (veeprom_set_receiving(v, plan[pageno]));
+#ifdef VEEPROM_DUAL_REGION
+        v->status.active_region = VEEPROM_REGION(v, plan[pageno]);
+#endif
+        v->status.next_alloc = plan[pageno];
+        RIFER (veeprom_set_next_alloc(v));
+    }
+
+    THROW (v->pages[index] != NULL, ERROR_NULLPTR);
+
+    v->cursor.p_start_page = v->pages[index] - 1;
+    v->cursor.p_current = v->cursor.p_start_page + 1;
+    v->cursor.index = index;
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_receiving_to_valid(veeprom_t *v) {
+    if (v->pages_size == 0)
+        return OK;
+
+    /* Receiving pages are at the end. They are validated starting from
+     * the head, so an interrupted validation leaves a torn record. */
+    int i = v->pages_size;
+    for (; i > 0; i--) {
+        THROW (v->pages[i-1] != NULL, ERROR_NULLPTR);
+        flash_chunk_t *p = v->pages[i-1] - 1;
+        if (VEEPROM_PAGE_STATUS(p) == PAGE_VALID)
+            break;
+        THROW (VEEPROM_PAGE_STATUS(p) == PAGE_RECEIVING, ERROR_DCNSTY,
+            VEEPROM_LOGDEBUG("receiving to valid inconsistency"));
+    }
+
+    for (; i < v->pages_size; i++)
+        RIFER (flash_write_chunk(PAGE_VALID, v->pages[i] - 1));
+
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_erase_receiving(veeprom_t *v) {
+    if (v->pages_size == 0)
+        return OK;
+
+    while (v->pages_size > 0 &&
+          *(v->pages[v->pages_size - 1] - 1) == PAGE_RECEIVING)
+    {
+        int index = v->pages_size - 1;
+        RIFER (veeprom_rm_dereg_page(v, v->pages[index] - 1, index));
+    }
+    return OK;
+}
+
+
+/*
+ * Chunks hold bytes in little-endian order, so packing is a copy and data
+ * aligned to a chunk are programmed right from the source buffer. The last
+ * chunk is padded with zeros. The checksum is updated on every span
+ * before it's programmed.
+ */
+VEEPROM_MODULE(int)
+veeprom_write_data(veeprom_t *v, uint8_t *data, flash_chunk_t length) {
+    flash_chunk_t stage[VEEPROM_WRITE_STAGE];
+    int chunks = TO_CHUNKS(length);
+    int bytes = length;
+
+    while (chunks > 0) {
+        RIFER (veeprom_iterate_cursor(v));
+        int n = veeprom_page_end(v, v->cursor.p_start_page) - v->cursor.p_current;
+        if (n > chunks)
+            n = chunks;
+
+        int aligned = (uintptr_t)data % sizeof(flash_chunk_t) == 0;
+        if (aligned && n > 1 && n * (int)sizeof(flash_chunk_t) > bytes)
+            n--;    /* the padded last chunk is staged separately */
+
+        flash_chunk_t *src = (flash_chunk_t*)data;
+        int size = n * sizeof(flash_chunk_t);
+        if (!aligned || size > bytes) {
+            if (n > VEEPROM_WRITE_STAGE)
+                n = VEEPROM_WRITE_STAGE;
+            size = n * sizeof(flash_chunk_t);
+            stage[n - 1] = 0;
+            memcpy(stage, data, size < bytes ? size : bytes);
+            src = stage;
+        }
+
+        v->cursor.checksum = veeprom_checksum(v->cursor.checksum, src, n);
+        RIFER (flash_write_range(v->cursor.p_current, src, n));
+        /* cursor points to the last programmed chunk */
+        v->cursor.p_current += n - 1;
+        data += size;
+        bytes -= size;
+        chunks -= n;
+    }
+
+    return OK;
+}
+
+
+
+
+/*
+ * Writes a fragment of appended data at p which is located on the page
+ * p_start_page. The fragment must fit into the page.
+ */
+VEEPROM_MODULE(int)
+veeprom_write_fragment(veeprom_t *v, flash_chunk_t *p_start_page, flash_chunk_t *p,
+        uint8_t *data, flash_chunk_t length, flash_chunk_t flags) {
+    THROW (p + VEEPROM_FRAGMENT_CHUNKS(length) <= veeprom_page_end(v, p_start_page), ERROR_OBNDS);
+
+    v->cursor.p_start_page = p_start_page;
+    v->cursor.p_current = p - 1;
+    v->cursor.checksum = 0;
+
+    RIFER (veeprom_write_chunk(v, length | flags));
+    RIFER (veeprom_write_data(v, data, length));
+    return veeprom_write_checksum(v);
+}
+
+
+/*
+ * Reads back the record which starts with p_id and compares it with
+ * the source data and the checksum accumulated by the cursor.
+ * Data are compared by memcmp over the whole page run.
+ */
+#ifdef VEEPROM_COMPRESSION
+/*
+ * Compressed data are verified by the checksum of the chunks read back
+ * from every page of the record.
+ */
+VEEPROM_MODULE(int)
+veeprom_verify_checksum(veeprom_t *v, flash_chunk_t *p_id) {
+    veeprom_checksum_t checksum = 0;
+    veeprom_checksum_t stored = 0;
+    RIFER (veeprom_record_checksum(v, p_id, &checksum, &stored));
+    v->status.verify_bytes += TO_CHUNKS(VEEPROM_STORED_LENGTH(*(p_id+1)))
+        * sizeof(flash_chunk_t);
+    if (checksum != v->cursor.checksum || stored != v->cursor.checksum)
+        return VEEPROM_ERROR_VERIFY;
+    return OK;
+}
+#endif
+
+
+VEEPROM_MODULE(int)
+veeprom_verify_record(veeprom_t *v, flash_chunk_t *p_id, flash_chunk_t id, uint8_t *data,
+        flash_chunk_t length) {
+    if (*p_id != id)
+        return VEEPROM_ERROR_VERIFY;
+#ifdef VEEPROM_COMPRESSION
+    if (*(p_id+1) & VEEPROM_LENGTH_COMPRESSED) {
+        if (*(p_id+2) != length)
+            return VEEPROM_ERROR_VERIFY;
+        return veeprom_verify_checksum(v, p_id);
+    }
+#endif
+    if (*(p_id+1) != length)
+        return VEEPROM_ERROR_VERIFY;
+
+    int last = -1;
+    flash_chunk_t *end = NULL;
+    RIFER (veeprom_record_end(v, p_id, &last, &end));
+    int index = veeprom_binsearch(v->pages, v->pages_size, *(p_id-1));
+
+    flash_chunk_t *p = p_id + 2;
+    int page_length = (veeprom_page_space(veeprom_physnum(v, p_id)) - 1) * sizeof(flash_chunk_t);
+    int remaining = length;
+
+    while (remaining > 0) {
+        int n = remaining < page_length ? remaining : page_length;
+        int whole = n - n % sizeof(flash_chunk_t);
+        if (memcmp(p, data, whole) != 0)
+            return VEEPROM_ERROR_VERIFY;
+        if (whole < n) {
+            /* the last chunk is padded with zeros */
+            flash_chunk_t c = 0;
+            memcpy(&c, data + whole, n - whole);
+            if (*(p + whole / sizeof(flash_chunk_t)) != c)
+                return VEEPROM_ERROR_VERIFY;
+        }
+        v->status.verify_bytes += n;
+        data += n;
+        remaining -= n;
+
+        if (remaining == 0)
+            break;
+
+        THROW (++index <= last, ERROR_DCNSTY);
+        p = v->pages[index] + 1;
+        if (*p != id)
+            return VEEPROM_ERROR_VERIFY;
+        p++;
+        page_length = veeprom_page_space(veeprom_physnum(v, p)) * sizeof(flash_chunk_t);
+    }
+
+    veeprom_checksum_t stored = 0;
+    RIFER (veeprom_stored_checksum(v, end, last, &stored, NULL));
+    if (stored != v->cursor.checksum)
+        return VEEPROM_ERROR_VERIFY;
+    return OK;
+}
+
+
+/*
+ * Checks that the pages of the record starting with p_id were switched
+ * to VALID, programming of the status is repeated once.
+ */
+VEEPROM_MODULE(int)
+veeprom_verify_valid(veeprom_t *v, flash_chunk_t *p_id) {
+    int index = veeprom_binsearch(v->pages, v->pages_size, *(p_id-1));
+    THROW (index != -1, ERROR_DCNSTY);
+
+    for (int i = veeprom_record_pages(v, VEEPROM_STORED_LENGTH(*(p_id+1)), index); i > 0; i--, index++) {
+        flash_chunk_t *page = v->pages[index] - 1;
+        v->status.verify_bytes += sizeof(flash_chunk_t);
+        if (VEEPROM_PAGE_STATUS(page) == PAGE_VALID)
+            continue;
+
+        v->status.verify_mismatches++;
+        RIFER (flash_write_chunk(PAGE_VALID, page));
+        THROW (VEEPROM_PAGE_STATUS(page) == PAGE_VALID, ERROR_FLASH_WRITE);
+    }
+    return OK;
+}
+
+
+#ifdef VEEPROM_COMPRESSION
+VEEPROM_MODULE(int)
+veeprom_write_stream(void *context, uint8_t *buf, int length) {
+    return veeprom_write_data(context, buf, length);
+}
+#endif
+
+
+/*
+ * Writes data of the record, stored is the value of the length chunk.
+ */
+VEEPROM_MODULE(int)
+veeprom_write_payload(veeprom_t *v, uint8_t *data, flash_chunk_t length, flash_chunk_t stored) {
+#ifdef VEEPROM_COMPRESSION
+    if (stored & VEEPROM_LENGTH_COMPRESSED) {
+        RIFER (veeprom_write_chunk(v, length));
+        int packed = veeprom_lzss_compress(data, length, veeprom_write_stream, v);
+        THROW (packed == VEEPROM_STORED_LENGTH(stored) - sizeof(flash_chunk_t), ERROR_DCNSTY);
+        return OK;
+    }
+#endif
+    return veeprom_write_data(v, data, length);
+}
+
+
+/*
+ * Writes the record: header_size bytes of header (whole chunks, a key)
+ * followed by data. Records with a header are not compressed.
+ */
+VEEPROM_MODULE(int)
+veeprom_write_record(veeprom_t *v, flash_chunk_t id, uint8_t *header, int header_size,
+        uint8_t *data, flash_chunk_t length, int verify) {
+    flash_chunk_t stored = header_size + length;
+#ifdef VEEPROM_COMPRESSION
+    /* The first pass only calculates the size of compressed data */
+    int packed = header_size == 0 ?
+        sizeof(flash_chunk_t) + veeprom_lzss_compress(data, length, NULL, NULL) : stored;
+    if (packed < length)
+        stored = packed | VEEPROM_LENGTH_COMPRESSED;
+#endif
+    veeprom_init_cursor(v);
+    RIFER (veeprom_alloc_pages_set_cursor(v, TO_CHUNKS(VEEPROM_STORED_LENGTH(stored))
+                + 1 + VEEPROM_CHECKSUM_CHUNKS, v->page_count));
+    int pages = v->pages_size - v->cursor.index;
+    RIFER (veeprom_write_chunk(v, id));
+    flash_chunk_t *p_id = v->cursor.p_current;
+
+    int ret = veeprom_write_chunk(v, stored);
+    if (ret == OK && header_size > 0)
+        ret = veeprom_write_data(v, header, header_size);
+    if (ret == OK)
+        ret = veeprom_write_payload(v, data, length, stored);
+    if (ret == OK)
+        ret = veeprom_write_checksum(v);
+    if (ret == OK && verify && (ret=veeprom_verify_record(v, p_id, id, data, length)) != OK)
+        v->status.verify_mismatches++;
+
+    if (ret != OK) {
+        /* pages are released and the next attempt takes fresh ones */
+        RIFER (veeprom_erase_receiving(v));
+        return ret;
+    }
+
+    RIFER (veeprom_receiving_to_valid(v));
+    if (verify)
+        RIFER (veeprom_verify_valid(v, p_id));
+    RIFER (veeprom_reg_id_rm_prev(v, p_id));
+
+    v->status.live_bytes += VEEPROM_STORED_LENGTH(stored);
+    v->status.overhead_bytes += sizeof(flash_chunk_t) *
+        (pages * (VEEPROM_HEADER_CHUNKS + 1) + 1 + VEEPROM_CHECKSUM_CHUNKS);
+
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_init_usage(veeprom_t *v) {
+    v->status.live_bytes = 0;
+    v->status.overhead_bytes = 0;
+
+    for (int i = 0; i < v->ids_size; i++) {
+        int live = 0;
+        int overhead = 0;
+        RIFER (veeprom_record_usage(v, v->ids[i], &live, &overhead));
+        v->status.live_bytes += live;
+        v->status.overhead_bytes += overhead;
+    }
+    return OK;
+}
+
+
+/*
+ * Locates the increment area of the counter record which starts with p_id:
+ * from the chunk following the checksum up to the end of the page.
+ */
+VEEPROM_MODULE(int)
+veeprom_counter_area(veeprom_t *v, flash_chunk_t *p_id, flash_chunk_t **area, int *size) {
+    THROW (p_id != NULL && area != NULL && size != NULL, ERROR_NULLPTR);
+    THROW (*(p_id+1) == sizeof(uint32_t), VEEPROM_ERROR_LENGTH);
+
+    flash_chunk_t *page_end = veeprom_page_end(v, p_id);
+    *area = p_id + 2 + TO_CHUNKS(sizeof(uint32_t)) + VEEPROM_CHECKSUM_CHUNKS;
+    *size = page_end - *area;
+    THROW (*size > 0, ERROR_DCNSTY);
+    return OK;
+}
 
-        RIFER (veeprom_set_receiving(physnum));
 
-        if (index == -1)
-            index = m_veeprom_pages_size - 1;
+/*
+ * Increments are applied from the start of the area, so the programmed
+ * chunks always form a prefix. Binary search finds the first chunk
+ * which is not completely cleared, popcount gives the cleared bits in it.
+ */
+VEEPROM_MODULE(int)
+veeprom_counter_used(flash_chunk_t *area, int size) {
+    int l = 0;
+    int r = size;
+    while (l < r) {
+        int m = (l + r) >> 1;
+        if (area[m] == 0)
+            l = m + 1;
+        else
+            r = m;
+    }
 
-        RIFER (veeprom_set_next_alloc());
+    int used = l * VEEPROM_COUNTER_UNITS;
+#ifdef VEEPROM_COUNTER_BITWISE
+    if (l < size)
+        used += VEEPROM_CHUNK_BITS - __builtin_popcountll(area[l]);
+#endif
+    return used;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_counter_base(flash_chunk_t *p_id, uint32_t *base) {
+    THROW (*(p_id+1) == sizeof(uint32_t), VEEPROM_ERROR_LENGTH);
+    memcpy(base, p_id + 2, sizeof(uint32_t));
+    return OK;
+}
+
+
+#ifdef VEEPROM_KEYS
+/*
+ * Key index: open addressing over groups of 8 slots. Every slot has
+ * a tag byte: EMPTY, DELETED or 0x80 | top 7 bits of the key hash.
+ * A group of tags is compared at once as a 64-bit word (SWAR), only
+ * the slots of a group with matching tags are compared to the key
+ * kept in the record. Probing stops at a group with an empty slot.
+ */
+#define VEEPROM_KEY_EMPTY       0x00
+#define VEEPROM_KEY_DELETED     0x01
+#define VEEPROM_KEY_GROUP       8
+#define VEEPROM_KEY_GROUPS      (VEEPROM_KEY_SLOTS / VEEPROM_KEY_GROUP)
+#define VEEPROM_KEY_TAG(h)      (0x80 | ((h) >> 25))
+#define VEEPROM_SWAR_ONES       UINT64_C(0x0101010101010101)
+#define VEEPROM_SWAR_HIGHS      UINT64_C(0x8080808080808080)
+
+
+/* FNV-1a */
+VEEPROM_MODULE(uint32_t)
+veeprom_key_hash(const uint8_t *key, int length) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        h ^= key[i];
+        h *= 16777619u;
     }
+    return h;
+}
+
+
+/*
+ * Non zero if some byte of the group equals tag. Bytes above a matching
+ * one may give false positives, so the slots are checked one by one.
+ */
+VEEPROM_MODULE(uint64_t)
+veeprom_key_match(const uint8_t *tags, uint8_t tag) {
+    uint64_t group;
+    memcpy(&group, tags, sizeof(group));
+    group ^= VEEPROM_SWAR_ONES * tag;
+    return (group - VEEPROM_SWAR_ONES) & ~group & VEEPROM_SWAR_HIGHS;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_key_equal(flash_chunk_t *p_id, const uint8_t *key, int length) {
+    /* a reader may meet a slot being filled */
+    if (p_id == NULL)
+        return 0;
+    const uint8_t *stored = (const uint8_t*)(p_id + 2);
+    return stored[0] == length && memcmp(stored + 1, key, length) == 0;
+}
+
+
+/*
+ * Returns the slot of the key or -1. free gets the first deleted or
+ * empty slot on the probe sequence (-1 if there is none).
+ */
+VEEPROM_MODULE(int)
+veeprom_key_lookup(veeprom_t *v, uint32_t h, const uint8_t *key, int length, int *free) {
+    uint8_t tag = VEEPROM_KEY_TAG(h);
+    int g = h & (VEEPROM_KEY_GROUPS - 1);
+    *free = -1;
+
+    for (int n = 0; n < VEEPROM_KEY_GROUPS; n++) {
+        uint8_t *tags = v->key_tags + g * VEEPROM_KEY_GROUP;
+        int base = g * VEEPROM_KEY_GROUP;
+
+        if (veeprom_key_match(tags, tag)) {
+            for (int i = 0; i < VEEPROM_KEY_GROUP; i++)
+                if (tags[i] == tag && veeprom_key_equal(v->key_records[base + i], key, length))
+                    return base + i;
+        }
+        int empty = veeprom_key_match(tags, VEEPROM_KEY_EMPTY) != 0;
+        if (*free == -1 && (empty || veeprom_key_match(tags, VEEPROM_KEY_DELETED))) {
+            for (int i = 0; *free == -1 && i < VEEPROM_KEY_GROUP; i++)
+                if (tags[i] == VEEPROM_KEY_EMPTY || tags[i] == VEEPROM_KEY_DELETED)
+                    *free = base + i;
+        }
+        if (empty)
+            return -1;
+        g = (g + 1) & (VEEPROM_KEY_GROUPS - 1);
+    }
+    return -1;
+}
 
-    THROW (index != -1, ERROR_DCNSTY);
-    THROW (m_veeprom_pages[index] != NULL, ERROR_NULLPTR);
 
-    m_cursor.p_start_page = m_veeprom_pages[index] - 1;
-    m_cursor.p_current = m_cursor.p_start_page + 1;
-    m_cursor.index = index;
-    return OK;
-}
+VEEPROM_MODULE(int)
+veeprom_key_build(veeprom_t *v);
 
 
+/*
+ * Registers the keyed record p_id. When live and deleted slots take 3/4
+ * of the index it's rebuilt from ids (the record must be registered).
+ */
 VEEPROM_MODULE(int)
-veeprom_receiving_to_valid() {
-    if (m_veeprom_pages_size == 0)
+veeprom_key_insert(veeprom_t *v, flash_chunk_t *p_id) {
+    const uint8_t *key = (const uint8_t*)(p_id + 2);
+    uint32_t h = veeprom_key_hash(key + 1, key[0]);
+    int free = -1;
+    int slot = veeprom_key_lookup(v, h, key + 1, key[0], &free);
+    if (slot != -1) {
+        v->key_records[slot] = p_id;
         return OK;
-
-    int i = m_veeprom_pages_size - 1;
-    for (; i >= 0; i--) {
-        THROW (m_veeprom_pages[i] != NULL, ERROR_NULLPTR);
-        flash_chunk_t *p = m_veeprom_pages[i] - 1;
-        switch (VEEPROM_PAGE_STATUS(p)) {
-            case PAGE_RECEIVING:
-                RIFER (flash_write_chunk(PAGE_VALID, p));
-                continue;
-            case PAGE_VALID:
-                return OK;
-            default:
-                THROW (0, ERROR_DCNSTY);
-        }
     }
 
-    if (i == -1)
-        return OK;
+    if (v->key_used >= VEEPROM_KEY_SLOTS / 4 * 3)
+        return veeprom_key_build(v);
 
-    VEEPROM_LOGDEBUG("receiving to valid inconsistency");
-    return ERROR_DCNSTY;
+    THROW (free != -1, VEEPROM_ERROR_NOMEM);
+    if (v->key_tags[free] == VEEPROM_KEY_EMPTY)
+        v->key_used++;
+    v->key_records[free] = p_id;
+    v->key_tags[free] = VEEPROM_KEY_TAG(h);
+    return OK;
 }
 
 
+/* ids are sorted, keyed records are at the end */
 VEEPROM_MODULE(int)
-veeprom_erase_receiving() {
-    if (m_veeprom_pages_size == 0)
-        return OK;
-
-    while (m_veeprom_pages_size > 0 &&
-          *(m_veeprom_pages[m_veeprom_pages_size - 1] - 1) == PAGE_RECEIVING)
-    {
-        int index = m_veeprom_pages_size - 1;
-        RIFER (veeprom_rm_dereg_page(m_veeprom_pages[index], index));
+veeprom_key_build(veeprom_t *v) {
+    memset(v->key_tags, VEEPROM_KEY_EMPTY, sizeof(v->key_tags));
+    memset(v->key_records, 0, sizeof(v->key_records));
+    v->key_used = 0;
+
+    for (int i = v->ids_size - 1; i >= 0 && *v->ids[i] >= VEEPROM_KEY_ID_MIN; i--) {
+        flash_chunk_t *p = v->ids[i];
+        int length = ((const uint8_t*)(p + 2))[0];
+        THROW (length > 0 && length <= VEEPROM_KEY_MAX &&
+                !(*(p+1) & VEEPROM_LENGTH_COMPRESSED) &&
+                *(p+1) >= VEEPROM_KEY_HEADER_CHUNKS(length) * sizeof(flash_chunk_t),
+                VEEPROM_ERROR_DATA);
+        RIFER (veeprom_key_insert(v, p));
     }
     return OK;
 }
 
 
-VEEPROM_MODULE(int)
-veeprom_write_data(uint8_t *data, flash_chunk_t length) {
-    int s = 0;
-    flash_chunk_t acc = 0;
-    int ret = OK;
-
-    for (unsigned int i = 0; i < length; i++) {
-        flash_chunk_t c = *(data + i);
-        if (s == sizeof(flash_chunk_t)) {
-            THROW ((ret=veeprom_write_chunk(acc)) == OK, ret);
-            acc = 0;
-            s = 0;
-        }
-        acc |= (c << (s*8));
-        s++;
+/*
+ * A new key takes the id its hash points to or the next free one: there
+ * are fewer records than ids in the keyed range.
+ */
+VEEPROM_MODULE(flash_chunk_t)
+veeprom_key_new_id(veeprom_t *v, uint32_t h) {
+    flash_chunk_t range = VEEPROM_MAX_ID - VEEPROM_KEY_ID_MIN;
+    flash_chunk_t offset = h % range;
+    for (int n = 0; n <= v->ids_size; n++) {
+        flash_chunk_t id = VEEPROM_KEY_ID_MIN + offset;
+        if (veeprom_binsearch(v->ids, v->ids_size, id) == -1)
+            return id;
+        offset = (offset + 1) % range;
     }
+    return 0;
+}
 
-    if (s > 0) {
-        THROW ((ret=veeprom_write_chunk(acc)) == OK, ret);
-    }
 
+VEEPROM_MODULE(int)
+veeprom_key_slot(veeprom_t *v, const void *key, int key_length, int *slot) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+    THROW (key != NULL && slot != NULL, ERROR_NULLPTR);
+    THROW (key_length > 0 && key_length <= VEEPROM_KEY_MAX, VEEPROM_ERROR_ID);
+
+    int free = -1;
+    *slot = veeprom_key_lookup(v, veeprom_key_hash(key, key_length), key, key_length, &free);
     return OK;
 }
+#endif
 
 
 
 
-/* API functions */
+/*
+ * Implementation of API functions, the callers hold the lock of the store.
+ */
+
+
+/* Space of the pages as the mount ordered them, no erase is pending yet */
+VEEPROM_MODULE(void)
+veeprom_init_space(veeprom_t *v) {
+    v->status.total_bytes = 0;
+    v->status.free_bytes = 0;
+    v->status.reclaimable_bytes = 0;
+    v->status.free_chunks = 0;
+    for (int physnum = 0; physnum < v->page_count; physnum++) {
+        v->status.total_bytes += veeprom_page_bytes(physnum);
+        if (v->status.busy_map[physnum] == VEEPROM_BUSY_PAGE_FLAG)
+            continue;
+        v->status.free_bytes += veeprom_page_bytes(physnum);
+        v->status.free_chunks += veeprom_page_space(physnum);
+    }
+}
 
 
-int veeprom_init(flash_chunk_t *flash_start) {
-    m_status.flags = VEEPROM_NOTINITIALIZED;
+VEEPROM_MODULE(int)
+veeprom_mount(veeprom_t *v, flash_chunk_t *flash_start, int page_count) {
+    THROW (flash_start != NULL, ERROR_NULLPTR);
+    v->status.flags = VEEPROM_NOTINITIALIZED;
     /* Set amount of pages that may be used for Virtual EEPROM.
      * Code and data are located on the flash.
      */
@@ -627,195 +1866,767 @@ int veeprom_init(flash_chunk_t *flash_start) {
     extern uint32_t _veeprom_end;
     VEEPROM_LOGDEBUG("veeprom_start=%d", &_veeprom_start);
     VEEPROM_LOGDEBUG("veeprom_end=%d", &_veeprom_end);
-    /* FIXIT: in the case of pages of different sizes this is not true */
-    VEEPROM_PAGE_COUNT = ((uint32_t)&_veeprom_end - (uint32_t)&_veeprom_start) / FLASH_PAGE_SIZE;
-    VEEPROM_LOGDEBUG("veeprom_page_count=%d", VEEPROM_PAGE_COUNT);
+#ifdef FLASH_SECTORS
+    int max_count = ARRAY_SIZE(m_sectors);
+    const flash_sector_t *last = &m_sectors[max_count - 1];
+    THROW (last->offset + last->size <=
+            (uint32_t)&_veeprom_end - (uint32_t)&_veeprom_start, ERROR_PARAM);
 #else
-    VEEPROM_PAGE_COUNT = FLASH_PAGE_COUNT;
+    int max_count = ((uint32_t)&_veeprom_end - (uint32_t)&_veeprom_start) / FLASH_PAGE_SIZE;
+#endif
+#elif defined(FLASH_SECTORS)
+    int max_count = ARRAY_SIZE(m_sectors);
+#else
+    int max_count = FLASH_PAGE_COUNT;
+#endif
+    /* Stores sharing the flash take a part of it each */
+    THROW (page_count >= 0 && page_count <= max_count && max_count <= FLASH_PAGE_COUNT,
+            ERROR_PARAM);
+    v->page_count = page_count > 0 ? page_count : max_count;
+    VEEPROM_LOGDEBUG("veeprom_page_count=%d", v->page_count);
+#ifdef FLASH_SECTORS
+    RIFER (veeprom_check_sectors(v));
+#endif
+    v->status.flash_start = flash_start;
+
+    memset(v->status.busy_map, 0xFF, (sizeof(v->status.busy_map)));
+
+    v->ids_size = 0;
+    v->pages_size = 0;
+
+    v->status.busy_pages = 0;
+    v->status.next_alloc = -1;
+    v->status.live_bytes = 0;
+    v->status.overhead_bytes = 0;
+    memset(v->status.extension_map, 0, sizeof(v->status.extension_map));
+    v->status.verify_bytes = 0;
+    v->status.verify_mismatches = 0;
+    v->status.torn_records = 0;
+    v->status.recovered_pages = 0;
+#ifdef VEEPROM_BLANK_CHECK
+    memset(v->status.dirty_map, 0, sizeof(v->status.dirty_map));
+#endif
+#ifdef VEEPROM_ASYNC_ERASE
+    memset(v->status.erase_map, 0, sizeof(v->status.erase_map));
+    v->status.erasing = -1;
 #endif
-    m_status.flash_start = flash_start;
-
-    memset(m_status.busy_map, 0xFF, (sizeof(m_status.busy_map)));
-
-    memset(m_veeprom_ids, 0, sizeof(m_veeprom_ids));
-    m_veeprom_ids_size = 0;
-
-    memset(m_veeprom_pages, 0, sizeof(m_veeprom_pages));
-    m_veeprom_pages_size = 0;
-
-    m_status.busy_pages = 0;
-    m_status.next_alloc = -1;
 
-    RIFER (veeprom_order_pages());
-    RIFER (veeprom_check_order());
-    RIFER (veeprom_init_data());
+    RIFER (veeprom_order_pages(v));
+    veeprom_init_space(v);
+#ifdef VEEPROM_DUAL_REGION
+    /* the region written last */
+    v->status.active_region = 0;
+    if (v->pages_size > 0)
+        v->status.active_region = VEEPROM_REGION(v,
+                veeprom_physnum(v, v->pages[v->pages_size - 1] - 1));
+#endif
+    RIFER (veeprom_check_order(v));
+    RIFER (veeprom_init_data(v));
+    RIFER (veeprom_init_usage(v));
+#ifdef VEEPROM_KEYS
+    RIFER (veeprom_key_build(v));
+#endif
+    v->version = 0;
+    for (int i = 0; i < v->ids_size; i++)
+        veeprom_new_version(v, v->ids[i]);
 
-    m_status.flags |= VEEPROM_INITIALIZED;
+    v->status.flags |= VEEPROM_INITIALIZED;
     return OK;
 }
 
 
-int veeprom_deinit() {
-    memset(m_veeprom_ids, 0, sizeof(m_veeprom_ids));
-    m_veeprom_ids_size = 0;
-    m_status.flags = VEEPROM_NOTINITIALIZED;
+VEEPROM_MODULE(int)
+veeprom_clean_unlocked(veeprom_t *v) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
 
-    return OK;
+#ifdef VEEPROM_ASYNC_ERASE
+    RIFER (veeprom_erase_settle(v));
+#endif
+
+    /* readers wait on the update mutex until the store is mounted again */
+    int ret = OK;
+    veeprom_update_begin(v);
+    for (int physnum = 0; physnum < v->page_count && ret == OK; physnum++)
+        ret = flash_erase_page(veeprom_page_addr(v, physnum));
+    if (ret == OK)
+        ret = veeprom_mount(v, v->status.flash_start, v->page_count);
+    veeprom_update_end(v);
+    return ret;
 }
 
 
-#ifdef CHIBIOS_ON
-int veeprom_clean() {
-    int ret = OK;
-    extern uint32_t _veeprom_start;
-    extern uint32_t _veeprom_end;
-    flash_chunk_t *page = (flash_chunk_t*)&_veeprom_start;
-    for (; page < (flash_chunk_t*)&_veeprom_end; page += FLASH_PAGE_CHUNKS) {
-        THROW ((ret=flash_erase_page(page)) == OK, ret);
-    }
-    return OK;
+#ifdef VEEPROM_ASYNC_ERASE
+VEEPROM_MODULE(int)
+veeprom_poll_unlocked(veeprom_t *v) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+    return veeprom_erase_progress(v);
 }
 #endif
 
 
-int veeprom_write(flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
-    THROW (VEEPROM_IS_INIT(), VEEPROM_ERROR_INIT);
+VEEPROM_MODULE(int)
+veeprom_write_unlocked(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
 
     THROW (data != NULL, ERROR_NULLPTR);
-    THROW (id > 0 && id < VEEPROM_MAX_ID, VEEPROM_ERROR_ID);
-    THROW (length >= 0 && length < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
+    THROW (id > 0 && id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+    THROW (length >= 0 && length < VEEPROM_LENGTH_LIMIT, VEEPROM_ERROR_LENGTH);
 
-    veeprom_init_cursor();
-    RIFER (veeprom_alloc_pages_set_cursor(veeprom_calculate_pages(length)));
-    RIFER (veeprom_write_chunk(id));
-    flash_chunk_t *p_id = m_cursor.p_current;
+    return veeprom_write_record(v, id, NULL, 0, data, length, 0);
+}
 
-    int ret = OK;
-    THROW ((ret=veeprom_write_chunk(length)) == OK, ret);
-    THROW ((ret=veeprom_write_data(data, length)) == OK, ret);
-    THROW ((ret=veeprom_write_chunk(m_cursor.checksum)) == OK, ret);
-    THROW (m_cursor.checksum == 0, ERROR_DCNSTY);
 
-    if (ret != OK) {
-        RIFER (veeprom_erase_receiving());
-        THROW (0, ret);
-    }
+VEEPROM_MODULE(int)
+veeprom_write_verify_unlocked(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
 
-    RIFER (veeprom_receiving_to_valid());
-    RIFER (veeprom_reg_id_rm_prev(p_id));
+    THROW (data != NULL, ERROR_NULLPTR);
+    THROW (id > 0 && id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+    THROW (length >= 0 && length < VEEPROM_LENGTH_LIMIT, VEEPROM_ERROR_LENGTH);
 
-    return OK;
+    int ret = OK;
+    for (int attempt = 0; attempt <= VEEPROM_VERIFY_RETRIES; attempt++) {
+        ret = veeprom_write_record(v, id, NULL, 0, data, length, 1);
+        if (ret != VEEPROM_ERROR_VERIFY)
+            return ret;
+        VEEPROM_LOGDEBUG("verify mismatch id=%" VEEPROM_FLASH_CHUNK_FMT, id);
+    }
+    return ret;
 }
 
 
-int veeprom_read(veeprom_read_t *read_buf) {
-    THROW (VEEPROM_IS_INIT(), VEEPROM_ERROR_INIT);
+VEEPROM_MODULE(int)
+veeprom_read_unlocked(veeprom_t *v, veeprom_read_t *read_buf) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
 
     THROW (read_buf != NULL && read_buf->buf != NULL, ERROR_NULLPTR);
 
-    int index = veeprom_binsearch(m_veeprom_ids, m_veeprom_ids_size, read_buf->id);
+    int index = veeprom_binsearch(v->ids, v->ids_size, read_buf->id);
     THROW (index != -1, VEEPROM_ERROR_ID_NOTFOUND,
         VEEPROM_LOGDEBUG("not found id=%" VEEPROM_FLASH_CHUNK_FMT, read_buf->id));
 
-    flash_chunk_t *p = m_veeprom_ids[index];
+    flash_chunk_t *p = v->ids[index];
     THROW (p != NULL && p+1 != NULL, ERROR_NULLPTR);
     THROW (*p == read_buf->id, -ERROR_DCNSTY);
+    int extended = VEEPROM_HAS_EXTENSION(v, veeprom_physnum(v, p)) != 0;
+
+    flash_chunk_t stored_length = VEEPROM_STORED_LENGTH(*(p+1));
+    int length = TO_CHUNKS(stored_length) * sizeof(flash_chunk_t);
+#ifdef VEEPROM_COMPRESSION
+    int compressed = (*(p+1) & VEEPROM_LENGTH_COMPRESSED) != 0;
+    int offset = 0;
+    veeprom_lzss_decoder_t decoder;
+    if (compressed) {
+        read_buf->length = *(p+2);
+        THROW (read_buf->length <= read_buf->buf_size, VEEPROM_ERROR_BUFSIZE);
+        veeprom_lzss_decoder_init(&decoder, read_buf->buf, read_buf->length);
+    } else
+#endif
+    {
+        read_buf->length = stored_length;
+        THROW (length <= read_buf->buf_size, VEEPROM_ERROR_BUFSIZE);
+    }
 
-    read_buf->length = *(p+1);
-    int length = TO_CHUNKS(*(p+1)) * sizeof(flash_chunk_t);
-    THROW (length <= read_buf->buf_size, VEEPROM_ERROR_BUFSIZE);
-
-    uint8_t *p_buf = read_buf->buf;
-    int pages = veeprom_calculate_pages(length);
+    int last = -1;
+    flash_chunk_t *end = NULL;
+    RIFER (veeprom_record_end(v, p, &last, &end));
 
-    if (pages > 0) {
-        index = veeprom_binsearch(m_veeprom_pages, m_veeprom_pages_size, *(p - 1));
-        THROW (index != -1, ERROR_DCNSTY);
-    }
-    p += 2;
+    veeprom_checksum_t stored = 0;
+    RIFER (veeprom_stored_checksum(v, end, last, &stored, &read_buf->checksum));
+    veeprom_checksum_t checksum = veeprom_checksum(0, p, 2);
 
-    while (pages-- > 0) {
+    index = veeprom_binsearch(v->pages, v->pages_size, *(p - 1));
+    THROW (index != -1, ERROR_DCNSTY);
 
-        int page_length = FLASH_PAGE_SIZE - VEEPROM_HEADER_SIZE - 2*sizeof(flash_chunk_t);
+    uint8_t *p_buf = read_buf->buf;
+    /* The first page has id and length before data, the next ones only id */
+    int page_length = (veeprom_page_space(veeprom_physnum(v, p)) - 1) * sizeof(flash_chunk_t);
+    p += 2;
 
+    while (length > 0) {
         if (page_length > length)
             page_length = length;
 
-        memcpy(p_buf, p, page_length);
+#ifdef VEEPROM_COMPRESSION
+        if (compressed) {
+            checksum = veeprom_checksum(checksum, p, page_length / sizeof(flash_chunk_t));
+            RIFER (veeprom_decode_span(&decoder, p, page_length, stored_length, &offset));
+        } else
+#endif
+        checksum = veeprom_checksum_copy(checksum, p_buf, p,
+                page_length / sizeof(flash_chunk_t));
         p_buf += page_length;
-
         length -= page_length;
 
-        THROW (length >= 0, ERROR_DCNSTY);
-
-        if (length == 0) {
-            p += TO_CHUNKS(page_length);
-            read_buf->checksum = p;
+        if (length == 0)
             break;
-        }
 
-        THROW (pages > 0, ERROR_DCNSTY);
-        THROW (index + 1 < m_veeprom_pages_size, ERROR_DCNSTY);
-        THROW (m_veeprom_pages[index + 1] != NULL, ERROR_NULLPTR);
+        THROW (index + 1 <= last, ERROR_DCNSTY);
+        THROW (v->pages[index + 1] != NULL, ERROR_NULLPTR);
         index++;
-        p = m_veeprom_pages[index];
+        p = v->pages[index];
         THROW (*p > 0 && *p < VEEPROM_MAX_VIRTNUM, VEEPROM_ERROR_VIRTNUM);
         THROW (*(p+1) == read_buf->id, ERROR_DCNSTY);
         p += 2;
+        page_length = veeprom_page_space(veeprom_physnum(v, p)) * sizeof(flash_chunk_t);
     }
 
+    THROW (checksum == stored, VEEPROM_ERROR_CHECKSUM,
+        VEEPROM_LOGDEBUG("checksum mismatch id=%" VEEPROM_FLASH_CHUNK_FMT, read_buf->id));
+#ifdef VEEPROM_COMPRESSION
+    THROW (!compressed || decoder.pos == read_buf->length, VEEPROM_ERROR_DATA);
+#endif
+
+    /* Appended data */
+    int pending = 0;
+    flash_chunk_t *page = v->pages[last] - 1;
+    int fragments = 0;
+    RIFER (veeprom_read_fragments(end, veeprom_page_end(v, page), read_buf,
+                &pending, &fragments));
+
+    if (extended)
+        while ((last = veeprom_next_extension(v, read_buf->id, last + 1)) != -1) {
+            page = v->pages[last] - 1;
+            RIFER (veeprom_read_fragments(page + VEEPROM_HEADER_CHUNKS + 2,
+                        veeprom_page_end(v, page), read_buf, &pending, &fragments));
+        }
+    THROW (read_buf->length <= read_buf->buf_size, VEEPROM_ERROR_BUFSIZE);
+
     return OK;
 }
 
-flash_chunk_t* veeprom_find(flash_chunk_t id) {
-    int index = veeprom_binsearch(m_veeprom_ids, m_veeprom_ids_size, id);
+VEEPROM_MODULE(flash_chunk_t*)
+veeprom_find_unlocked(veeprom_t *v, flash_chunk_t id) {
+    int index = veeprom_binsearch(v->ids, v->ids_size, id);
     if (index == -1) {
         return NULL;
     }
-    return m_veeprom_ids[index];
+    return v->ids[index];
+}
+
+VEEPROM_MODULE(int)
+veeprom_get_version_unlocked(veeprom_t *v, flash_chunk_t id, uint32_t *version) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+    THROW (version != NULL, ERROR_NULLPTR);
+
+    *version = 0;
+    flash_chunk_t *p = veeprom_find_unlocked(v, id);
+    if (p == NULL)
+        return OK;
+
+    *version = v->versions[veeprom_physnum(v, p)];
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_write_if_version_unlocked(veeprom_t *v, flash_chunk_t id, uint32_t expected_version,
+        uint8_t *data, flash_chunk_t length) {
+    uint32_t version = 0;
+    RIFER (veeprom_get_version_unlocked(v, id, &version));
+    if (version != expected_version) {
+        VEEPROM_LOGDEBUG("version mismatch id=%" VEEPROM_FLASH_CHUNK_FMT
+                " expected=%" PRIu32 " actual=%" PRIu32, id, expected_version, version);
+        return VEEPROM_ERROR_VERSION;
+    }
+    return veeprom_write_unlocked(v, id, data, length);
 }
 
-int veeprom_delete(flash_chunk_t id) {
-    THROW (VEEPROM_IS_INIT(), VEEPROM_ERROR_INIT);
 
-    int index = veeprom_binsearch(m_veeprom_ids, m_veeprom_ids_size, id);
+VEEPROM_MODULE(int)
+veeprom_delete_unlocked(veeprom_t *v, flash_chunk_t id) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+#ifdef VEEPROM_KEYS
+    THROW (id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+#endif
+
+    int index = veeprom_binsearch(v->ids, v->ids_size, id);
     if (index == -1) {
         VEEPROM_LOGDEBUG("not found id=%" VEEPROM_FLASH_CHUNK_FMT, id);
         return OK;
     }
 
-    RIFER (veeprom_rm_data_dereg_pages(m_veeprom_ids[index]));
-    RIFER (veeprom_sortedrm(m_veeprom_ids, &m_veeprom_ids_size, index));
+    flash_chunk_t *p = v->ids[index];
+    veeprom_update_begin(v);
+    int ret = veeprom_sortedrm(v->ids, &v->ids_size, index);
+    veeprom_update_end(v);
+    RIFER (ret);
+
+    return veeprom_rm_data_dereg_pages(v, p);
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_append_unlocked(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+
+    THROW (data != NULL, ERROR_NULLPTR);
+    THROW (id > 0 && id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+    THROW (length > 0 && length < VEEPROM_MAX_LENGTH, VEEPROM_ERROR_LENGTH);
+
+    flash_chunk_t *p = veeprom_find_unlocked(v, id);
+    if (p == NULL)
+        return veeprom_write_unlocked(v, id, data, length);
+
+    flash_chunk_t *page = NULL;
+    flash_chunk_t *p_free = NULL;
+    RIFER (veeprom_record_tail(v, p, &page, &p_free));
+
+    flash_chunk_t appended = length;
+    flash_chunk_t flags = VEEPROM_FRAGMENT_FIRST;
+    int extension = 0;
+    while (length > 0) {
+        /* Fragment takes length and checksum besides data */
+        int space = (veeprom_page_end(v, page) - p_free - 1 - VEEPROM_CHECKSUM_CHUNKS)
+            * sizeof(flash_chunk_t);
+
+        if (space <= 0) {
+            veeprom_init_cursor(v);
+            /* marker and the fragment follow id */
+            RIFER (veeprom_alloc_pages_set_cursor(v, 1 + VEEPROM_FRAGMENT_CHUNKS(length), 1));
+            RIFER (veeprom_write_chunk(v, id));
+            RIFER (veeprom_write_chunk(v, VEEPROM_LENGTH_EXTENSION));
+            veeprom_update_begin(v);
+            VEEPROM_SET_EXTENSION(v, veeprom_physnum(v, p));
+            veeprom_update_end(v);
+            page = v->cursor.p_start_page;
+            p_free = v->cursor.p_current + 1;
+            extension = 1;
+            continue;
+        }
+
+        flash_chunk_t n = length < space ? length : space;
+        if (n < length)
+            flags |= VEEPROM_FRAGMENT_MORE;
+        else
+            flags &= ~VEEPROM_FRAGMENT_MORE;
+
+        /* the tail of a page readers may be reading is programmed */
+        veeprom_update_begin(v);
+        int ret = veeprom_write_fragment(v, page, p_free, data, n, flags);
+        veeprom_update_end(v);
+        if (ret == OK && VEEPROM_PAGE_STATUS(page) == PAGE_RECEIVING)
+            ret = veeprom_receiving_to_valid(v);
+        if (ret != OK) {
+            veeprom_erase_receiving(v);
+            THROW (0, ret);
+        }
+
+        v->status.overhead_bytes += sizeof(flash_chunk_t) *
+            (1 + VEEPROM_CHECKSUM_CHUNKS + extension * (VEEPROM_HEADER_CHUNKS + 2));
+        extension = 0;
+        p_free += VEEPROM_FRAGMENT_CHUNKS(n);
+        data += n;
+        length -= n;
+        flags = 0;
+    }
+
+    v->status.live_bytes += appended;
+    veeprom_update_begin(v);
+    veeprom_new_version(v, p);
+    veeprom_update_end(v);
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_counter_init_unlocked(veeprom_t *v, flash_chunk_t id, uint32_t value) {
+    return veeprom_write_unlocked(v, id, (uint8_t*)&value, sizeof(value));
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_counter_inc_unlocked(veeprom_t *v, flash_chunk_t id) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+
+    flash_chunk_t *p = veeprom_find_unlocked(v, id);
+    THROW (p != NULL, VEEPROM_ERROR_ID_NOTFOUND);
+
+    flash_chunk_t *area = NULL;
+    int size = 0;
+    RIFER (veeprom_counter_area(v, p, &area, &size));
+
+    int used = veeprom_counter_used(area, size);
+    if (used < size * VEEPROM_COUNTER_UNITS) {
+        flash_chunk_t *c = area + used / VEEPROM_COUNTER_UNITS;
+#ifdef VEEPROM_COUNTER_BITWISE
+        RIFER (flash_write_chunk(*c << 1, c));
+#else
+        RIFER (flash_write_chunk(0, c));
+#endif
+        veeprom_update_begin(v);
+        veeprom_new_version(v, p);
+        veeprom_update_end(v);
+        return OK;
+    }
+
+    /* The area is exhausted: roll over to a fresh record */
+    uint32_t base = 0;
+    RIFER (veeprom_counter_base(p, &base));
+    THROW (base + used + 1 > base, ERROR_OBNDS);
+    return veeprom_counter_init_unlocked(v, id, base + used + 1);
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_counter_get_unlocked(veeprom_t *v, flash_chunk_t id, uint32_t *value) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+    THROW (value != NULL, ERROR_NULLPTR);
+
+    flash_chunk_t *p = veeprom_find_unlocked(v, id);
+    THROW (p != NULL, VEEPROM_ERROR_ID_NOTFOUND);
+
+    flash_chunk_t *area = NULL;
+    int size = 0;
+    RIFER (veeprom_counter_area(v, p, &area, &size));
+
+    uint32_t base = 0;
+    RIFER (veeprom_counter_base(p, &base));
+    *value = base + veeprom_counter_used(area, size);
+    return OK;
+}
+
+
+#ifdef VEEPROM_KEYS
+VEEPROM_MODULE(int)
+veeprom_write_key_unlocked(veeprom_t *v, const void *key, int key_length,
+        uint8_t *data, flash_chunk_t length) {
+    int slot = -1;
+    RIFER (veeprom_key_slot(v, key, key_length, &slot));
+    THROW (data != NULL, ERROR_NULLPTR);
+
+    flash_chunk_t header[VEEPROM_KEY_HEADER_CHUNKS(VEEPROM_KEY_MAX)];
+    int header_size = VEEPROM_KEY_HEADER_CHUNKS(key_length) * sizeof(flash_chunk_t);
+    THROW (length >= 0 && length < VEEPROM_LENGTH_LIMIT - header_size, VEEPROM_ERROR_LENGTH);
+    memset(header, 0, header_size);
+    ((uint8_t*)header)[0] = key_length;
+    memcpy((uint8_t*)header + 1, key, key_length);
+
+    flash_chunk_t id = 0;
+    if (slot != -1) {
+        id = *v->key_records[slot];
+    } else {
+        id = veeprom_key_new_id(v, veeprom_key_hash(key, key_length));
+        THROW (id != 0, VEEPROM_ERROR_NOMEM);
+    }
+
+    /* the key index is updated when the record is registered */
+    return veeprom_write_record(v, id, (uint8_t*)header, header_size, data, length, 0);
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_read_key_unlocked(veeprom_t *v, const void *key, int key_length, veeprom_read_t *read_buf) {
+    int slot = -1;
+    RIFER (veeprom_key_slot(v, key, key_length, &slot));
+    THROW (read_buf != NULL && read_buf->buf != NULL, ERROR_NULLPTR);
+    THROW (slot != -1, VEEPROM_ERROR_ID_NOTFOUND);
+
+    /* a writer may have deleted the key meanwhile, the read is retried then */
+    flash_chunk_t *p_id = v->key_records[slot];
+    THROW (p_id != NULL, VEEPROM_ERROR_ID_NOTFOUND);
+    read_buf->id = *p_id;
+    RIFER (veeprom_read_unlocked(v, read_buf));
+
+    int header_size = VEEPROM_KEY_HEADER_CHUNKS(key_length) * sizeof(flash_chunk_t);
+    THROW (read_buf->length >= header_size, VEEPROM_ERROR_DATA);
+    read_buf->length -= header_size;
+    memmove(read_buf->buf, read_buf->buf + header_size, read_buf->length);
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_delete_key_unlocked(veeprom_t *v, const void *key, int key_length) {
+    int slot = -1;
+    RIFER (veeprom_key_slot(v, key, key_length, &slot));
+    if (slot == -1)
+        return OK;
+
+    int index = veeprom_binsearch(v->ids, v->ids_size, *v->key_records[slot]);
+    THROW (index != -1, ERROR_DCNSTY);
+
+    flash_chunk_t *p = v->ids[index];
+    veeprom_update_begin(v);
+    int ret = veeprom_sortedrm(v->ids, &v->ids_size, index);
+    v->key_tags[slot] = VEEPROM_KEY_DELETED;
+    v->key_records[slot] = NULL;
+    veeprom_update_end(v);
+    RIFER (ret);
+
+    return veeprom_rm_data_dereg_pages(v, p);
+}
+
+
+VEEPROM_MODULE(flash_chunk_t*)
+veeprom_find_key_unlocked(veeprom_t *v, const void *key, int key_length) {
+    int slot = -1;
+    if (veeprom_key_slot(v, key, key_length, &slot) != OK || slot == -1)
+        return NULL;
+    return v->key_records[slot];
+}
+#endif
+
+
+VEEPROM_MODULE(int)
+veeprom_space_info_unlocked(veeprom_t *v, veeprom_space_t *info) {
+    THROW (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT);
+    THROW (info != NULL, ERROR_NULLPTR);
+
+    info->total_bytes = v->status.total_bytes;
+    info->free_bytes = v->status.free_bytes;
+    info->reclaimable_bytes = v->status.reclaimable_bytes;
+    info->live_bytes = v->status.live_bytes;
+    info->overhead_bytes = v->status.overhead_bytes;
+    info->unused_bytes = info->total_bytes - info->free_bytes - info->reclaimable_bytes
+        - v->status.live_bytes - v->status.overhead_bytes;
+
+    /* The new record is written before the previous one is removed,
+     * released pages are erased on allocation */
+    int max_length = (v->status.free_chunks - 1 - VEEPROM_CHECKSUM_CHUNKS) * sizeof(flash_chunk_t);
+    if (max_length < 0)
+        max_length = 0;
+    if ((flash_chunk_t)max_length > VEEPROM_LENGTH_LIMIT - 1)
+        max_length = (int)(VEEPROM_LENGTH_LIMIT - 1);
+    info->max_record_length = max_length;
+    return OK;
+}
+
+
+/* API functions */
+
+
+int veeprom_init(veeprom_t *v, flash_chunk_t *flash_start, int page_count) {
+    THROW (v != NULL, ERROR_NULLPTR);
+    memset(v->ids, 0, sizeof(v->ids));
+    memset(v->pages, 0, sizeof(v->pages));
+#ifdef VEEPROM_THREADS
+    v->seq = 0;
+    v->update_depth = 0;
+    VEEPROM_MUTEX_INIT(&v->update_mutex);
+#endif
+    VEEPROM_LOCK_INIT(&v->lock);
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_mount(v, flash_start, page_count);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_deinit(veeprom_t *v) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+#ifdef VEEPROM_ASYNC_ERASE
+    /* pages left are erased at mount */
+    if (VEEPROM_IS_INIT(v))
+        veeprom_erase_settle(v);
+#endif
+    memset(v->ids, 0, sizeof(v->ids));
+    v->ids_size = 0;
+    v->status.flags = VEEPROM_NOTINITIALIZED;
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    VEEPROM_LOCK_DESTROY(&v->lock);
+    VEEPROM_MUTEX_DESTROY(&v->update_mutex);
 
     return OK;
 }
 
 
-veeprom_status_t* veeprom_get_status() {
-    TRACE (VEEPROM_IS_INIT(), VEEPROM_ERROR_INIT, return NULL;)
-    return &m_status;
+int veeprom_clean(veeprom_t *v) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_clean_unlocked(v);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+#ifdef VEEPROM_ASYNC_ERASE
+int veeprom_poll(veeprom_t *v) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_poll_unlocked(v);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+#endif
+
+
+int veeprom_write(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_write_unlocked(v, id, data, length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_write_verify(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_write_verify_unlocked(v, id, data, length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_read(veeprom_t *v, veeprom_read_t *read_buf) {
+    int ret = OK;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_read_unlocked(v, read_buf);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+flash_chunk_t* veeprom_find(veeprom_t *v, flash_chunk_t id) {
+    flash_chunk_t *ret = NULL;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_find_unlocked(v, id);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+int veeprom_get_version(veeprom_t *v, flash_chunk_t id, uint32_t *version) {
+    int ret = OK;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_get_version_unlocked(v, id, version);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+int veeprom_write_if_version(veeprom_t *v, flash_chunk_t id, uint32_t expected_version,
+        uint8_t *data, flash_chunk_t length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_write_if_version_unlocked(v, id, expected_version, data, length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_delete(veeprom_t *v, flash_chunk_t id) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_delete_unlocked(v, id);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_append(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_append_unlocked(v, id, data, length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_counter_init(veeprom_t *v, flash_chunk_t id, uint32_t value) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_counter_init_unlocked(v, id, value);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_counter_inc(veeprom_t *v, flash_chunk_t id) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_counter_inc_unlocked(v, id);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_counter_get(veeprom_t *v, flash_chunk_t id, uint32_t *value) {
+    int ret = OK;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_counter_get_unlocked(v, id, value);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+#ifdef VEEPROM_KEYS
+int veeprom_write_key(veeprom_t *v, const void *key, int key_length,
+        uint8_t *data, flash_chunk_t length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_write_key_unlocked(v, key, key_length, data, length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+int veeprom_read_key(veeprom_t *v, const void *key, int key_length, veeprom_read_t *read_buf) {
+    int ret = OK;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_read_key_unlocked(v, key, key_length, read_buf);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+int veeprom_delete_key(veeprom_t *v, const void *key, int key_length) {
+    VEEPROM_WRITE_LOCK(&v->lock);
+    int ret = veeprom_delete_key_unlocked(v, key, key_length);
+    VEEPROM_WRITE_UNLOCK(&v->lock);
+    return ret;
+}
+
+
+flash_chunk_t* veeprom_find_key(veeprom_t *v, const void *key, int key_length) {
+    flash_chunk_t *ret = NULL;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_find_key_unlocked(v, key, key_length);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+#endif
+
+
+int veeprom_space_info(veeprom_t *v, veeprom_space_t *info) {
+    int ret = OK;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = veeprom_read_begin(v, attempt);
+        ret = veeprom_space_info_unlocked(v, info);
+        if (!veeprom_read_retry(v, seq))
+            return ret;
+    }
+}
+
+
+veeprom_status_t* veeprom_get_status(veeprom_t *v) {
+    TRACE (VEEPROM_IS_INIT(v), VEEPROM_ERROR_INIT, return NULL;)
+    return &v->status;
 }
 
 
-flash_chunk_t** veeprom_get_pages() {
-    return m_veeprom_pages;
+flash_chunk_t** veeprom_get_pages(veeprom_t *v) {
+    return v->pages;
 }
 
 
-int veeprom_get_pages_size() {
-    return m_veeprom_pages_size;
+int veeprom_get_pages_size(veeprom_t *v) {
+    return v->pages_size;
 }
 
 
-flash_chunk_t** veeprom_get_ids() {
-    return m_veeprom_ids;
+flash_chunk_t** veeprom_get_ids(veeprom_t *v) {
+    return v->ids;
 }
 
 
-int veeprom_get_ids_size() {
-    return m_veeprom_ids_size;
+int veeprom_get_ids_size(veeprom_t *v) {
+    return v->ids_size;
 }
 
-veeprom_cursor_t* veeprom_get_cursor() {
-    return &m_cursor;
+veeprom_cursor_t* veeprom_get_cursor(veeprom_t *v) {
+    return &v->cursor;
 }
@@ -40,15 +40,198 @@
 /*
  * Define the number of chunks depending on the platform.
  */
-#define TO_CHUNKS_16(v)  ((v + (v & 1)) >> 1)
-#define TO_CHUNKS_32(v)  (v / 4 + (((v & 0x03) >> 1) | (v & 0x01)))
-#define TO_CHUNKS_64(v)  (v / 8 + (((v & 0x07) >> 2) | ((v & 0x02) >> 1) | (v & 0x01) ))
+#define TO_CHUNKS_16(v)  (((v) + ((v) & 1)) >> 1)
+#define TO_CHUNKS_32(v)  ((v) / 4 + ((((v) & 0x03) >> 1) | ((v) & 0x01)))
+#define TO_CHUNKS_64(v)  ((v) / 8 + ((((v) & 0x07) >> 2) | (((v) & 0x02) >> 1) | ((v) & 0x01)))
+
+#if VEEPROM_CHUNK_WIDTH == 16
+#define TO_CHUNKS(v)     TO_CHUNKS_16(v)
+#elif VEEPROM_CHUNK_WIDTH == 32
+#define TO_CHUNKS(v)     TO_CHUNKS_32(v)
+#else
+#define TO_CHUNKS(v)     TO_CHUNKS_64(v)
+#endif
+
+
+/*
+ * Counter records keep the base value in the record and count increments
+ * in the erased tail of the page that follows the checksum. By default
+ * an increment programs the next chunk to zero (the only reprogramming
+ * allowed on STM32 flash). With VEEPROM_COUNTER_BITWISE every increment
+ * clears the next bit, which requires flash that allows to clear single
+ * bits of an already programmed chunk.
+ */
+#define VEEPROM_CHUNK_BITS            (sizeof(flash_chunk_t) * 8)
+#ifdef VEEPROM_COUNTER_BITWISE
+#define VEEPROM_COUNTER_UNITS         VEEPROM_CHUNK_BITS
+#else
+#define VEEPROM_COUNTER_UNITS         1
+#endif
+
+
+/*
+ * Appended data are stored as fragments in the erased tail of the last
+ * page of a record and then in extension pages.
+ * Fragment: length | flags, data, checksum.
+ * Extension page: header, id, VEEPROM_LENGTH_EXTENSION, fragments.
+ * An append consists of one or more fragments, the first one is marked
+ * with FIRST, all but the last one with MORE. A chain which is not
+ * completed (interrupted append) is ignored.
+ */
+#define VEEPROM_ERASED_CHUNK          ((flash_chunk_t)~0)
+#define VEEPROM_LENGTH_EXTENSION      VEEPROM_MAX_LENGTH
+#define VEEPROM_FRAGMENT_FIRST        ((flash_chunk_t)1 << (VEEPROM_CHUNK_BITS - 1))
+#define VEEPROM_FRAGMENT_MORE         ((flash_chunk_t)1 << (VEEPROM_CHUNK_BITS - 2))
+#define VEEPROM_FRAGMENT_LENGTH(c)    ((c) & (VEEPROM_FRAGMENT_MORE - 1))
+
+
+/*
+ * Records and fragments end with a checksum. By default it's XOR of
+ * the chunks, VEEPROM_CHECKSUM_CRC32 selects CRC-32 which takes
+ * VEEPROM_CHECKSUM_CHUNKS chunks. The checksum covers id, length and
+ * data of a record (length and data of a fragment) and is verified
+ * while the data are copied on read.
+ */
+#ifdef VEEPROM_CHECKSUM_CRC32
+typedef uint32_t veeprom_checksum_t;
+#define VEEPROM_CHECKSUM_CHUNKS       TO_CHUNKS(sizeof(uint32_t))
+#else
+typedef flash_chunk_t veeprom_checksum_t;
+#define VEEPROM_CHECKSUM_CHUNKS       1
+#endif
+
+/* Chunks occupied by a fragment with length bytes of data */
+#define VEEPROM_FRAGMENT_CHUNKS(length) \
+    (TO_CHUNKS(length) + 1 + VEEPROM_CHECKSUM_CHUNKS)
+
+
+/*
+ * With VEEPROM_COMPRESSION a record which becomes smaller is stored
+ * compressed by LZSS and the top bit of its length is set. The length
+ * holds the size of stored data: the original length (one chunk)
+ * followed by the compressed stream. The maximum length of a record is
+ * limited by VEEPROM_LENGTH_LIMIT.
+ */
+#ifdef VEEPROM_COMPRESSION
+#define VEEPROM_LENGTH_COMPRESSED     ((flash_chunk_t)1 << (VEEPROM_CHUNK_BITS - 1))
+#define VEEPROM_LENGTH_LIMIT          (VEEPROM_LENGTH_COMPRESSED - 1)
+#else
+#define VEEPROM_LENGTH_COMPRESSED     0
+#define VEEPROM_LENGTH_LIMIT          VEEPROM_MAX_LENGTH
+#endif
+#define VEEPROM_STORED_LENGTH(c)      ((c) & ~VEEPROM_LENGTH_COMPRESSED)
+
+
+/*
+ * Record data are programmed by flash_write_range() in spans up to the end
+ * of a page. Data which are not aligned to a chunk are packed into
+ * a buffer of VEEPROM_WRITE_STAGE chunks on the stack first.
+ */
+#ifndef VEEPROM_WRITE_STAGE
+#define VEEPROM_WRITE_STAGE 64
+#endif
+
+
+/*
+ * With VEEPROM_KEYS records may be addressed by keys: short strings or
+ * 32-bit values passed as 4 bytes, up to VEEPROM_KEY_MAX bytes. A keyed
+ * record gets an id from the upper half of ids (VEEPROM_KEY_ID_MIN and
+ * above, numeric API functions don't accept them) and keeps the key at
+ * the start of its data: key length byte, key, zero padding to a chunk.
+ * Keyed records are not compressed. Keys are looked up through an open
+ * addressing hash index of VEEPROM_KEY_SLOTS slots built at mount.
+ */
+#ifdef VEEPROM_KEYS
+#ifndef VEEPROM_KEY_MAX
+#define VEEPROM_KEY_MAX 32
+#endif
+#ifndef VEEPROM_KEY_SLOTS
+#define VEEPROM_KEY_SLOTS 256
+#endif
+#if VEEPROM_KEY_MAX < 1 || VEEPROM_KEY_MAX > 255
+#error "VEEPROM_KEY_MAX must be 1..255"
+#endif
+/* Probing goes by groups of 8 slots, the index keeps at most half live */
+#if (VEEPROM_KEY_SLOTS & (VEEPROM_KEY_SLOTS - 1)) || VEEPROM_KEY_SLOTS < 8 || \
+    VEEPROM_KEY_SLOTS < 2 * FLASH_PAGE_COUNT
+#error "VEEPROM_KEY_SLOTS must be a power of two, at least 8 and 2 * FLASH_PAGE_COUNT"
+#endif
+#define VEEPROM_KEY_ID_MIN            ((VEEPROM_MAX_ID >> 1) + 1)
+#define VEEPROM_KEY_HEADER_CHUNKS(n)  TO_CHUNKS((n) + 1)
+#else
+#define VEEPROM_KEY_ID_MIN            VEEPROM_MAX_ID
+#endif
 
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
 #define VEEPROM_BUSY_PAGE_FLAG -1
 
+/*
+ * With VEEPROM_BLANK_CHECK pages with ERASED status are checked to be
+ * completely erased at mount. Pages which are not (interrupted erase or
+ * program) are marked dirty and erased when they are allocated.
+ */
+#define VEEPROM_DIRTY_WORDS ((FLASH_PAGE_COUNT + 31) / 32)
+
+/*
+ * With VEEPROM_ASYNC_ERASE released pages are not erased at once. Their
+ * virtual number is programmed to 0, so they're erased at mount if power
+ * is lost, and they're erased one by one in the background by
+ * flash_erase_start() and flash_erase_poll() of the flash backend.
+ * Erases progress on writes and on veeprom_poll(), free pages which are
+ * erased already are allocated first.
+ *
+ * VEEPROM_DUAL_REGION splits the pages of a store into two halves for
+ * flash which reads one bank while it erases the other one (dual-bank
+ * parts, external flash): the halves have to lie in different banks.
+ * Pages are allocated in the active region, released pages there wait
+ * until the other region becomes active and only pages of the inactive
+ * region are erased. So recently written records stay readable while
+ * the flash erases. The active region changes when it has no erased
+ * pages left.
+ */
+#if defined(VEEPROM_DUAL_REGION) && !defined(VEEPROM_ASYNC_ERASE)
+#error "VEEPROM_DUAL_REGION requires VEEPROM_ASYNC_ERASE"
+#endif
+
+/*
+ * veeprom_write_verify() reads back the programmed record and rewrites it
+ * on fresh pages up to VEEPROM_VERIFY_RETRIES times on mismatch.
+ */
+#ifndef VEEPROM_VERIFY_RETRIES
+#define VEEPROM_VERIFY_RETRIES 2
+#endif
+
+/*
+ * With VEEPROM_THREADS calls which change the store take the lock of
+ * the store exclusively. Reading calls don't wait for them: they check
+ * the sequence of the store and retry if the index was changed meanwhile,
+ * after VEEPROM_READ_RETRIES attempts they take the update mutex, which
+ * a writer holds only while it changes the index, not while it programs
+ * or erases. lock.h of the application provides veeprom_lock_t,
+ * veeprom_mutex_t and their macros for its OS. veeprom_init() and veeprom_deinit() must not race with
+ * other calls on the same store.
+ */
+#ifdef VEEPROM_THREADS
+#include "lock.h"
+#ifndef VEEPROM_READ_RETRIES
+#define VEEPROM_READ_RETRIES 4
+#endif
+#else
+#define VEEPROM_LOCK_INIT(l)
+#define VEEPROM_LOCK_DESTROY(l)
+#define VEEPROM_READ_LOCK(l)
+#define VEEPROM_READ_UNLOCK(l)
+#define VEEPROM_WRITE_LOCK(l)
+#define VEEPROM_WRITE_UNLOCK(l)
+#define VEEPROM_MUTEX_INIT(m)
+#define VEEPROM_MUTEX_DESTROY(m)
+#define VEEPROM_MUTEX_LOCK(m)
+#define VEEPROM_MUTEX_UNLOCK(m)
+#define VEEPROM_YIELD()
+#endif
+
 #ifndef VEEPROM_DEBUG
 #define VEEPROM_MODULE(t) static t
 #else
@@ -62,13 +245,60 @@ typedef struct {
     flash_chunk_t *flash_start;
     int16_t next_alloc;
     int flags;
+    int live_bytes;
+    int overhead_bytes;
+    /* pages by state, kept up to date for veeprom_space_info() */
+    int total_bytes;
+    int free_bytes;
+    int reclaimable_bytes;
+    int free_chunks;        /* page space of pages which aren't busy */
+    /* first pages of records which have extension pages */
+    uint32_t extension_map[VEEPROM_DIRTY_WORDS];
+#ifdef VEEPROM_BLANK_CHECK
+    uint32_t dirty_map[VEEPROM_DIRTY_WORDS];
+#endif
+#ifdef VEEPROM_ASYNC_ERASE
+    uint32_t erase_map[VEEPROM_DIRTY_WORDS];   /* released, not erased yet */
+    int erasing;    /* physnum of the erase in progress or -1 */
+#endif
+#ifdef VEEPROM_DUAL_REGION
+    int active_region;
+#endif
+    /* read back bytes and mismatches found by veeprom_write_verify() */
+    int verify_bytes;
+    int verify_mismatches;
+    /*
+     * Repairs of the last mount: records with missing pages, pages of
+     * interrupted writes and removals released or erased.
+     */
+    int torn_records;
+    int recovered_pages;
 } veeprom_status_t;
 
 
+/*
+ * free + live + overhead + unused + reclaimable = total
+ * unused bytes are located on busy pages but don't hold live data or
+ * metadata: unused tails of pages, used counter areas, broken fragments.
+ * They are freed when the record is rewritten or deleted.
+ * reclaimable bytes are on released pages which are not erased yet
+ * (VEEPROM_ASYNC_ERASE), they become free when the erase completes.
+ */
+typedef struct {
+    int total_bytes;
+    int free_bytes;
+    int live_bytes;
+    int overhead_bytes;
+    int unused_bytes;
+    int reclaimable_bytes;
+    int max_record_length;
+} veeprom_space_t;
+
+
 typedef struct {
     flash_chunk_t *p_start_page;
     flash_chunk_t *p_current;
-    flash_chunk_t checksum;
+    veeprom_checksum_t checksum;
     int index;
 } veeprom_cursor_t;
 
@@ -88,31 +318,115 @@ enum {
 };
 
 
+/*
+ * Store instance: status, cursor and index of one area of flash.
+ * The storage is provided by the caller, stores don't share anything,
+ * so each one is a separate wear domain.
+ */
+typedef struct {
+    veeprom_status_t status;
+    veeprom_cursor_t cursor;
+    flash_chunk_t *ids[FLASH_PAGE_COUNT];
+    int ids_size;
+    flash_chunk_t *pages[FLASH_PAGE_COUNT];
+    int pages_size;
+    int page_count;
+    /* versions of records by the physnum of their first page */
+    uint32_t versions[FLASH_PAGE_COUNT];
+    uint32_t version;   /* the last one given out */
+#ifdef VEEPROM_KEYS
+    /* key index: tag of the key hash and record of every slot */
+    uint8_t key_tags[VEEPROM_KEY_SLOTS];
+    flash_chunk_t *key_records[VEEPROM_KEY_SLOTS];
+    int key_used;   /* live and deleted slots */
+#endif
+#ifdef VEEPROM_THREADS
+    veeprom_lock_t lock;
+    uint32_t seq;       /* odd while the index is being changed */
+    int update_depth;
+    veeprom_mutex_t update_mutex;   /* held while the index is being changed */
+#endif
+} veeprom_t;
+
+
 /* API functions */
 
-int veeprom_init(flash_chunk_t *flash_start);
+/*
+ * Mounts the store located at flash_start, page_count pages of the area
+ * belong to it (0 - the whole area).
+ */
+int veeprom_init(veeprom_t *v, flash_chunk_t *flash_start, int page_count);
+
+int veeprom_deinit(veeprom_t *v);
+
+int veeprom_write(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+
+/* Same as veeprom_write() but the programmed data are read back */
+int veeprom_write_verify(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+
+int veeprom_read(veeprom_t *v, veeprom_read_t *read_buf);
+
+int veeprom_delete(veeprom_t *v, flash_chunk_t id);
+
+/* The record stays at the returned address until it's rewritten or deleted */
+flash_chunk_t* veeprom_find(veeprom_t *v, flash_chunk_t id);
+
+/*
+ * Version of a record changes on every write, append and counter
+ * increment of it. Versions are given out by a counter of the store, so
+ * a record which is deleted and written again doesn't get an old version
+ * back. The counter starts at mount: versions are valid until the store
+ * is mounted again. Version 0 means the record does not exist.
+ */
+int veeprom_get_version(veeprom_t *v, flash_chunk_t id, uint32_t *version);
+
+int veeprom_write_if_version(veeprom_t *v, flash_chunk_t id, uint32_t expected_version,
+        uint8_t *data, flash_chunk_t length);
+
+/*
+ * Appends data to the record, creates the record if it doesn't exist.
+ * Must not be used for counter records: both use the tail of the page.
+ */
+int veeprom_append(veeprom_t *v, flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+
+int veeprom_counter_init(veeprom_t *v, flash_chunk_t id, uint32_t value);
 
-int veeprom_deinit();
+int veeprom_counter_inc(veeprom_t *v, flash_chunk_t id);
 
-int veeprom_write(flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+int veeprom_counter_get(veeprom_t *v, flash_chunk_t id, uint32_t *value);
 
-int veeprom_read(veeprom_read_t *read_buf);
+int veeprom_space_info(veeprom_t *v, veeprom_space_t *info);
 
-int veeprom_delete(flash_chunk_t id);
+#ifdef VEEPROM_KEYS
+int veeprom_write_key(veeprom_t *v, const void *key, int key_length,
+        uint8_t *data, flash_chunk_t length);
 
-flash_chunk_t* veeprom_find(flash_chunk_t id);
+/*
+ * read_buf->id is set to the id of the record. The buffer must have room
+ * for the key header besides the data: it's read and then cut off.
+ */
+int veeprom_read_key(veeprom_t *v, const void *key, int key_length, veeprom_read_t *read_buf);
+
+int veeprom_delete_key(veeprom_t *v, const void *key, int key_length);
 
-#ifdef CHIBIOS_ON
-int veeprom_clean();
+flash_chunk_t* veeprom_find_key(veeprom_t *v, const void *key, int key_length);
 #endif
 
+#ifdef VEEPROM_ASYNC_ERASE
+/* Advances erases of released pages, doesn't wait for the flash */
+int veeprom_poll(veeprom_t *v);
+#endif
+
+/* Erases all pages of the store and mounts it empty */
+int veeprom_clean(veeprom_t *v);
+
 
 /* For debug and testing purposes */
-veeprom_status_t* veeprom_get_status();
-flash_chunk_t**   veeprom_get_pages();
-int               veeprom_get_pages_size();
-flash_chunk_t**   veeprom_get_ids();
-int               veeprom_get_ids_size();
-veeprom_cursor_t* veeprom_get_cursor();
+veeprom_status_t* veeprom_get_status(veeprom_t *v);
+flash_chunk_t**   veeprom_get_pages(veeprom_t *v);
+int               veeprom_get_pages_size(veeprom_t *v);
+flash_chunk_t**   veeprom_get_ids(veeprom_t *v);
+int               veeprom_get_ids_size(veeprom_t *v);
+veeprom_cursor_t* veeprom_get_cursor(veeprom_t *v);
 
 #endif
@@ -21,13 +21,33 @@
 
 #include "types.h"
 
+/* Sector of the VEEPROM area, see FLASH_SECTORS in flash_cfg.h */
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} flash_sector_t;
+
 int init_blocks();
 
 int flash_invert(flash_chunk_t *p);
 
 int flash_write_chunk(flash_chunk_t data, flash_chunk_t *addr);
 
+/* Programs chunks consecutive chunks, all of them are located on one page */
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks);
+
 int flash_erase_page(flash_chunk_t *p);
 
+#ifdef VEEPROM_ASYNC_ERASE
+/*
+ * Starts erasing the page and returns. The flash erases one page at
+ * a time, an erase in progress (of another store) is finished first.
+ */
+int flash_erase_start(flash_chunk_t *p);
+
+/* Sets done when the erase of the page is over and returns its status then */
+int flash_erase_poll(flash_chunk_t *p, int *done);
+#endif
+
 
 #endif
@@ -0,0 +1,141 @@
+/*
+ *  lzss.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "lzss.h"
+
+/* flag byte and 8 matches */
+#define LZSS_GROUP (1 + 8 * 2)
+
+
+typedef struct {
+    veeprom_lzss_sink_t sink;
+    void *context;
+    uint8_t buf[VEEPROM_LZSS_STAGE + LZSS_GROUP];
+    int fill;
+    int total;
+} lzss_output_t;
+
+
+static int lzss_put(lzss_output_t *out, uint8_t *group, int length) {
+    out->total += length;
+    if (out->sink == NULL)
+        return 0;
+
+    memcpy(out->buf + out->fill, group, length);
+    out->fill += length;
+    if (out->fill >= VEEPROM_LZSS_STAGE) {
+        if (out->sink(out->context, out->buf, VEEPROM_LZSS_STAGE) != 0)
+            return -1;
+        out->fill -= VEEPROM_LZSS_STAGE;
+        memmove(out->buf, out->buf + VEEPROM_LZSS_STAGE, out->fill);
+    }
+    return 0;
+}
+
+
+int veeprom_lzss_compress(const uint8_t *src, int length, veeprom_lzss_sink_t sink,
+        void *context) {
+    lzss_output_t out = { .sink = sink, .context = context };
+    uint8_t group[LZSS_GROUP];
+    int items = 0;
+    int fill = 1;
+
+    group[0] = 0;
+    for (int i = 0; i < length;) {
+        int best = 0;
+        int offset = 0;
+        int max = length - i < VEEPROM_LZSS_MAX_MATCH ? length - i : VEEPROM_LZSS_MAX_MATCH;
+        int start = i > VEEPROM_LZSS_WINDOW ? i - VEEPROM_LZSS_WINDOW : 0;
+
+        for (int j = i - 1; j >= start && best < max; j--) {
+            int n = 0;
+            while (n < max && src[j + n] == src[i + n])
+                n++;
+            if (n > best) {
+                best = n;
+                offset = i - j;
+            }
+        }
+
+        if (best >= VEEPROM_LZSS_MIN_MATCH) {
+            group[fill++] = (offset - 1) & 0xFF;
+            group[fill++] = (((offset - 1) >> 8) << 4) | (best - VEEPROM_LZSS_MIN_MATCH);
+            i += best;
+        } else {
+            group[0] |= 1 << items;
+            group[fill++] = src[i++];
+        }
+
+        if (++items == 8) {
+            if (lzss_put(&out, group, fill) != 0)
+                return -1;
+            group[0] = 0;
+            items = 0;
+            fill = 1;
+        }
+    }
+
+    if (items > 0 && lzss_put(&out, group, fill) != 0)
+        return -1;
+    if (sink != NULL && out.fill > 0 && sink(context, out.buf, out.fill) != 0)
+        return -1;
+    return out.total;
+}
+
+
+void veeprom_lzss_decoder_init(veeprom_lzss_decoder_t *decoder, uint8_t *dst, int size) {
+    memset(decoder, 0, sizeof(veeprom_lzss_decoder_t));
+    decoder->dst = dst;
+    decoder->size = size;
+}
+
+
+int veeprom_lzss_decode(veeprom_lzss_decoder_t *d, const uint8_t *src, int length) {
+    for (int i = 0; i < length; i++) {
+        uint8_t c = src[i];
+
+        if (d->bits == 0) {
+            d->flags = c;
+            d->bits = 8;
+            continue;
+        }
+
+        if (d->flags & 1) {
+            if (d->pos >= d->size)
+                return -1;
+            d->dst[d->pos++] = c;
+        } else if (!d->half) {
+            d->low = c;
+            d->half = 1;
+            continue;
+        } else {
+            int offset = (d->low | ((c >> 4) << 8)) + 1;
+            int n = (c & 0x0F) + VEEPROM_LZSS_MIN_MATCH;
+            if (offset > d->pos || d->pos + n > d->size)
+                return -1;
+            for (; n > 0; n--, d->pos++)
+                d->dst[d->pos] = d->dst[d->pos - offset];
+            d->half = 0;
+        }
+
+        d->flags >>= 1;
+        d->bits--;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ *  lzss.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VEEPROM_LZSS_H
+#define VEEPROM_LZSS_H
+
+#include "types.h"
+
+/*
+ * LZSS with a small footprint.
+ * Stream: a flag byte followed by up to 8 items, bit i of the flags
+ * describes item i: 1 - literal byte, 0 - match of two bytes
+ *   offset - 1 (12 bits): low 8 bits, then high 4 bits | length - 3.
+ *
+ * The compressor searches matches in the source buffer itself and keeps
+ * only VEEPROM_LZSS_STAGE bytes of output, the decoder uses the output
+ * buffer as the window, so neither needs a separate window buffer.
+ * VEEPROM_LZSS_WINDOW (up to 4096) bounds the search cost.
+ */
+#ifndef VEEPROM_LZSS_WINDOW
+#define VEEPROM_LZSS_WINDOW 256
+#endif
+
+#define VEEPROM_LZSS_MIN_MATCH  3
+#define VEEPROM_LZSS_MAX_MATCH  (VEEPROM_LZSS_MIN_MATCH + 15)
+
+/* Output is passed in pieces of VEEPROM_LZSS_STAGE bytes except the last one */
+#define VEEPROM_LZSS_STAGE      32
+
+typedef int (*veeprom_lzss_sink_t)(void *context, uint8_t *buf, int length);
+
+typedef struct {
+    uint8_t *dst;
+    int size;
+    int pos;
+    uint8_t flags;
+    uint8_t bits;
+    uint8_t half;
+    uint8_t low;
+} veeprom_lzss_decoder_t;
+
+/*
+ * Returns the size of the compressed data. If sink is NULL the size is
+ * only calculated. A negative value is returned if sink fails. context
+ * is passed to sink.
+ */
+int veeprom_lzss_compress(const uint8_t *src, int length, veeprom_lzss_sink_t sink,
+        void *context);
+
+void veeprom_lzss_decoder_init(veeprom_lzss_decoder_t *decoder, uint8_t *dst, int size);
+
+/* Decodes the next piece of the stream, returns -1 if data are broken */
+int veeprom_lzss_decode(veeprom_lzss_decoder_t *decoder, const uint8_t *src, int length);
+
+#endif
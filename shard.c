@@ -0,0 +1,130 @@
+/*
+ *  shard.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "shard.h"
+#include "wrappers.h"
+#include "errdef.h"
+
+
+typedef struct {
+    veeprom_t *v;
+    const veeprom_region_t *region;
+    int ret;
+} veeprom_shard_mount_t;
+
+
+#ifdef VEEPROM_THREADS
+static VEEPROM_THREAD(veeprom_shard_mount, arg) {
+    veeprom_shard_mount_t *m = arg;
+    m->ret = veeprom_init(m->v, m->region->flash_start, m->region->page_count);
+    VEEPROM_THREAD_EXIT();
+}
+#endif
+
+
+/* Mounts the shards, returns the first error */
+VEEPROM_MODULE(int)
+veeprom_shards_mount(veeprom_shards_t *s, const veeprom_region_t *regions) {
+    veeprom_shard_mount_t mounts[VEEPROM_SHARDS_MAX];
+    for (int i = 0; i < s->count; i++)
+        mounts[i] = (veeprom_shard_mount_t){ &s->stores[i], &regions[i], OK };
+
+#ifdef VEEPROM_THREADS
+    veeprom_thread_t workers[VEEPROM_SHARDS_MAX];
+    int started = 0;
+    /* the last shard is mounted by the caller */
+    for (; started < s->count - 1; started++)
+        if (VEEPROM_THREAD_START(&workers[started], veeprom_shard_mount, &mounts[started]) != 0)
+            break;
+    for (int i = started; i < s->count; i++)
+        mounts[i].ret = veeprom_init(mounts[i].v, regions[i].flash_start, regions[i].page_count);
+    for (int i = 0; i < started; i++)
+        VEEPROM_THREAD_JOIN(&workers[i]);
+#else
+    for (int i = 0; i < s->count; i++)
+        mounts[i].ret = veeprom_init(mounts[i].v, regions[i].flash_start, regions[i].page_count);
+#endif
+
+    for (int i = 0; i < s->count; i++)
+        RIFER (mounts[i].ret);
+    return OK;
+}
+
+
+int veeprom_shards_init(veeprom_shards_t *s, const veeprom_region_t *regions, int count) {
+    THROW (s != NULL && regions != NULL, ERROR_NULLPTR);
+    THROW (count > 0 && count <= VEEPROM_SHARDS_MAX, ERROR_PARAM);
+    for (int i = 0; i < count; i++)
+        THROW (regions[i].flash_start != NULL, ERROR_NULLPTR);
+
+    s->count = count;
+    int ret = veeprom_shards_mount(s, regions);
+    if (ret != OK)
+        veeprom_shards_deinit(s);
+    return ret;
+}
+
+
+int veeprom_shards_deinit(veeprom_shards_t *s) {
+    for (int i = 0; i < s->count; i++)
+        veeprom_deinit(&s->stores[i]);
+    s->count = 0;
+    return OK;
+}
+
+
+/* Fibonacci hashing, ids which differ by the count of shards are spread too */
+veeprom_t* veeprom_shard(veeprom_shards_t *s, flash_chunk_t id) {
+    uint32_t h = (uint32_t)id * 2654435761u;
+    return &s->stores[(h >> 16) % s->count];
+}
+
+
+int veeprom_shards_write(veeprom_shards_t *s, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    return veeprom_write(veeprom_shard(s, id), id, data, length);
+}
+
+
+int veeprom_shards_read(veeprom_shards_t *s, veeprom_read_t *read_buf) {
+    THROW (read_buf != NULL, ERROR_NULLPTR);
+    return veeprom_read(veeprom_shard(s, read_buf->id), read_buf);
+}
+
+
+int veeprom_shards_delete(veeprom_shards_t *s, flash_chunk_t id) {
+    return veeprom_delete(veeprom_shard(s, id), id);
+}
+
+
+flash_chunk_t* veeprom_shards_find(veeprom_shards_t *s, flash_chunk_t id) {
+    return veeprom_find(veeprom_shard(s, id), id);
+}
+
+
+#ifdef VEEPROM_ASYNC_ERASE
+int veeprom_shards_poll(veeprom_shards_t *s) {
+    int ret = OK;
+    for (int i = 0; i < s->count; i++) {
+        int r = veeprom_poll(&s->stores[i]);
+        if (ret == OK)
+            ret = r;
+    }
+    return ret;
+}
+#endif
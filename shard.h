@@ -0,0 +1,70 @@
+/*
+ *  shard.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VEEPROM_SHARD_H
+#define VEEPROM_SHARD_H
+
+#include "eeprom.h"
+
+
+/*
+ * Sharded store. Records are spread by a hash of the id over up to
+ * VEEPROM_SHARDS_MAX independent stores, every one in its own region of
+ * flash (another chip or a part of the area). With VEEPROM_THREADS every
+ * shard is mounted by its own thread, otherwise one after another.
+ * A record always lives in the shard veeprom_shard() returns for its id,
+ * so the count of shards of a flash image must not change.
+ */
+#ifndef VEEPROM_SHARDS_MAX
+#define VEEPROM_SHARDS_MAX 8
+#endif
+
+
+typedef struct {
+    flash_chunk_t *flash_start;
+    int page_count;         /* 0 - the whole area */
+} veeprom_region_t;
+
+
+typedef struct {
+    veeprom_t stores[VEEPROM_SHARDS_MAX];
+    int count;
+} veeprom_shards_t;
+
+
+/* Mounts count shards located in regions, all or none are mounted */
+int veeprom_shards_init(veeprom_shards_t *s, const veeprom_region_t *regions, int count);
+
+int veeprom_shards_deinit(veeprom_shards_t *s);
+
+/* The store keeping the record id, for the rest of the store API */
+veeprom_t* veeprom_shard(veeprom_shards_t *s, flash_chunk_t id);
+
+int veeprom_shards_write(veeprom_shards_t *s, flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+
+int veeprom_shards_read(veeprom_shards_t *s, veeprom_read_t *read_buf);
+
+int veeprom_shards_delete(veeprom_shards_t *s, flash_chunk_t id);
+
+flash_chunk_t* veeprom_shards_find(veeprom_shards_t *s, flash_chunk_t id);
+
+#ifdef VEEPROM_ASYNC_ERASE
+/* veeprom_poll() of every shard */
+int veeprom_shards_poll(veeprom_shards_t *s);
+#endif
+
+#endif
@@ -20,7 +20,44 @@
 #define VEEPROM_TYPES_H
 
 #include <stdint.h>
+#include <inttypes.h>
 
 #define     __IO    volatile
 
+
+/*
+ * Width of a flash chunk in bits: 16 (default), 32 or 64. A chunk is
+ * the unit the flash is programmed by, every page status, virtual
+ * number, id and length takes one chunk.
+ */
+#ifndef VEEPROM_CHUNK_WIDTH
+#define VEEPROM_CHUNK_WIDTH 16
+#endif
+
+#if VEEPROM_CHUNK_WIDTH == 16
+typedef uint16_t flash_chunk_t;
+#define VEEPROM_FLASH_CHUNK_FMT       PRIu16
+#define VEEPROM_CHUNK_MAX             UINT16_C(0xFFFF)
+#define PAGE_RECEIVING                UINT16_C(0xAAAA)
+#elif VEEPROM_CHUNK_WIDTH == 32
+typedef uint32_t flash_chunk_t;
+#define VEEPROM_FLASH_CHUNK_FMT       PRIu32
+#define VEEPROM_CHUNK_MAX             UINT32_C(0xFFFFFFFF)
+#define PAGE_RECEIVING                UINT32_C(0xAAAAAAAA)
+#elif VEEPROM_CHUNK_WIDTH == 64
+typedef uint64_t flash_chunk_t;
+#define VEEPROM_FLASH_CHUNK_FMT       PRIu64
+#define VEEPROM_CHUNK_MAX             UINT64_C(0xFFFFFFFFFFFFFFFF)
+#define PAGE_RECEIVING                UINT64_C(0xAAAAAAAAAAAAAAAA)
+#else
+#error "VEEPROM_CHUNK_WIDTH must be 16, 32 or 64"
+#endif
+
+#define PAGE_ERASED                   VEEPROM_CHUNK_MAX
+#define PAGE_VALID                    0
+
+#define VEEPROM_MAX_ID                VEEPROM_CHUNK_MAX
+#define VEEPROM_MAX_LENGTH            VEEPROM_CHUNK_MAX
+#define VEEPROM_MAX_VIRTNUM           VEEPROM_CHUNK_MAX
+
 #endif
@@ -0,0 +1,469 @@
+/*
+ *  veeprom_coro.hpp
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VEEPROM_CORO_HPP
+#define VEEPROM_CORO_HPP
+
+/*
+ * C++20 coroutine facade for host software emulating many devices:
+ *
+ *     veeprom::executor ex(4);
+ *     veeprom::store s(ex);
+ *     int ret = co_await s.mount(flash, page_count);
+ *     ret = co_await s.write(id, data);
+ *     veeprom::read_result r = co_await s.read(id, buf);
+ *
+ * An operation runs the store call on the thread of the coroutine. The
+ * flash backend charges the simulated duration of the flash operations
+ * it does to that thread (sim_charge()), the coroutine then sleeps for
+ * the charged time on the timers of the executor, so the threads of
+ * the executor serve other coroutines meanwhile. All calls return
+ * the status of the store, there are no exceptions.
+ *
+ * The simulated backend working in RAM is defined by the source file
+ * which defines VEEPROM_CORO_SIM_BACKEND before the include. Without
+ * VEEPROM_THREADS a store must not be used by two coroutines at once.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "eeprom.h"
+#include "errnum.h"
+}
+
+
+namespace veeprom {
+
+/* Durations of flash operations for the simulated backend */
+struct latency_model {
+    uint32_t program_ns = 50000;    /* per chunk */
+    uint32_t erase_us = 20000;      /* per page */
+    uint32_t read_ns_per_byte = 0;
+};
+
+inline latency_model sim_latency;
+
+/* Flash time charged to the operation running on this thread */
+inline thread_local uint64_t sim_charged_ns;
+
+inline void sim_charge(uint64_t ns) {
+    sim_charged_ns += ns;
+}
+
+
+template <typename T = void>
+class task;
+
+
+namespace detail {
+
+struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        auto continuation = h.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+};
+
+
+template <typename T>
+struct promise : promise_base {
+    T value{};
+
+    task<T> get_return_object() noexcept;
+    void return_value(T v) { value = std::move(v); }
+};
+
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+};
+
+
+/* Started by executor::spawn(), destroys itself when it's over */
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+}
+
+
+/* Lazy coroutine, starts when it's awaited */
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    task(task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (h_)
+            h_.destroy();
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                h.promise().continuation = caller;
+                return h;
+            }
+
+            T await_resume() {
+                if constexpr (!std::is_void_v<T>)
+                    return std::move(h.promise().value);
+            }
+        };
+        return awaiter{h_};
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+
+template <typename T>
+inline task<T> detail::promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+
+inline task<void> detail::promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+
+/*
+ * Runs coroutines on a few threads. A coroutine waiting for flash is
+ * kept on the timers and doesn't take a thread.
+ */
+class executor {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit executor(unsigned threads) {
+        for (unsigned i = 0; i < threads; i++)
+            workers_.emplace_back([this] { run(); });
+    }
+
+    executor(const executor&) = delete;
+    executor& operator=(const executor&) = delete;
+
+    /* Waits for the spawned coroutines */
+    ~executor() {
+        wait_idle();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &t : workers_)
+            t.join();
+    }
+
+    void post(std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.push_back(h);
+        }
+        cv_.notify_one();
+    }
+
+    void post_at(clock::time_point when, std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            timers_.push(timer{when, timer_seq_++, h});
+        }
+        cv_.notify_one();
+    }
+
+    /* Moves the awaiting coroutine to a thread of the executor */
+    auto schedule() noexcept {
+        struct awaiter {
+            executor &ex;
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { ex.post(h); }
+            void await_resume() noexcept {}
+        };
+        return awaiter{*this};
+    }
+
+    /* Runs the task to its end, wait_idle() waits for it */
+    void spawn(task<void> t) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_++;
+        }
+        run_detached(*this, std::move(t));
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [this] { return active_ == 0; });
+    }
+
+private:
+    struct timer {
+        clock::time_point when;
+        uint64_t seq;       /* FIFO order of equal deadlines */
+        std::coroutine_handle<> h;
+
+        bool operator>(const timer &other) const {
+            return when != other.when ? when > other.when : seq > other.seq;
+        }
+    };
+
+    static detail::detached run_detached(executor &ex, task<void> t) {
+        co_await ex.schedule();
+        co_await std::move(t);
+        ex.task_done();
+    }
+
+    void task_done() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--active_ == 0)
+            idle_cv_.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            auto now = clock::now();
+            while (!timers_.empty() && timers_.top().when <= now) {
+                ready_.push_back(timers_.top().h);
+                timers_.pop();
+            }
+            if (!ready_.empty()) {
+                auto h = ready_.front();
+                ready_.pop_front();
+                lock.unlock();
+                h.resume();
+                lock.lock();
+                continue;
+            }
+            if (stop_)
+                break;
+            if (timers_.empty())
+                cv_.wait(lock);
+            else
+                cv_.wait_until(lock, timers_.top().when);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable idle_cv_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers_;
+    uint64_t timer_seq_ = 0;
+    int active_ = 0;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+
+struct read_result {
+    int status;
+    int length;
+};
+
+
+/*
+ * Awaiter of a store operation: op runs when the coroutine suspends,
+ * the coroutine is resumed after the flash time op was charged with.
+ */
+template <typename F>
+class flash_op {
+public:
+    using result_type = decltype(std::declval<F&>()());
+
+    flash_op(executor &ex, uint64_t &flash_ns, F op) : ex_(ex), flash_ns_(flash_ns), op_(std::move(op)) {}
+
+    bool await_ready() noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        sim_charged_ns = 0;
+        result_ = op_();
+        uint64_t ns = std::exchange(sim_charged_ns, 0);
+        if (ns == 0)
+            return false;
+        flash_ns_ += ns;
+        /* h may run on another thread from now on */
+        ex_.post_at(executor::clock::now() + std::chrono::nanoseconds(ns), h);
+        return true;
+    }
+
+    result_type await_resume() { return result_; }
+
+private:
+    executor &ex_;
+    uint64_t &flash_ns_;
+    F op_;
+    result_type result_{};
+};
+
+
+class store {
+public:
+    explicit store(executor &ex) : ex_(ex) {}
+    store(const store&) = delete;
+    store& operator=(const store&) = delete;
+    ~store() {
+        if (mounted_)
+            veeprom_deinit(&v_);
+    }
+
+    /* page_count pages at flash_start, 0 - the whole area */
+    auto mount(flash_chunk_t *flash_start, int page_count = 0) {
+        return make_op([this, flash_start, page_count] {
+            int ret = veeprom_init(&v_, flash_start, page_count);
+            /* the lock is set up even if the mount fails */
+            if (ret == OK)
+                mounted_ = true;
+            else
+                veeprom_deinit(&v_);
+            return ret;
+        });
+    }
+
+    auto write(flash_chunk_t id, std::span<const uint8_t> data) {
+        return make_op([this, id, data] {
+            return veeprom_write(&v_, id, const_cast<uint8_t*>(data.data()),
+                    static_cast<flash_chunk_t>(data.size()));
+        });
+    }
+
+    auto read(flash_chunk_t id, std::span<uint8_t> buf) {
+        return make_op([this, id, buf] {
+            veeprom_read_t read_buf = {};
+            read_buf.id = id;
+            read_buf.buf = buf.data();
+            read_buf.buf_size = static_cast<int>(buf.size());
+            int ret = veeprom_read(&v_, &read_buf);
+            if (ret == OK)
+                sim_charge(uint64_t(sim_latency.read_ns_per_byte) * read_buf.length);
+            return read_result{ret, ret == OK ? read_buf.length : 0};
+        });
+    }
+
+    auto remove(flash_chunk_t id) {
+        return make_op([this, id] { return veeprom_delete(&v_, id); });
+    }
+
+    /* For the rest of the C API, calls through it don't suspend */
+    veeprom_t* get() noexcept { return &v_; }
+
+    /* Simulated flash time of the operations so far */
+    uint64_t flash_ns() const noexcept { return flash_ns_; }
+
+private:
+    template <typename F>
+    flash_op<F> make_op(F op) {
+        return flash_op<F>(ex_, flash_ns_, std::move(op));
+    }
+
+    executor &ex_;
+    veeprom_t v_{};
+    bool mounted_ = false;
+    uint64_t flash_ns_ = 0;
+};
+
+}
+
+
+#ifdef VEEPROM_CORO_SIM_BACKEND
+/* Flash in RAM, every operation charges its simulated duration */
+extern "C" {
+
+int flash_write_chunk(flash_chunk_t data, flash_chunk_t *p) {
+    *p = data;
+    veeprom::sim_charge(veeprom::sim_latency.program_ns);
+    return OK;
+}
+
+
+int flash_write_range(flash_chunk_t *dst, const flash_chunk_t *src, int chunks) {
+    std::memcpy(dst, src, chunks * sizeof(flash_chunk_t));
+    veeprom::sim_charge(uint64_t(veeprom::sim_latency.program_ns) * chunks);
+    return OK;
+}
+
+
+int flash_erase_page(flash_chunk_t *p) {
+    std::memset(p, 0xFF, FLASH_PAGE_SIZE);
+    veeprom::sim_charge(uint64_t(veeprom::sim_latency.erase_us) * 1000);
+    return OK;
+}
+
+
+#ifdef VEEPROM_ASYNC_ERASE
+/* Background erases are over at once and cost the writer nothing */
+int flash_erase_start(flash_chunk_t *p) {
+    std::memset(p, 0xFF, FLASH_PAGE_SIZE);
+    return OK;
+}
+
+
+int flash_erase_poll(flash_chunk_t *p, int *done) {
+    *done = 1;
+    return OK;
+}
+#endif
+
+}
+#endif
+
+#endif
@@ -29,6 +29,8 @@ __errnum_message__(VEEPROM_ERROR_CHECKSUM, ("veeprom checksum error"))
 __errnum_message__(VEEPROM_ERROR_VIRTNUM, ("veeprom wrong virtnum"))
 __errnum_message__(VEEPROM_ERROR_ID_NOTFOUND, ("veeprom id not found"))
 __errnum_message__(VEEPROM_ERROR_BUFSIZE, ("veeprom insufficient buffer size"))
+__errnum_message__(VEEPROM_ERROR_VERSION, ("veeprom record version mismatch"))
+__errnum_message__(VEEPROM_ERROR_VERIFY, ("veeprom program verification error"))
 
 
 /*
@@ -0,0 +1,218 @@
+/*
+ *  writeback.c
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "writeback.h"
+#include "wrappers.h"
+#include "errdef.h"
+
+
+#define VEEPROM_WB_AGE(wb, e) ((wb)->now_ms - (e)->dirty_ms)
+
+
+VEEPROM_MODULE(veeprom_wb_entry_t*)
+veeprom_wb_find(veeprom_wb_t *wb, flash_chunk_t id) {
+    for (int i = 0; i < VEEPROM_WB_ENTRIES; i++) {
+        if (wb->entries[i].id == id)
+            return &wb->entries[i];
+    }
+    return NULL;
+}
+
+
+VEEPROM_MODULE(void)
+veeprom_wb_drop(veeprom_wb_t *wb, veeprom_wb_entry_t *e) {
+    wb->dirty_bytes -= e->length;
+    e->id = 0;
+}
+
+
+/* The entry stays dirty if the write fails */
+VEEPROM_MODULE(int)
+veeprom_wb_flush_entry(veeprom_wb_t *wb, veeprom_wb_entry_t *e) {
+    RIFER (veeprom_write(wb->v, e->id, e->data, e->length));
+    wb->stats.flash_writes++;
+    veeprom_wb_drop(wb, e);
+    return OK;
+}
+
+
+/*
+ * Writes dirty records which are at least min_age_ms old. All of them
+ * are tried, the first error is returned.
+ */
+VEEPROM_MODULE(int)
+veeprom_wb_flush_older(veeprom_wb_t *wb, uint32_t min_age_ms) {
+    int ret = OK;
+    for (int i = 0; i < VEEPROM_WB_ENTRIES; i++) {
+        veeprom_wb_entry_t *e = &wb->entries[i];
+        if (e->id == 0 || VEEPROM_WB_AGE(wb, e) < min_age_ms)
+            continue;
+        int r = veeprom_wb_flush_entry(wb, e);
+        if (ret == OK)
+            ret = r;
+    }
+    return ret;
+}
+
+
+/* Returns a free entry, the oldest dirty record is written if needed */
+VEEPROM_MODULE(int)
+veeprom_wb_alloc(veeprom_wb_t *wb, veeprom_wb_entry_t **entry) {
+    veeprom_wb_entry_t *oldest = NULL;
+    for (int i = 0; i < VEEPROM_WB_ENTRIES; i++) {
+        veeprom_wb_entry_t *e = &wb->entries[i];
+        if (e->id == 0) {
+            *entry = e;
+            return OK;
+        }
+        if (oldest == NULL || VEEPROM_WB_AGE(wb, e) > VEEPROM_WB_AGE(wb, oldest))
+            oldest = e;
+    }
+
+    RIFER (veeprom_wb_flush_entry(wb, oldest));
+    *entry = oldest;
+    return OK;
+}
+
+
+VEEPROM_MODULE(int)
+veeprom_wb_write_unlocked(veeprom_wb_t *wb, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    wb->stats.writes++;
+
+    veeprom_wb_entry_t *e = veeprom_wb_find(wb, id);
+    if (wb->write_through || length > VEEPROM_WB_RECORD_MAX) {
+        RIFER (veeprom_write(wb->v, id, data, length));
+        wb->stats.flash_writes++;
+        /* the dirty version is superseded */
+        if (e != NULL)
+            veeprom_wb_drop(wb, e);
+        return OK;
+    }
+
+    if (e != NULL) {
+        wb->dirty_bytes -= e->length;
+    } else {
+        RIFER (veeprom_wb_alloc(wb, &e));
+        e->id = id;
+        e->dirty_ms = wb->now_ms;
+    }
+    memcpy(e->data, data, length);
+    e->length = length;
+    wb->dirty_bytes += length;
+
+    if (wb->dirty_bytes > VEEPROM_WB_FLUSH_BYTES)
+        return veeprom_wb_flush_older(wb, 0);
+    return OK;
+}
+
+
+int veeprom_wb_init(veeprom_wb_t *wb, veeprom_t *v) {
+    THROW (wb != NULL && v != NULL, ERROR_NULLPTR);
+
+    memset(wb, 0, sizeof(*wb));
+    wb->v = v;
+    VEEPROM_MUTEX_INIT(&wb->mutex);
+    return OK;
+}
+
+
+int veeprom_wb_deinit(veeprom_wb_t *wb) {
+    int ret = veeprom_flush(wb);
+    VEEPROM_MUTEX_DESTROY(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_wb_write(veeprom_wb_t *wb, flash_chunk_t id, uint8_t *data, flash_chunk_t length) {
+    THROW (data != NULL, ERROR_NULLPTR);
+    THROW (id > 0 && id < VEEPROM_KEY_ID_MIN, VEEPROM_ERROR_ID);
+    THROW (length >= 0 && length < VEEPROM_LENGTH_LIMIT, VEEPROM_ERROR_LENGTH);
+
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    int ret = veeprom_wb_write_unlocked(wb, id, data, length);
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_wb_read(veeprom_wb_t *wb, veeprom_read_t *read_buf) {
+    THROW (read_buf != NULL && read_buf->buf != NULL, ERROR_NULLPTR);
+
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    veeprom_wb_entry_t *e = veeprom_wb_find(wb, read_buf->id);
+    if (e == NULL) {
+        VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+        return veeprom_read(wb->v, read_buf);
+    }
+
+    THROW (e->length <= read_buf->buf_size, VEEPROM_ERROR_BUFSIZE,
+            VEEPROM_MUTEX_UNLOCK(&wb->mutex));
+    memcpy(read_buf->buf, e->data, e->length);
+    read_buf->length = e->length;
+    read_buf->checksum = NULL;
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return OK;
+}
+
+
+int veeprom_wb_delete(veeprom_wb_t *wb, flash_chunk_t id) {
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    veeprom_wb_entry_t *e = veeprom_wb_find(wb, id);
+    if (e != NULL)
+        veeprom_wb_drop(wb, e);
+    int ret = veeprom_delete(wb->v, id);
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_wb_tick(veeprom_wb_t *wb, uint32_t now_ms) {
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    wb->now_ms = now_ms;
+    int ret = veeprom_wb_flush_older(wb, VEEPROM_WB_MAX_AGE_MS);
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_flush(veeprom_wb_t *wb) {
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    int ret = veeprom_wb_flush_older(wb, 0);
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_wb_power_fail(veeprom_wb_t *wb) {
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    wb->write_through = 1;
+    int ret = veeprom_wb_flush_older(wb, 0);
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return ret;
+}
+
+
+int veeprom_wb_get_stats(veeprom_wb_t *wb, veeprom_wb_stats_t *stats) {
+    THROW (stats != NULL, ERROR_NULLPTR);
+
+    VEEPROM_MUTEX_LOCK(&wb->mutex);
+    *stats = wb->stats;
+    VEEPROM_MUTEX_UNLOCK(&wb->mutex);
+    return OK;
+}
@@ -0,0 +1,102 @@
+/*
+ *  writeback.h
+ *
+ *  This file is a part of VirtEEPROM, emulation of EEPROM (Electrically
+ *  Erasable Programmable Read-only Memory).
+ *
+ *  (C) 2017  Nina Evseenko <anvoebugz@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VEEPROM_WRITEBACK_H
+#define VEEPROM_WRITEBACK_H
+
+#include "eeprom.h"
+
+
+/*
+ * Write-back buffer in front of a store. veeprom_wb_write() keeps
+ * the record dirty in RAM, a rewrite of a dirty record only replaces
+ * it there. Dirty records are written to the store:
+ * - all of them when they take more than VEEPROM_WB_FLUSH_BYTES,
+ * - the oldest one when all VEEPROM_WB_ENTRIES entries are taken,
+ * - by veeprom_wb_tick() when they are dirty for VEEPROM_WB_MAX_AGE_MS,
+ * - by veeprom_flush() and veeprom_wb_power_fail().
+ * Records longer than VEEPROM_WB_RECORD_MAX are written through.
+ * Time is passed by the application to veeprom_wb_tick() in ms.
+ */
+#ifndef VEEPROM_WB_ENTRIES
+#define VEEPROM_WB_ENTRIES 16
+#endif
+#ifndef VEEPROM_WB_RECORD_MAX
+#define VEEPROM_WB_RECORD_MAX 64
+#endif
+#ifndef VEEPROM_WB_FLUSH_BYTES
+#define VEEPROM_WB_FLUSH_BYTES 512
+#endif
+#ifndef VEEPROM_WB_MAX_AGE_MS
+#define VEEPROM_WB_MAX_AGE_MS 1000
+#endif
+
+
+typedef struct {
+    flash_chunk_t id;       /* 0 - the entry is free */
+    flash_chunk_t length;
+    uint32_t dirty_ms;      /* time the record became dirty */
+    uint8_t data[VEEPROM_WB_RECORD_MAX];
+} veeprom_wb_entry_t;
+
+
+typedef struct {
+    uint32_t writes;        /* veeprom_wb_write() calls */
+    uint32_t flash_writes;  /* records written to the store */
+} veeprom_wb_stats_t;
+
+
+typedef struct {
+    veeprom_t *v;
+    veeprom_wb_entry_t entries[VEEPROM_WB_ENTRIES];
+    int dirty_bytes;
+    uint32_t now_ms;
+    int write_through;      /* set by veeprom_wb_power_fail() */
+    veeprom_wb_stats_t stats;
+#ifdef VEEPROM_THREADS
+    veeprom_mutex_t mutex;
+#endif
+} veeprom_wb_t;
+
+
+int veeprom_wb_init(veeprom_wb_t *wb, veeprom_t *v);
+
+/* Writes dirty records, the buffer must not be used after that */
+int veeprom_wb_deinit(veeprom_wb_t *wb);
+
+int veeprom_wb_write(veeprom_wb_t *wb, flash_chunk_t id, uint8_t *data, flash_chunk_t length);
+
+/* Dirty records are read from RAM, read_buf->checksum is NULL then */
+int veeprom_wb_read(veeprom_wb_t *wb, veeprom_read_t *read_buf);
+
+int veeprom_wb_delete(veeprom_wb_t *wb, flash_chunk_t id);
+
+/* Writes records dirty for VEEPROM_WB_MAX_AGE_MS, now_ms only grows */
+int veeprom_wb_tick(veeprom_wb_t *wb, uint32_t now_ms);
+
+/* Writes all dirty records */
+int veeprom_flush(veeprom_wb_t *wb);
+
+/*
+ * For the power-fail handler of the application (not an interrupt):
+ * writes all dirty records, the following writes go to the store directly.
+ */
+int veeprom_wb_power_fail(veeprom_wb_t *wb);
+
+int veeprom_wb_get_stats(veeprom_wb_t *wb, veeprom_wb_stats_t *stats);
+
+#endif